@@ -13,6 +13,7 @@ lib_LTLIBRARIES = libeh.la
 
 libeh_la_SOURCES = \\
 	$(list *.c)
+libeh_la_LIBADD = \$(libev_LIBS)
 
 include_HEADERS = \\
 	$(list *.h)
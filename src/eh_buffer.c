@@ -28,8 +28,11 @@
  */
 
 #include "eh_buffer.h"
+#include "eh_fmt.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <stdio.h>
 #include <unistd.h>
 
 /** Moves the content of a buffer to it's head
@@ -82,11 +85,11 @@ ssize_t eh_buffer_read(struct eh_buffer *self, int fd, bool *eof)
 	if (eh_buffer_free(self) == 0)
 		return 0; /* full */
 
-	/* maintainance */
+	/* maintainance, read into the biggest free run */
 	if (self->base > 0) {
 		if (self->len == 0)
 			eh_buffer_reset(self);
-		else if (self->base + self->len == self->size)
+		else if (eh_buffer_freetail(self) < self->base)
 			eh_buffer_rebase(self);
 	}
 
@@ -153,3 +156,127 @@ ssize_t eh_buffer_appendz(struct eh_buffer *self, const char *str)
 
 	return eh_buffer_append(self, str, strlen(str));
 }
+
+/** Makes len bytes available at eh_buffer_next(), rebasing if needed
+ *
+ * Returns: where to write them, or NULL (ENOSPC) if they don't fit
+ */
+char *eh_buffer_reserve(struct eh_buffer *self, size_t len)
+{
+	assert(self != NULL);
+
+	if (len <= eh_buffer_freetail(self)) {
+		;
+	} else if (len > eh_buffer_free(self)) {
+		errno = ENOSPC;
+		return NULL;
+	} else if (self->len == 0) {
+		eh_buffer_reset(self);
+	} else {
+		eh_buffer_rebase(self);
+	}
+	return eh_buffer_next(self);
+}
+
+/** Appends formatted text, it needs a spare byte for vsnprintf()'s terminator */
+ssize_t eh_buffer_vprintf(struct eh_buffer *self, const char *fmt, va_list ap)
+{
+	va_list ap2;
+	int l;
+
+	assert(self != NULL);
+
+	va_copy(ap2, ap);
+	l = vsnprintf(eh_buffer_next(self), eh_buffer_freetail(self), fmt, ap2);
+	va_end(ap2);
+
+	if (unlikely(l < 0)) {
+		return -1;
+	} else if ((size_t)l >= eh_buffer_freetail(self)) {
+		/* only the free space was touched, try again after rebasing */
+		if (eh_buffer_reserve(self, l + 1) == NULL)
+			return -1;
+
+		vsnprintf(eh_buffer_next(self), eh_buffer_freetail(self), fmt, ap);
+	}
+
+	self->len += l;
+	return l;
+}
+
+ssize_t eh_buffer_printf(struct eh_buffer *self, const char *fmt, ...)
+{
+	va_list ap;
+	ssize_t l;
+
+	va_start(ap, fmt);
+	l = eh_buffer_vprintf(self, fmt, ap);
+	va_end(ap);
+
+	return l;
+}
+
+/*
+ * eh_fmt straight into the buffer
+ */
+ssize_t eh_buffer_append_u64(struct eh_buffer *self, uint64_t n)
+{
+	size_t l = eh_fmt_u64_len(n);
+	char *p = eh_buffer_reserve(self, l);
+
+	if (p == NULL)
+		return -1;
+
+	eh_fmt_u64(p, n);
+	self->len += l;
+	return l;
+}
+
+ssize_t eh_buffer_append_i64(struct eh_buffer *self, int64_t n)
+{
+	size_t l = eh_fmt_i64_len(n);
+	char *p = eh_buffer_reserve(self, l);
+
+	if (p == NULL)
+		return -1;
+
+	eh_fmt_i64(p, n);
+	self->len += l;
+	return l;
+}
+
+/* zero padded up to width */
+ssize_t eh_buffer_append_x64(struct eh_buffer *self, uint64_t n, unsigned width)
+{
+	size_t l = eh_fmt_x64_len(n);
+	char *p;
+
+	if (l < width)
+		l = width;
+	if ((p = eh_buffer_reserve(self, l)) == NULL)
+		return -1;
+
+	eh_fmt_x64_pad(p, n, width);
+	self->len += l;
+	return l;
+}
+
+ssize_t eh_buffer_append_double(struct eh_buffer *self, double v)
+{
+	char buf[EH_FMT_DOUBLE_SIZE];
+	size_t l;
+
+	/* the length isn't known in advance */
+	if (eh_buffer_freetail(self) >= sizeof(buf)) {
+		l = eh_fmt_double(eh_buffer_next(self), v);
+		self->len += l;
+		return l;
+	}
+
+	l = eh_fmt_double(buf, v);
+	if (eh_buffer_append(self, buf, l) < 0) {
+		errno = ENOSPC;
+		return -1;
+	}
+	return l;
+}
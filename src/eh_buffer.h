@@ -32,8 +32,11 @@
 #include <string.h>	/* memmove() */
 #include <stdint.h>	/* uint8_t */
 #include <stdbool.h>	/* bool */
+#include <stdarg.h>	/* va_list */
 #include <sys/types.h>	/* size_t */
 
+#include "eh.h"		/* TYPECHECK_PRINTF */
+
 struct eh_buffer {
 	char *buf;
 
@@ -64,4 +67,25 @@ static inline void eh_buffer_reset(struct eh_buffer *self)
 ssize_t eh_buffer_append(struct eh_buffer *self, const char *data, size_t len);
 ssize_t eh_buffer_appendz(struct eh_buffer *self, const char *str);
 
+/*
+ * formatting in place, at eh_buffer_next(). when the output doesn't fit
+ * they return -1 (ENOSPC) and the content is left as it was.
+ */
+char *eh_buffer_reserve(struct eh_buffer *self, size_t len);
+
+/** Accounts for len bytes written at eh_buffer_next() */
+static inline void eh_buffer_commit(struct eh_buffer *self, size_t len)
+{
+	self->len += len;
+}
+
+ssize_t eh_buffer_vprintf(struct eh_buffer *self, const char *fmt, va_list ap);
+ssize_t eh_buffer_printf(struct eh_buffer *self, const char *fmt, ...)
+	TYPECHECK_PRINTF(2, 3);
+
+ssize_t eh_buffer_append_u64(struct eh_buffer *self, uint64_t n);
+ssize_t eh_buffer_append_i64(struct eh_buffer *self, int64_t n);
+ssize_t eh_buffer_append_x64(struct eh_buffer *self, uint64_t n, unsigned width);
+ssize_t eh_buffer_append_double(struct eh_buffer *self, double v);
+
 #endif
@@ -28,6 +28,7 @@
  */
 #include "eh_connection.h"
 #include "eh_watcher.h"
+#include "eh_alloc.h"
 #include "eh.h"
 
 #ifdef HAVE_CONFIG_H
@@ -35,11 +36,328 @@
 #endif
 
 #define READ_BUF_SIZE	4096
+#define READ_LOOPS	8	/* reads per event while they fill the buffer */
 
 #include <unistd.h>
+#include <string.h>
 #include <errno.h>
 #include <assert.h>
 
+#include <sys/uio.h>
+
+/*
+ * overflow, for the odd message that doesn't fit in read_buffer. when
+ * on_read() asks for more with the buffer full, what's pending moves to a
+ * bigger block and reads continue there. the block doubles as needed, up
+ * to overflow_max, and once on_read() consumes enough for the rest to fit
+ * in read_buffer again it goes back there.
+ *
+ * a hot connection, one whose reads fill the buffer READ_LOOPS times in a
+ * row, moves up a block the same way so it needs fewer reads, and goes
+ * back once a read drains the socket.
+ *
+ * blocks are powers of 2 from 64KiB, and released ones are kept per thread
+ * for the next big message.
+ */
+#define OVERFLOW_MIN_SHIFT	16
+#define OVERFLOW_CLASSES	16
+#define OVERFLOW_POOLED		2
+
+static __thread struct {
+	char *block[OVERFLOW_POOLED];
+	unsigned count;
+} pool[OVERFLOW_CLASSES];
+
+static int overflow_class(size_t size)
+{
+	for (int c = 0; c < OVERFLOW_CLASSES; c++) {
+		if (size == (size_t)1 << (OVERFLOW_MIN_SHIFT + c))
+			return c;
+	}
+	return -1;
+}
+
+static char *overflow_get(size_t size)
+{
+	int c = overflow_class(size);
+
+	if (c >= 0 && pool[c].count > 0)
+		return pool[c].block[--pool[c].count];
+	return eh_alloc(size);
+}
+
+static void overflow_put(char *block, size_t size)
+{
+	int c = overflow_class(size);
+
+	if (c >= 0 && pool[c].count < OVERFLOW_POOLED)
+		pool[c].block[pool[c].count++] = block;
+	else
+		eh_free(block);
+}
+
+static void overflow_release(struct eh_connection *self)
+{
+	overflow_put(self->overflow, self->overflow_size);
+	self->overflow = NULL;
+	self->overflow_len = self->overflow_size = 0;
+}
+
+/* moves what's pending to a bigger block. 0:ok, -1:errno */
+static int overflow_grow(struct eh_connection *self)
+{
+	struct eh_buffer *buf = &self->read_buffer;
+	size_t len, size, new_size = (size_t)1 << OVERFLOW_MIN_SHIFT;
+	const char *data;
+	char *p;
+
+	if (self->overflow) {
+		data = self->overflow;
+		len = self->overflow_len;
+		size = self->overflow_size;
+	} else {
+		data = eh_buffer_data(buf);
+		len = eh_buffer_len(buf);
+		size = buf->size;
+	}
+
+	if (size >= self->overflow_max) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	while (new_size <= size)
+		new_size <<= 1;
+	if (new_size > self->overflow_max)
+		new_size = self->overflow_max;
+
+	if ((p = overflow_get(new_size)) == NULL)
+		return -1;
+	memcpy(p, data, len);
+
+	if (self->overflow)
+		overflow_put(self->overflow, self->overflow_size);
+	else
+		eh_buffer_reset(buf);
+
+	self->overflow = p;
+	self->overflow_len = len;
+	self->overflow_size = new_size;
+	return 0;
+}
+
+static ssize_t overflow_read(struct eh_connection *self, int fd, bool *eof)
+{
+	ssize_t l = read(fd, self->overflow + self->overflow_len,
+			 self->overflow_size - self->overflow_len);
+
+	if (l > 0)
+		self->overflow_len += l;
+	else if (l == 0)
+		*eof = true;
+	return l;
+}
+
+static inline bool over_budget(struct eh_connection *self, size_t bytes,
+				unsigned messages)
+{
+	return (self->read_budget_bytes && bytes >= self->read_budget_bytes) ||
+		(self->read_budget_messages && messages >= self->read_budget_messages);
+}
+
+/* same as with read_buffer, 1:over budget, 0:ok, -1:close */
+static int overflow_dispatch(struct eh_connection *self)
+{
+	struct eh_connection_cb *cb = self->cb;
+	size_t off = 0, len = self->overflow_len;
+	unsigned messages = 0;
+	int ret = 0;
+	ssize_t l;
+
+	while (off < len && !self->closing) {
+		if (over_budget(self, off, messages)) {
+			ret = 1;
+			break;
+		}
+
+		l = cb->on_read(self, self->overflow + off, len - off);
+
+		if (l < 0)
+			return -1;
+		else if (l == 0)
+			break;
+		else
+			off += l;
+		messages++;
+	}
+
+	len -= off;
+	if (!self->read_hot && len <= self->read_buffer.size) {
+		/* back to the small buffer */
+		eh_buffer_reset(&self->read_buffer);
+		eh_buffer_append(&self->read_buffer, self->overflow + off, len);
+		overflow_release(self);
+	} else if (off > 0) {
+		memmove(self->overflow, self->overflow + off, len);
+		self->overflow_len = len;
+	}
+	return ret;
+}
+
+/*
+ * hands what's buffered to on_read() until it wants more or the budget
+ * is spent. 1:over budget, 0:ok, -1:close
+ */
+static int read_dispatch(struct eh_connection *self)
+{
+	struct eh_connection_cb *cb = self->cb;
+	struct eh_buffer *buf = &self->read_buffer;
+	size_t bytes = 0;
+	unsigned messages = 0;
+	ssize_t l;
+
+	if (self->overflow)
+		return overflow_dispatch(self);
+
+	if (cb->on_read == NULL) {
+		eh_buffer_reset(buf);
+		return 0;
+	}
+
+	while ((l = eh_buffer_len(buf)) && !self->closing) {
+		if (over_budget(self, bytes, messages))
+			return 1;
+
+		l = cb->on_read(self, eh_buffer_data(buf), l);
+
+		if (l < 0)
+			return -1;
+		else if (l == 0)
+			break;
+
+		eh_buffer_skip(buf, l);
+		bytes += l;
+		messages++;
+	}
+	return 0;
+}
+
+/* every read of an event filled the buffer, a bigger one saves reads */
+static void read_heat(struct eh_connection *self)
+{
+	if (self->overflow_max > 0 && self->cb->on_read &&
+	    overflow_grow(self) == 0)
+		self->read_hot = true;
+}
+
+/* a read drained the socket, back to read_buffer once the rest fits */
+static void read_cool(struct eh_connection *self)
+{
+	self->read_hot = false;
+
+	if (self->overflow && self->overflow_len <= self->read_buffer.size) {
+		eh_buffer_reset(&self->read_buffer);
+		eh_buffer_append(&self->read_buffer, self->overflow, self->overflow_len);
+		overflow_release(self);
+	}
+}
+
+/*
+ * over budget, the rest waits for the next loop iteration. the resume
+ * watcher has top priority so busy loops don't starve it, and the read
+ * watcher is held until then.
+ */
+static void read_defer(struct eh_connection *self)
+{
+	if (eh_io_active(&self->read_watcher))
+		eh_io_stop(&self->read_watcher, self->loop);
+	if (!eh_idle_active(&self->resume_watcher))
+		eh_idle_start(&self->resume_watcher, self->loop);
+}
+
+/*
+ * shared payloads are queued by reference. write_buffer keeps the bytes
+ * written in between: each ref knows how many buffered bytes go before
+ * it, and whatever is buffered past the last ref goes after it. writev()
+ * sends it all in order.
+ */
+#define QUEUE_IOV	64
+
+struct eh_connection_ref {
+	struct eh_connection_ref *next;
+	struct eh_payload *payload;
+	size_t off;		/* already sent */
+	size_t buffered;	/* write_buffer bytes before it */
+};
+
+static void queue_pop(struct eh_connection *self)
+{
+	struct eh_connection_ref *ref = self->queue;
+
+	if ((self->queue = ref->next) == NULL)
+		self->queue_tail = &self->queue;
+
+	self->queue_bytes -= ref->payload->len - ref->off;
+	self->queue_buffered -= ref->buffered;
+	eh_payload_put(ref->payload);
+	eh_free(ref);
+}
+
+static ssize_t queue_write(struct eh_connection *self, int fd)
+{
+	struct eh_buffer *buf = &self->write_buffer;
+	struct eh_connection_ref *ref;
+	const char *data = eh_buffer_data(buf);
+	size_t rest = eh_buffer_len(buf);
+	struct iovec v[QUEUE_IOV];
+	ssize_t l, wc;
+	int n = 0;
+
+	for (ref = self->queue; ref && n + 2 <= QUEUE_IOV; ref = ref->next) {
+		if (ref->buffered > 0) {
+			v[n++] = (struct iovec) { (char *)data, ref->buffered };
+			data += ref->buffered;
+			rest -= ref->buffered;
+		}
+		v[n++] = (struct iovec) { ref->payload->data + ref->off,
+			ref->payload->len - ref->off };
+	}
+	if (ref == NULL && rest > 0)
+		v[n++] = (struct iovec) { (char *)data, rest };
+
+	if ((wc = l = writev(fd, v, n)) <= 0)
+		return wc;
+
+	/* account for what went out, in the same order */
+	while ((ref = self->queue) != NULL && l > 0) {
+		size_t k = ref->buffered;
+
+		if (k > 0) {
+			if (k > (size_t)l)
+				k = l;
+			eh_buffer_skip(buf, k);
+			ref->buffered -= k;
+			self->queue_buffered -= k;
+			if ((l -= k) == 0)
+				break;
+		}
+
+		k = ref->payload->len - ref->off;
+		if (k > (size_t)l) {
+			ref->off += l;
+			self->queue_bytes -= l;
+			l = 0;
+		} else {
+			l -= k;
+			queue_pop(self);
+		}
+	}
+	if (l > 0)
+		eh_buffer_skip(buf, l);
+
+	return wc;
+}
+
 /* callbacks */
 static void read_callback(struct ev_loop *loop, ev_io *w, int revents)
 {
@@ -52,11 +370,21 @@ static void read_callback(struct ev_loop *loop, ev_io *w, int revents)
 
 	if (revents & EV_READ) {
 		struct eh_buffer *buf = &self->read_buffer;
-		bool eof = false;
+		int loops = READ_LOOPS;
+		bool eof = false, filled;
 		ssize_t l;
 
-		if (eh_buffer_free(buf) == 0) {
+		self->read_events++;
+again:
+		if (self->overflow ? self->overflow_len == self->overflow_size :
+		    eh_buffer_free(buf) == 0) {
 			bool close = true;
+
+			/* on_read() wants more, continue in a bigger block */
+			if (self->overflow_max > 0 && cb->on_read &&
+			    overflow_grow(self) == 0)
+				goto try_read;
+
 			if (cb->on_error)
 				close = cb->on_error(self, EH_CONNECTION_READ_FULL);
 			if (close)
@@ -64,28 +392,44 @@ static void read_callback(struct ev_loop *loop, ev_io *w, int revents)
 		}
 
 try_read:
-		l = eh_buffer_read(buf, w->fd, &eof);
+		self->read_calls++;
+		if (self->overflow) {
+			l = overflow_read(self, w->fd, &eof);
+			filled = (self->overflow_len == self->overflow_size);
+		} else {
+			l = eh_buffer_read(buf, w->fd, &eof);
+			filled = (eh_buffer_freetail(buf) == 0);
+		}
+		if (l > 0)
+			self->read_bytes += l;
+		if (!filled)
+			self->read_hot = false; /* overflow_dispatch() settles it */
 
 		if (l == 0) { /* EOF */
 			goto terminate;
 		} else if (l > 0) { /* has new data, pass over */
-			if (cb->on_read) {
-				while ((l = eh_buffer_len(buf))) {
-					l = cb->on_read(self, eh_buffer_data(buf), l);
-
-					if (l < 0)
-						goto terminate;
-					else if (l == 0)
-						break;
-					else
-						eh_buffer_skip(buf, l);
-				}
-			} else {
-				eh_buffer_reset(buf);
-			}
+			int ret = read_dispatch(self);
+
+			/*
+			 * a short read means the socket is drained, a full one
+			 * likely left more behind. take it now instead of
+			 * waiting for another wakeup.
+			 */
+			if (ret < 0)
+				goto terminate;
+			else if (self->closing)
+				return; /* eh_connection_close() from on_read() */
+			else if (ret > 0)
+				read_defer(self);
+			else if (filled && --loops > 0)
+				goto again;
+			else if (filled)
+				read_heat(self);
 		} else if (errno == EINTR) {
 			goto try_read;
-		} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			read_cool(self);
+		} else {
 			bool close = true;
 			if (cb->on_error)
 				close = cb->on_error(self, EH_CONNECTION_READ_ERROR);
@@ -108,6 +452,28 @@ terminate:
 	eh_connection_finish(self);
 }
 
+static void resume_callback(struct ev_loop *loop, ev_idle *w, int UNUSED(revents))
+{
+	struct eh_connection *self = w->data;
+	int ret;
+
+	assert(self->loop == loop);
+
+	eh_idle_stop(w, loop);
+	if (self->closing) {
+		eh_connection_finish(self);
+		return;
+	}
+	eh_io_start(&self->read_watcher, loop);
+
+	if ((ret = read_dispatch(self)) < 0) {
+		eh_connection_stop(self);
+		eh_connection_finish(self);
+	} else if (ret > 0) {
+		read_defer(self);
+	}
+}
+
 static void write_callback(struct ev_loop *loop, ev_io *w, int revents)
 {
 	struct eh_connection *self = w->data;
@@ -117,11 +483,14 @@ static void write_callback(struct ev_loop *loop, ev_io *w, int revents)
 
 	if (revents & EV_WRITE) {
 		ssize_t wc;
-		if (eh_buffer_len(&self->write_buffer) == 0)
+		if (eh_connection_pending(self) == 0)
 			goto stop_it;
 
 try_write:
-		wc = eh_buffer_write(&self->write_buffer, w->fd);
+		if (self->queue)
+			wc = queue_write(self, w->fd);
+		else
+			wc = eh_buffer_write(&self->write_buffer, w->fd);
 		if (wc < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
 			bool close = true;
 			if (errno == EINTR)
@@ -133,7 +502,7 @@ try_write:
 				goto terminate;
 		}
 
-		if (eh_buffer_len(&self->write_buffer) == 0) {
+		if (eh_connection_pending(self) == 0) {
 stop_it:
 			ev_io_stop(loop, w);
 		}
@@ -179,12 +548,87 @@ try_append:
 			return -1;
 	}
 
-	if (!eh_io_active(&self->write_watcher))
+	if (!self->closing && !eh_io_active(&self->write_watcher))
 		ev_io_start(self->loop, &self->write_watcher);
 
 	return len;
 }
 
+/** Queues a shared payload after whatever was written before
+ *
+ * It takes its own reference, dropped once sent or when the connection
+ * is finished.
+ */
+ssize_t eh_connection_write_payload(struct eh_connection *self,
+				    struct eh_payload *payload)
+{
+	struct eh_connection_ref *ref;
+	size_t buffered = eh_buffer_len(&self->write_buffer);
+
+	assert(payload != NULL);
+
+	if (payload->len == 0)
+		return 0;
+	else if ((ref = eh_alloc(sizeof(*ref))) == NULL)
+		return -1;
+
+	ref->next = NULL;
+	ref->payload = eh_payload_get(payload);
+	ref->off = 0;
+	ref->buffered = buffered - self->queue_buffered;
+
+	*self->queue_tail = ref;
+	self->queue_tail = &ref->next;
+	self->queue_bytes += payload->len;
+	self->queue_buffered = buffered;
+
+	if (!self->closing && !eh_io_active(&self->write_watcher))
+		ev_io_start(self->loop, &self->write_watcher);
+
+	return payload->len;
+}
+
+/** Formats straight into the write buffer, all or nothing */
+ssize_t eh_connection_vwritef(struct eh_connection *self, const char *fmt, va_list ap)
+{
+	struct eh_buffer *buffer = &self->write_buffer;
+	struct eh_connection_cb *cb = self->cb;
+	ssize_t l;
+
+	assert(self->cb != NULL);
+
+try_append:
+	if ((l = eh_buffer_vprintf(buffer, fmt, ap)) < 0) {
+		bool close = true;
+		if (errno == ENOSPC && cb->on_error)
+			close = cb->on_error(self, EH_CONNECTION_WRITE_FULL);
+
+		if (!close)
+			goto try_append;
+		else
+			return -1;
+	} else if (l == 0) {
+		return 0;
+	}
+
+	if (!self->closing && !eh_io_active(&self->write_watcher))
+		ev_io_start(self->loop, &self->write_watcher);
+
+	return l;
+}
+
+ssize_t eh_connection_writef(struct eh_connection *self, const char *fmt, ...)
+{
+	va_list ap;
+	ssize_t l;
+
+	va_start(ap, fmt);
+	l = eh_connection_vwritef(self, fmt, ap);
+	va_end(ap);
+
+	return l;
+}
+
 /* exported */
 int eh_connection_init(struct eh_connection *self, int fd,
 		       struct eh_connection_cb *cb,
@@ -199,6 +643,22 @@ int eh_connection_init(struct eh_connection *self, int fd,
 
 	eh_io_init(&self->read_watcher, read_callback, self, fd, EH_READ);
 	eh_io_init(&self->write_watcher, write_callback, self, fd, EH_WRITE);
+	eh_idle_init(&self->resume_watcher, resume_callback, self);
+	eh_watcher_set_priority(&self->resume_watcher, EV_MAXPRI);
+
+	self->read_budget_bytes = 0;
+	self->read_budget_messages = 0;
+
+	self->read_events = self->read_calls = self->read_bytes = 0;
+
+	self->queue = NULL;
+	self->queue_tail = &self->queue;
+	self->queue_bytes = self->queue_buffered = 0;
+
+	self->overflow = NULL;
+	self->overflow_len = self->overflow_size = self->overflow_max = 0;
+	self->read_hot = false;
+	self->closing = false;
 
 	self->cb = cb;
 	return 1;
@@ -211,14 +671,53 @@ void eh_connection_finish(struct eh_connection *self)
 	assert(self->cb != NULL);
 	assert(!eh_io_active(&self->read_watcher));
 	assert(!eh_io_active(&self->write_watcher));
+	assert(!eh_idle_active(&self->resume_watcher));
 
 	close(self->read_watcher.fd);
 
+	if (self->overflow)
+		overflow_release(self);
+	while (self->queue)
+		queue_pop(self);
+
 	/* on_close() is mandatory, you need to release the connection somehow */
 	assert(cb->on_close);
 	cb->on_close(self);
 }
 
+/** Lets messages grow past read_buffer, up to max bytes
+ *
+ * Only when on_read() returns 0 with read_buffer full, or while reads
+ * keep filling it. 0 disables it again, the default, and then a full
+ * buffer is EH_CONNECTION_READ_FULL.
+ * A message already in a bigger block stays there until consumed.
+ */
+void eh_connection_set_overflow(struct eh_connection *self, size_t max)
+{
+	self->overflow_max = max;
+}
+
+/** Releases the calling thread's spare overflow blocks */
+void eh_connection_overflow_flush(void)
+{
+	for (int c = 0; c < OVERFLOW_CLASSES; c++) {
+		while (pool[c].count > 0)
+			eh_free(pool[c].block[--pool[c].count]);
+	}
+}
+
+/** Caps the on_read() work done per callback
+ *
+ * Once bytes or messages are consumed the rest is left for the next loop
+ * iteration, so a pipelining peer can't hold the loop. 0 is unlimited.
+ */
+void eh_connection_set_budget(struct eh_connection *self, size_t bytes,
+			      unsigned messages)
+{
+	self->read_budget_bytes = bytes;
+	self->read_budget_messages = messages;
+}
+
 void eh_connection_start(struct eh_connection *self, struct ev_loop *loop)
 {
 	assert(loop != NULL || self->loop != NULL);
@@ -228,13 +727,39 @@ void eh_connection_start(struct eh_connection *self, struct ev_loop *loop)
 	else
 		loop = self->loop;
 
+	if (self->closing)
+		return;
+
 	if (!eh_io_active(&self->read_watcher))
 		ev_io_start(loop, &self->read_watcher);
 
-	if (eh_buffer_len(&self->write_buffer) > 0 && !eh_io_active(&self->write_watcher))
+	/* whatever was left buffered when stopped */
+	if ((eh_buffer_len(&self->read_buffer) > 0 || self->overflow) &&
+	    !eh_idle_active(&self->resume_watcher))
+		eh_idle_start(&self->resume_watcher, loop);
+
+	if (eh_connection_pending(self) > 0 && !eh_io_active(&self->write_watcher))
 		ev_io_start(loop, &self->write_watcher);
 }
 
+/** Finishes it from the loop, safe within any callback
+ *
+ * It stops at once and on_close() follows from resume_watcher, when no
+ * callback of this or another connection is running on it anymore. What
+ * wasn't sent is dropped, and starting or writing to it does nothing.
+ */
+void eh_connection_close(struct eh_connection *self)
+{
+	assert(self->loop != NULL);
+
+	if (self->closing)
+		return;
+
+	eh_connection_stop(self);
+	self->closing = true;
+	eh_idle_start(&self->resume_watcher, self->loop);
+}
+
 void eh_connection_stop(struct eh_connection *self)
 {
 	assert(self->loop != NULL);
@@ -244,4 +769,7 @@ void eh_connection_stop(struct eh_connection *self)
 
 	if (eh_io_active(&self->write_watcher))
 		ev_io_stop(self->loop, &self->write_watcher);
+
+	if (eh_idle_active(&self->resume_watcher))
+		ev_idle_stop(self->loop, &self->resume_watcher);
 }
@@ -33,6 +33,7 @@
 #include <stdbool.h>
 
 #include <eh_buffer.h>
+#include <eh_payload.h>
 
 enum eh_connection_error {
 	EH_CONNECTION_READ_ERROR,
@@ -44,6 +45,7 @@ enum eh_connection_error {
 };
 
 struct eh_connection;
+struct eh_connection_ref;
 
 struct eh_connection_cb {
 	ssize_t (*on_read) (struct eh_connection *, char *, size_t);
@@ -55,6 +57,7 @@ struct eh_connection_cb {
 struct eh_connection {
 	ev_io read_watcher;
 	ev_io write_watcher;
+	ev_idle resume_watcher;	/* continues a read over budget */
 
 	struct ev_loop *loop;
 
@@ -62,12 +65,42 @@ struct eh_connection {
 	struct eh_buffer write_buffer;
 
 	struct eh_connection_cb *cb;
+
+	/* on_read() work per callback, 0 is unlimited */
+	size_t read_budget_bytes;
+	unsigned read_budget_messages;
+
+	/* read counters, reads per byte is read_calls/read_bytes */
+	unsigned long read_events;
+	unsigned long read_calls;
+	unsigned long read_bytes;
+
+	/* shared payloads to send, interleaved with write_buffer */
+	struct eh_connection_ref *queue;
+	struct eh_connection_ref **queue_tail;
+	size_t queue_bytes;	/* payload bytes pending */
+	size_t queue_buffered;	/* write_buffer bytes that go before the last */
+
+	/* messages larger than read_buffer, see eh_connection_set_overflow() */
+	char *overflow;
+	size_t overflow_len;
+	size_t overflow_size;
+	size_t overflow_max;
+	bool read_hot;		/* reads fill the buffer, kept in a block */
+
+	bool closing;		/* see eh_connection_close() */
 };
 
 static inline int eh_connection_fd(struct eh_connection *self)
 {
 	return self->read_watcher.fd;
 }
+/** Bytes waiting to be sent, buffered or queued */
+static inline size_t eh_connection_pending(struct eh_connection *self)
+{
+	return eh_buffer_len(&self->write_buffer) + self->queue_bytes;
+}
+
 static inline void eh_connection_reset_readbuffer(struct eh_connection *self)
 {
 	eh_buffer_reset(&self->read_buffer);
@@ -79,10 +112,22 @@ int eh_connection_init(struct eh_connection *self, int fd,
 		       char *write_buf, size_t write_buf_size);
 void eh_connection_finish(struct eh_connection *self);
 
+void eh_connection_set_overflow(struct eh_connection *self, size_t max);
+void eh_connection_set_budget(struct eh_connection *self, size_t bytes,
+			      unsigned messages);
+void eh_connection_overflow_flush(void);
+
 void eh_connection_start(struct eh_connection *self, struct ev_loop *loop);
 void eh_connection_stop(struct eh_connection *self);
+void eh_connection_close(struct eh_connection *self);
 
 ssize_t eh_connection_write(struct eh_connection *self, const char *buffer,
 			    size_t len);
+ssize_t eh_connection_write_payload(struct eh_connection *self,
+				    struct eh_payload *payload);
+ssize_t eh_connection_vwritef(struct eh_connection *self, const char *fmt,
+			      va_list ap);
+ssize_t eh_connection_writef(struct eh_connection *self, const char *fmt, ...)
+	TYPECHECK_PRINTF(2, 3);
 
 #endif /* !_EH_CONNECTION_H */
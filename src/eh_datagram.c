@@ -0,0 +1,424 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE	/* recvmmsg(), sendmmsg() */
+
+#include <unistd.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>	/* UDP_GRO, UDP_SEGMENT */
+
+#include "eh.h"
+#include "eh_alloc.h"
+#include "eh_socket.h"
+#include "eh_watcher.h"
+#include "eh_datagram.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* room for an UDP_GRO control message */
+#define CONTROL_SIZE	CMSG_SPACE(sizeof(int))
+
+struct eh_datagram_slot {
+	struct iovec iov;
+	struct sockaddr_storage addr;
+	union {
+		char buf[CONTROL_SIZE];
+		size_t align;
+	} control;
+};
+
+/* recvmmsg() overwrites the lengths, so they need to be restored after each call */
+static inline void rx_slot_prepare(struct eh_datagram *self, unsigned i)
+{
+	struct eh_datagram_slot *slot = &self->rx_slot[i];
+
+	self->rx_hdr[i].msg_hdr = (struct msghdr) {
+		.msg_name = &slot->addr,
+		.msg_namelen = sizeof(slot->addr),
+		.msg_iov = &slot->iov,
+		.msg_iovlen = 1,
+		.msg_control = slot->control.buf,
+		.msg_controllen = sizeof(slot->control.buf),
+	};
+}
+
+static inline unsigned rx_segment(struct msghdr *hdr)
+{
+#ifdef UDP_GRO
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(hdr); c; c = CMSG_NXTHDR(hdr, c)) {
+		if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+			int segment;
+			memcpy(&segment, CMSG_DATA(c), sizeof(segment));
+			return segment;
+		}
+	}
+#else
+	(void)hdr;
+#endif
+	return 0;
+}
+
+/* callbacks */
+static void read_callback(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct eh_datagram *self = w->data;
+	struct eh_datagram_cb *cb = self->cb;
+
+	assert(self != NULL);
+	assert(self->cb != NULL);
+	assert(self->loop == loop);
+	(void)loop; /* only checked */
+
+	if (revents & EV_READ) {
+		int n;
+try_read:
+		n = recvmmsg(w->fd, self->rx_hdr, self->rx_count, MSG_DONTWAIT, NULL);
+
+		if (n > 0) {
+			for (int i = 0; i < n; i++) {
+				struct msghdr *hdr = &self->rx_hdr[i].msg_hdr;
+
+				self->rx_msg[i] = (struct eh_datagram_msg) {
+					.data = self->rx_slot[i].iov.iov_base,
+					.len = self->rx_hdr[i].msg_len,
+					.addr = hdr->msg_namelen ? hdr->msg_name : NULL,
+					.addrlen = hdr->msg_namelen,
+					.segment = hdr->msg_controllen ? rx_segment(hdr) : 0,
+					.truncated = (hdr->msg_flags & MSG_TRUNC) != 0,
+				};
+			}
+
+			if (cb->on_read)
+				cb->on_read(self, self->rx_msg, n);
+
+			for (int i = 0; i < n; i++)
+				rx_slot_prepare(self, i);
+		} else if (n < 0 && errno == EINTR) {
+			goto try_read;
+		} else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			bool close = true;
+			if (cb->on_error)
+				close = cb->on_error(self, EH_DATAGRAM_READ_ERROR);
+			if (close)
+				goto terminate;
+		}
+	}
+
+	if (revents & EV_ERROR) {
+		bool close = true;
+		if (cb->on_error)
+			close = cb->on_error(self, EH_DATAGRAM_READ_WATCHER_ERROR);
+		if (close)
+			goto terminate;
+	}
+
+	return;
+terminate:
+	eh_datagram_stop(self);
+	eh_datagram_finish(self);
+}
+
+static void write_callback(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct eh_datagram *self = w->data;
+	struct eh_datagram_cb *cb = self->cb;
+
+	assert(self->cb != NULL);
+
+	if (revents & EV_WRITE) {
+		if (eh_datagram_flush(self) < 0) {
+			bool close = true;
+			if (cb->on_error)
+				close = cb->on_error(self, EH_DATAGRAM_WRITE_ERROR);
+			if (close)
+				goto terminate;
+		}
+
+		if (self->tx_head == self->tx_len)
+			ev_io_stop(loop, w);
+	}
+	if (revents & EV_ERROR) {
+		bool close = true;
+		if (cb->on_error)
+			close = cb->on_error(self, EH_DATAGRAM_WRITE_WATCHER_ERROR);
+		if (close)
+			goto terminate;
+	}
+
+	return;
+terminate:
+	eh_datagram_stop(self);
+	eh_datagram_finish(self);
+}
+
+/** Sends as much of the outgoing queue as the socket takes
+ *
+ * A datagram refused by the kernel is dropped so it doesn't block the rest
+ * of the queue.
+ *
+ * Returns: number of datagrams sent, -1:errno
+ */
+ssize_t eh_datagram_flush(struct eh_datagram *self)
+{
+	ssize_t sent = 0;
+
+	while (self->tx_head < self->tx_len) {
+		int n = sendmmsg(eh_datagram_fd(self), self->tx_hdr + self->tx_head,
+				 self->tx_len - self->tx_head, MSG_DONTWAIT);
+
+		if (n > 0) {
+			self->tx_head += n;
+			sent += n;
+		} else if (errno == EINTR) {
+			continue;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			break;
+		} else {
+			int e = errno;
+			if (++self->tx_head == self->tx_len)
+				self->tx_head = self->tx_len = self->tx_buf_len = 0;
+			errno = e;
+			return -1;
+		}
+	}
+
+	if (self->tx_head == self->tx_len)
+		self->tx_head = self->tx_len = self->tx_buf_len = 0;
+
+	return sent;
+}
+
+/** Queues a datagram to be sent
+ *
+ * If the queue is full it's flushed right away, addr can be NULL on
+ * connected sockets.
+ */
+ssize_t eh_datagram_sendto(struct eh_datagram *self, const char *data, size_t len,
+			   const struct sockaddr *addr, socklen_t addrlen)
+{
+	struct eh_datagram_cb *cb = self->cb;
+	struct eh_datagram_slot *slot;
+	unsigned i;
+
+	assert(self->cb != NULL);
+	assert(data != NULL || len == 0);
+	assert(addrlen <= sizeof(struct sockaddr_storage));
+
+	if (unlikely(len > self->tx_buf_size)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+try_append:
+	if (self->tx_len == self->tx_count || len > self->tx_buf_size - self->tx_buf_len) {
+		if (eh_datagram_flush(self) < 0 && errno != EMSGSIZE)
+			return -1;
+
+		if (self->tx_len > 0) {
+			bool close = true;
+			if (cb->on_error)
+				close = cb->on_error(self, EH_DATAGRAM_WRITE_FULL);
+
+			if (!close)
+				goto try_append;
+			else
+				return -1;
+		}
+	}
+
+	i = self->tx_len++;
+	slot = &self->tx_slot[i];
+
+	slot->iov = (struct iovec) { self->tx_buf + self->tx_buf_len, len };
+	memcpy(slot->iov.iov_base, data, len);
+	self->tx_buf_len += len;
+
+	if (addr)
+		memcpy(&slot->addr, addr, addrlen);
+	else
+		addrlen = 0;
+
+	self->tx_hdr[i].msg_hdr = (struct msghdr) {
+		.msg_name = addrlen ? &slot->addr : NULL,
+		.msg_namelen = addrlen,
+		.msg_iov = &slot->iov,
+		.msg_iovlen = 1,
+	};
+
+	if (!eh_io_active(&self->write_watcher) && self->loop)
+		ev_io_start(self->loop, &self->write_watcher);
+
+	return len;
+}
+
+/* exported */
+int eh_datagram_ipv4_udp(const char *addr, unsigned port, bool cloexec)
+{
+	struct sockaddr_in sin;
+	int fd, flags = 1;
+
+	int e = eh_socket_init_ipv4(&sin, addr, port);
+	if (e == 0)
+		errno = EINVAL;
+	if (e != 1)
+		return -1;
+
+	if ((fd = eh_socket(sin.sin_family, SOCK_DGRAM, cloexec, true)) < 0)
+		return -1; /* socket() call failed */
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
+
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		close(fd);
+		return -1; /* bind() failed */
+	}
+
+	return fd;
+}
+
+int eh_datagram_init(struct eh_datagram *self, int fd,
+		     struct eh_datagram_cb *cb,
+		     unsigned rx_count, size_t rx_size,
+		     unsigned tx_count, size_t tx_buf_size)
+{
+	char *p;
+
+	assert(fd >= 0);
+	assert(cb);
+	assert(rx_count > 0 && rx_size > 0);
+	assert(tx_count > 0 && tx_buf_size > 0);
+
+	/* a single chunk for everything, slots first to keep them aligned */
+	p = eh_alloc((rx_count + tx_count) * (sizeof(struct mmsghdr) + sizeof(struct eh_datagram_slot)) +
+		     rx_count * (sizeof(struct eh_datagram_msg) + rx_size) + tx_buf_size);
+	if (p == NULL)
+		return -1;
+
+	*self = (struct eh_datagram) {
+		.rx_count = rx_count, .rx_size = rx_size,
+		.tx_count = tx_count, .tx_buf_size = tx_buf_size,
+		.cb = cb,
+	};
+
+	self->rx_slot = (struct eh_datagram_slot *)p;
+	self->tx_slot = self->rx_slot + rx_count;
+	self->rx_hdr = (struct mmsghdr *)(self->tx_slot + tx_count);
+	self->tx_hdr = self->rx_hdr + rx_count;
+	self->rx_msg = (struct eh_datagram_msg *)(self->tx_hdr + tx_count);
+
+	p = (char *)(self->rx_msg + rx_count);
+	for (unsigned i = 0; i < rx_count; i++, p += rx_size) {
+		self->rx_slot[i].iov = (struct iovec) { p, rx_size };
+		rx_slot_prepare(self, i);
+	}
+	self->tx_buf = p;
+
+	eh_io_init(&self->read_watcher, read_callback, self, fd, EH_READ);
+	eh_io_init(&self->write_watcher, write_callback, self, fd, EH_WRITE);
+
+	return 1;
+}
+
+void eh_datagram_finish(struct eh_datagram *self)
+{
+	struct eh_datagram_cb *cb = self->cb;
+
+	assert(self->cb != NULL);
+	assert(!eh_io_active(&self->read_watcher));
+	assert(!eh_io_active(&self->write_watcher));
+
+	close(self->read_watcher.fd);
+	eh_free(self->rx_slot);
+
+	if (cb->on_close)
+		cb->on_close(self);
+}
+
+void eh_datagram_start(struct eh_datagram *self, struct ev_loop *loop)
+{
+	assert(loop != NULL || self->loop != NULL);
+
+	if (loop)
+		self->loop = loop;
+	else
+		loop = self->loop;
+
+	if (!eh_io_active(&self->read_watcher))
+		ev_io_start(loop, &self->read_watcher);
+
+	if (self->tx_len > 0 && !eh_io_active(&self->write_watcher))
+		ev_io_start(loop, &self->write_watcher);
+}
+
+void eh_datagram_stop(struct eh_datagram *self)
+{
+	assert(self->loop != NULL);
+
+	if (eh_io_active(&self->read_watcher))
+		ev_io_stop(self->loop, &self->read_watcher);
+
+	if (eh_io_active(&self->write_watcher))
+		ev_io_stop(self->loop, &self->write_watcher);
+}
+
+/*
+ * UDP offloads
+ */
+int eh_datagram_set_gro(struct eh_datagram *self, bool enabled)
+{
+#ifdef UDP_GRO
+	int v = enabled;
+	return setsockopt(eh_datagram_fd(self), SOL_UDP, UDP_GRO, &v, sizeof(v));
+#else
+	(void)self; (void)enabled;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
+int eh_datagram_set_gso(struct eh_datagram *self, unsigned segment)
+{
+#ifdef UDP_SEGMENT
+	int v = segment;
+	return setsockopt(eh_datagram_fd(self), SOL_UDP, UDP_SEGMENT, &v, sizeof(v));
+#else
+	(void)self; (void)segment;
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
@@ -0,0 +1,135 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EH_DATAGRAM_H
+#define _EH_DATAGRAM_H
+
+#include <ev.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+enum eh_datagram_error {
+	EH_DATAGRAM_READ_ERROR,
+	EH_DATAGRAM_WRITE_ERROR,
+	EH_DATAGRAM_WRITE_FULL,
+	EH_DATAGRAM_READ_WATCHER_ERROR,
+	EH_DATAGRAM_WRITE_WATCHER_ERROR,
+};
+
+/** Received datagram, as delivered to on_read() */
+struct eh_datagram_msg {
+	char *data;
+	size_t len;
+
+	const struct sockaddr *addr;
+	socklen_t addrlen;
+
+	/** size of each coalesced segment when GRO is enabled, 0 otherwise */
+	unsigned segment;
+
+	/** bigger than rx_size, only the first len bytes are here */
+	bool truncated;
+};
+
+struct eh_datagram;
+
+struct eh_datagram_cb {
+	/** batch of datagrams drained by a single recvmmsg() */
+	void (*on_read) (struct eh_datagram *, struct eh_datagram_msg *, unsigned);
+	void (*on_close) (struct eh_datagram *);
+
+	bool (*on_error) (struct eh_datagram *, enum eh_datagram_error);
+};
+
+struct mmsghdr;
+struct eh_datagram_slot;
+
+struct eh_datagram {
+	ev_io read_watcher;
+	ev_io write_watcher;
+
+	struct ev_loop *loop;
+
+	/* incoming */
+	struct mmsghdr *rx_hdr;
+	struct eh_datagram_slot *rx_slot;
+	struct eh_datagram_msg *rx_msg;
+	unsigned rx_count;
+	size_t rx_size;
+
+	/* outgoing */
+	struct mmsghdr *tx_hdr;
+	struct eh_datagram_slot *tx_slot;
+	unsigned tx_count;
+	unsigned tx_head, tx_len;
+
+	char *tx_buf;
+	size_t tx_buf_size, tx_buf_len;
+
+	struct eh_datagram_cb *cb;
+};
+
+static inline int eh_datagram_fd(struct eh_datagram *self)
+{
+	return self->read_watcher.fd;
+}
+
+/*
+ * Returns: fd:ok, -1:errno (EINVAL for bad address)
+ */
+int eh_datagram_ipv4_udp(const char *addr, unsigned port, bool cloexec);
+
+/*
+ * rx_count datagrams of up to rx_size bytes are drained per recvmmsg(),
+ * and up to tx_count datagrams adding up to tx_buf_size bytes are queued
+ * for the next sendmmsg(). Memory is taken from eh_alloc().
+ *
+ * Returns: 1:ok, -1:errno
+ */
+int eh_datagram_init(struct eh_datagram *self, int fd,
+		     struct eh_datagram_cb *cb,
+		     unsigned rx_count, size_t rx_size,
+		     unsigned tx_count, size_t tx_buf_size);
+void eh_datagram_finish(struct eh_datagram *self);
+
+void eh_datagram_start(struct eh_datagram *self, struct ev_loop *loop);
+void eh_datagram_stop(struct eh_datagram *self);
+
+ssize_t eh_datagram_sendto(struct eh_datagram *self, const char *data, size_t len,
+			   const struct sockaddr *addr, socklen_t addrlen);
+ssize_t eh_datagram_flush(struct eh_datagram *self);
+
+/*
+ * UDP offloads, 0:ok, -1:errno (ENOPROTOOPT if unsupported)
+ */
+int eh_datagram_set_gro(struct eh_datagram *self, bool enabled);
+int eh_datagram_set_gso(struct eh_datagram *self, unsigned segment);
+
+#endif /* !_EH_DATAGRAM_H */
@@ -29,6 +29,8 @@
 #ifndef _EH_FMT_H
 #define _EH_FMT_H
 
+#include <stdint.h>
+
 ssize_t eh_fmt_cstr(char *, size_t, const char *, size_t);
 
 static inline size_t eh_fmt_unsigned_len(register unsigned n, const unsigned b)
@@ -41,4 +43,49 @@ static inline size_t eh_fmt_unsigned_len(register unsigned n, const unsigned b)
 
 size_t eh_fmt_unsigned(char *, unsigned);
 
+/** Number of decimal digits of n */
+static inline size_t eh_fmt_u64_len(uint64_t n)
+{
+	static const uint64_t pow10[] = {
+		1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+		10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+		100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+		100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+		100000000000000000ULL, 1000000000000000000ULL,
+		10000000000000000000ULL,
+	};
+	/* log10(2) ~ 1233/4096, off by one at most. n|1 keeps 0 as 1 digit */
+	unsigned t = ((64 - __builtin_clzll(n | 1)) * 1233) >> 12;
+	return t + ((n | 1) >= pow10[t]);
+}
+
+/** Number of digits of n, in hexadecimal */
+static inline size_t eh_fmt_x64_len(uint64_t n)
+{
+	return (64 - __builtin_clzll(n | 1) + 3) / 4;
+}
+
+static inline size_t eh_fmt_i64_len(int64_t n)
+{
+	return n < 0 ? 1 + eh_fmt_u64_len(-(uint64_t)n) : eh_fmt_u64_len(n);
+}
+
+/*
+ * buf needs room for the digits (and sign), or width if it's bigger.
+ * nothing is terminated.
+ */
+size_t eh_fmt_u64(char *buf, uint64_t n);
+size_t eh_fmt_i64(char *buf, int64_t n);
+size_t eh_fmt_x64(char *buf, uint64_t n);
+
+/* zero padded on the left up to width */
+size_t eh_fmt_u64_pad(char *buf, uint64_t n, unsigned width);
+size_t eh_fmt_x64_pad(char *buf, uint64_t n, unsigned width);
+
+/* room for any double, as rendered by eh_fmt_double*() */
+#define EH_FMT_DOUBLE_SIZE	40
+
+size_t eh_fmt_double(char *buf, double v);
+size_t eh_fmt_double_fixed(char *buf, double v, unsigned prec);
+
 #endif /* !_EH_FMT_H */
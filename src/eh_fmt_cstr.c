@@ -28,10 +28,18 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "eh.h"
 #include "eh_fmt.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
 #define hexa "0123456789abcdef"
 #define CEC "abtnvfr"
 
@@ -54,11 +62,91 @@ static inline size_t eh_fmt_cstr_len(unsigned char c)
 	}
 }
 
+/*
+ * length of the leading run of bytes copied as they are, up to n.
+ * a word at a time, then simd when the cpu has it.
+ */
+#define ONES	0x0101010101010101ULL
+#define HIGHS	0x8080808080808080ULL
+
+static size_t plain_run_word(const unsigned char *p, size_t n)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		uint64_t x, q, b;
+
+		memcpy(&x, p + i, 8);
+		q = x ^ (ONES * '"');
+		b = x ^ (ONES * '\\');
+
+		if ((((x - ONES * 0x20) & ~x) |	/* < 0x20 */
+		     ((x + ONES) | x) |		/* > 0x7e */
+		     ((q - ONES) & ~q) |		/* '"' */
+		     ((b - ONES) & ~b)) & HIGHS)	/* '\\' */
+			break;
+	}
+
+	for (; i < n && eh_fmt_cstr_len(p[i]) == 1; i++)
+		;
+	return i;
+}
+
+#ifdef HAVE_SSE2
+/* signed compares, so 0x80 and above count as below 0x20 */
+#define SIMD_PLAIN(W, T, P)								\
+	const T lo = _mm##W##_set1_epi8(0x20), del = _mm##W##_set1_epi8(0x7f);	\
+	const T quot = _mm##W##_set1_epi8('"'), bs = _mm##W##_set1_epi8('\\');	\
+	size_t i = 0;									\
+	for (; i + sizeof(T) <= n; i += sizeof(T)) {					\
+		T x = _mm##W##_loadu_si##P((const T *)(p + i));			\
+		T m = _mm##W##_or_si##P(						\
+			_mm##W##_or_si##P(_mm##W##_cmpgt_epi8(lo, x),			\
+					 _mm##W##_cmpeq_epi8(x, del)),			\
+			_mm##W##_or_si##P(_mm##W##_cmpeq_epi8(x, quot),		\
+					 _mm##W##_cmpeq_epi8(x, bs)));			\
+		unsigned mask = (unsigned)_mm##W##_movemask_epi8(m);			\
+		if (mask)								\
+			return i + __builtin_ctz(mask);				\
+	}										\
+	return i + plain_run_word(p + i, n - i)
+
+static size_t plain_run_sse2(const unsigned char *p, size_t n)
+{
+	SIMD_PLAIN(, __m128i, 128);
+}
+
+__attribute__((target("avx2")))
+static size_t plain_run_avx2(const unsigned char *p, size_t n)
+{
+	SIMD_PLAIN(256, __m256i, 256);
+}
+#endif
+
+static size_t plain_run_init(const unsigned char *, size_t);
+static size_t (*plain_run)(const unsigned char *, size_t) = plain_run_init;
+
+/* picks the best implementation on the first call */
+static size_t plain_run_init(const unsigned char *p, size_t n)
+{
+	size_t (*f)(const unsigned char *, size_t) = plain_run_word;
+
+#ifdef HAVE_SSE2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		f = plain_run_avx2;
+	else
+		f = plain_run_sse2;
+#endif
+	__atomic_store_n(&plain_run, f, __ATOMIC_RELAXED);
+	return f(p, n);
+}
+
 ssize_t eh_fmt_cstr(char *buf, size_t buf_size, const char *data, size_t data_size)
 {
 	size_t len = 0;
-	while(data_size-- > 0) {
-		unsigned char c = *data++;
+	while(data_size > 0) {
+		unsigned char c = *data;
 		size_t l = eh_fmt_cstr_len(c);
 
 		if (unlikely(l > buf_size))
@@ -66,7 +154,16 @@ ssize_t eh_fmt_cstr(char *buf, size_t buf_size, const char *data, size_t data_si
 
 		switch (l) {
 		case 1:
-			*buf = c;
+			/* the whole run of plain bytes at once, if there is one */
+			if (data_size < 2 || eh_fmt_cstr_len(data[1]) != 1) {
+				*buf = c;
+				break;
+			}
+			l = plain_run((const unsigned char *)data,
+				      data_size < buf_size ? data_size : buf_size);
+			memcpy(buf, data, l);
+			data += l - 1;
+			data_size -= l - 1;
 			break;
 		case 2:
 			buf[0] = '\\';
@@ -83,6 +180,8 @@ ssize_t eh_fmt_cstr(char *buf, size_t buf_size, const char *data, size_t data_si
 			buf[3] = hexa[c & 0x0f];
 		}
 
+		data++;
+		data_size--;
 		buf_size -= l;
 		buf += l;
 		len += l;
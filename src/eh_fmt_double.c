@@ -0,0 +1,496 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_fmt.h"
+
+/*
+ * shortest decimal that reads back as the same double, using Grisu2
+ * (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with
+ * Integers", PLDI 2010) on 64bit "do it yourself" floating points.
+ */
+struct diyfp {
+	uint64_t f;
+	int e;
+};
+
+#define DP_SIGNIFICAND	0x000fffffffffffffULL
+#define DP_HIDDEN_BIT	0x0010000000000000ULL
+#define DP_EXPONENT	0x7ff0000000000000ULL
+#define DP_BIAS		(0x3ff + 52)
+
+/* 10^-348, 10^-340, ... 10^340, normalized */
+static const struct diyfp cached_powers[] = {
+	{ 0xfa8fd5a0081c0288ULL, -1220 },
+	{ 0xbaaee17fa23ebf76ULL, -1193 },
+	{ 0x8b16fb203055ac76ULL, -1166 },
+	{ 0xcf42894a5dce35eaULL, -1140 },
+	{ 0x9a6bb0aa55653b2dULL, -1113 },
+	{ 0xe61acf033d1a45dfULL, -1087 },
+	{ 0xab70fe17c79ac6caULL, -1060 },
+	{ 0xff77b1fcbebcdc4fULL, -1034 },
+	{ 0xbe5691ef416bd60cULL, -1007 },
+	{ 0x8dd01fad907ffc3cULL, -980 },
+	{ 0xd3515c2831559a83ULL, -954 },
+	{ 0x9d71ac8fada6c9b5ULL, -927 },
+	{ 0xea9c227723ee8bcbULL, -901 },
+	{ 0xaecc49914078536dULL, -874 },
+	{ 0x823c12795db6ce57ULL, -847 },
+	{ 0xc21094364dfb5637ULL, -821 },
+	{ 0x9096ea6f3848984fULL, -794 },
+	{ 0xd77485cb25823ac7ULL, -768 },
+	{ 0xa086cfcd97bf97f4ULL, -741 },
+	{ 0xef340a98172aace5ULL, -715 },
+	{ 0xb23867fb2a35b28eULL, -688 },
+	{ 0x84c8d4dfd2c63f3bULL, -661 },
+	{ 0xc5dd44271ad3cdbaULL, -635 },
+	{ 0x936b9fcebb25c996ULL, -608 },
+	{ 0xdbac6c247d62a584ULL, -582 },
+	{ 0xa3ab66580d5fdaf6ULL, -555 },
+	{ 0xf3e2f893dec3f126ULL, -529 },
+	{ 0xb5b5ada8aaff80b8ULL, -502 },
+	{ 0x87625f056c7c4a8bULL, -475 },
+	{ 0xc9bcff6034c13053ULL, -449 },
+	{ 0x964e858c91ba2655ULL, -422 },
+	{ 0xdff9772470297ebdULL, -396 },
+	{ 0xa6dfbd9fb8e5b88fULL, -369 },
+	{ 0xf8a95fcf88747d94ULL, -343 },
+	{ 0xb94470938fa89bcfULL, -316 },
+	{ 0x8a08f0f8bf0f156bULL, -289 },
+	{ 0xcdb02555653131b6ULL, -263 },
+	{ 0x993fe2c6d07b7facULL, -236 },
+	{ 0xe45c10c42a2b3b06ULL, -210 },
+	{ 0xaa242499697392d3ULL, -183 },
+	{ 0xfd87b5f28300ca0eULL, -157 },
+	{ 0xbce5086492111aebULL, -130 },
+	{ 0x8cbccc096f5088ccULL, -103 },
+	{ 0xd1b71758e219652cULL, -77 },
+	{ 0x9c40000000000000ULL, -50 },
+	{ 0xe8d4a51000000000ULL, -24 },
+	{ 0xad78ebc5ac620000ULL, 3 },
+	{ 0x813f3978f8940984ULL, 30 },
+	{ 0xc097ce7bc90715b3ULL, 56 },
+	{ 0x8f7e32ce7bea5c70ULL, 83 },
+	{ 0xd5d238a4abe98068ULL, 109 },
+	{ 0x9f4f2726179a2245ULL, 136 },
+	{ 0xed63a231d4c4fb27ULL, 162 },
+	{ 0xb0de65388cc8ada8ULL, 189 },
+	{ 0x83c7088e1aab65dbULL, 216 },
+	{ 0xc45d1df942711d9aULL, 242 },
+	{ 0x924d692ca61be758ULL, 269 },
+	{ 0xda01ee641a708deaULL, 295 },
+	{ 0xa26da3999aef774aULL, 322 },
+	{ 0xf209787bb47d6b85ULL, 348 },
+	{ 0xb454e4a179dd1877ULL, 375 },
+	{ 0x865b86925b9bc5c2ULL, 402 },
+	{ 0xc83553c5c8965d3dULL, 428 },
+	{ 0x952ab45cfa97a0b3ULL, 455 },
+	{ 0xde469fbd99a05fe3ULL, 481 },
+	{ 0xa59bc234db398c25ULL, 508 },
+	{ 0xf6c69a72a3989f5cULL, 534 },
+	{ 0xb7dcbf5354e9beceULL, 561 },
+	{ 0x88fcf317f22241e2ULL, 588 },
+	{ 0xcc20ce9bd35c78a5ULL, 614 },
+	{ 0x98165af37b2153dfULL, 641 },
+	{ 0xe2a0b5dc971f303aULL, 667 },
+	{ 0xa8d9d1535ce3b396ULL, 694 },
+	{ 0xfb9b7cd9a4a7443cULL, 720 },
+	{ 0xbb764c4ca7a44410ULL, 747 },
+	{ 0x8bab8eefb6409c1aULL, 774 },
+	{ 0xd01fef10a657842cULL, 800 },
+	{ 0x9b10a4e5e9913129ULL, 827 },
+	{ 0xe7109bfba19c0c9dULL, 853 },
+	{ 0xac2820d9623bf429ULL, 880 },
+	{ 0x80444b5e7aa7cf85ULL, 907 },
+	{ 0xbf21e44003acdd2dULL, 933 },
+	{ 0x8e679c2f5e44ff8fULL, 960 },
+	{ 0xd433179d9c8cb841ULL, 986 },
+	{ 0x9e19db92b4e31ba9ULL, 1013 },
+	{ 0xeb96bf6ebadf77d9ULL, 1039 },
+	{ 0xaf87023b9bf0ee6bULL, 1066 },
+};
+
+static const uint64_t powers10[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL,
+	10000000000000000000ULL,
+};
+
+static inline uint64_t dbl_bits(double v)
+{
+	uint64_t u;
+	memcpy(&u, &v, sizeof(u));
+	return u;
+}
+
+/* upper half of the 128bit product, rounded */
+static inline struct diyfp diyfp_mul(struct diyfp a, struct diyfp b)
+{
+#ifdef __SIZEOF_INT128__
+	__extension__ typedef unsigned __int128 uint128_t;
+	uint128_t p = (uint128_t)a.f * b.f;
+	uint64_t h = p >> 64, l = (uint64_t)p;
+	if (l & (1ULL << 63))
+		h++;
+#else
+	uint64_t a1 = a.f >> 32, a0 = a.f & 0xffffffff;
+	uint64_t b1 = b.f >> 32, b0 = b.f & 0xffffffff;
+	uint64_t p11 = a1 * b1, p10 = a1 * b0, p01 = a0 * b1, p00 = a0 * b0;
+	uint64_t mid = (p00 >> 32) + (p10 & 0xffffffff) + (p01 & 0xffffffff);
+	uint64_t h = p11 + (p10 >> 32) + (p01 >> 32) + (mid >> 32);
+	if (mid & (1ULL << 31))
+		h++;
+#endif
+	return (struct diyfp) { h, a.e + b.e + 64 };
+}
+
+static inline struct diyfp diyfp_normalize(struct diyfp v)
+{
+	int s = __builtin_clzll(v.f);
+	return (struct diyfp) { v.f << s, v.e - s };
+}
+
+/* v, and the middle points to its neighbours, sharing the exponent */
+static inline void diyfp_boundaries(uint64_t bits, struct diyfp *v,
+				    struct diyfp *minus, struct diyfp *plus)
+{
+	uint64_t sig = bits & DP_SIGNIFICAND;
+	int be = (bits & DP_EXPONENT) >> 52;
+
+	if (be)
+		*v = (struct diyfp) { sig + DP_HIDDEN_BIT, be - DP_BIAS };
+	else
+		*v = (struct diyfp) { sig, 1 - DP_BIAS };
+
+	*plus = diyfp_normalize((struct diyfp) { (v->f << 1) + 1, v->e - 1 });
+
+	/* the gap below is half as big at the start of a binade */
+	if (v->f == DP_HIDDEN_BIT)
+		*minus = (struct diyfp) { (v->f << 2) - 1, v->e - 2 };
+	else
+		*minus = (struct diyfp) { (v->f << 1) - 1, v->e - 1 };
+
+	minus->f <<= minus->e - plus->e;
+	minus->e = plus->e;
+}
+
+/* a power of ten that brings the exponent of e into [-60, -32] */
+static inline struct diyfp cached_power(int e, int *K)
+{
+	double dk = (-61 - e) * 0.30102999566398114 + 347;
+	int k = (int)dk;
+	unsigned i;
+
+	if (dk - k > 0.0)
+		k++;
+
+	i = (k >> 3) + 1;
+	*K = -(-348 + (int)i * 8);
+	return cached_powers[i];
+}
+
+/* moves the last digit towards w while it stays within the range */
+static inline void grisu_round(char *buf, int len, uint64_t delta,
+			       uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+	       (rest + ten_kappa < wp_w ||
+		wp_w - rest > rest + ten_kappa - wp_w)) {
+		buf[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+static inline int digit_gen(struct diyfp w, struct diyfp mp, uint64_t delta,
+			    char *buf, int *K)
+{
+	const struct diyfp one = { 1ULL << -mp.e, mp.e };
+	const uint64_t wp_w = mp.f - w.f;
+	uint32_t p1 = mp.f >> -one.e;
+	uint64_t p2 = mp.f & (one.f - 1);
+	int kappa = eh_fmt_u64_len(p1);
+	int len = 0;
+
+	/* integral part */
+	while (kappa > 0) {
+		uint32_t d = p1 / powers10[kappa - 1];
+		uint64_t rest;
+
+		p1 %= powers10[kappa - 1];
+		if (d || len)
+			buf[len++] = '0' + d;
+
+		kappa--;
+		rest = ((uint64_t)p1 << -one.e) + p2;
+		if (rest <= delta) {
+			*K += kappa;
+			grisu_round(buf, len, delta, rest,
+				    powers10[kappa] << -one.e, wp_w);
+			return len;
+		}
+	}
+
+	/* fractional part */
+	for (;;) {
+		unsigned d;
+
+		p2 *= 10;
+		delta *= 10;
+		d = p2 >> -one.e;
+		if (d || len)
+			buf[len++] = '0' + d;
+
+		p2 &= one.f - 1;
+		kappa--;
+		if (p2 < delta) {
+			*K += kappa;
+			grisu_round(buf, len, delta, p2, one.f,
+				    -kappa < 20 ? wp_w * powers10[-kappa] : 0);
+			return len;
+		}
+	}
+}
+
+/* digits of a positive finite v, and their decimal exponent */
+static int grisu2(uint64_t bits, char *buf, int *K)
+{
+	struct diyfp v, minus, plus, c, w;
+
+	diyfp_boundaries(bits, &v, &minus, &plus);
+	c = cached_power(plus.e, K);
+
+	w = diyfp_mul(diyfp_normalize(v), c);
+	plus = diyfp_mul(plus, c);
+	minus = diyfp_mul(minus, c);
+	minus.f++;
+	plus.f--;
+
+	return digit_gen(w, plus, plus.f - minus.f, buf, K);
+}
+
+/* "nan", "inf" or "0" with their signs, 0 if v is something else */
+static size_t fmt_special(char *buf, uint64_t bits)
+{
+	char *p = buf;
+
+	if ((bits & DP_EXPONENT) == DP_EXPONENT) {
+		if (bits & DP_SIGNIFICAND) {
+			memcpy(p, "nan", 3);
+			return 3;
+		}
+		if (bits >> 63)
+			*p++ = '-';
+		memcpy(p, "inf", 3);
+		return p - buf + 3;
+	} else if ((bits << 1) == 0) {
+		if (bits >> 63)
+			*p++ = '-';
+		*p++ = '0';
+		return p - buf;
+	}
+	return 0;
+}
+
+/** Shortest decimal that reads back as v
+ *
+ * Plain notation for decimal exponents from -7 to 20, "d.ddde[-]x"
+ * otherwise. Not locale dependent and not terminated. buf must have
+ * EH_FMT_DOUBLE_SIZE bytes.
+ */
+size_t eh_fmt_double(char *buf, double v)
+{
+	uint64_t bits = dbl_bits(v);
+	char digits[20], *p = buf;
+	int n, K, kk;
+	size_t l;
+
+	if ((l = fmt_special(buf, bits)) > 0)
+		return l;
+
+	if (bits >> 63)
+		*p++ = '-';
+
+	n = grisu2(bits & ~(1ULL << 63), digits, &K);
+	kk = n + K; /* position of the decimal point */
+
+	if (K >= 0 && kk <= 21) {
+		/* 1234e7 -> 12340000000 */
+		memcpy(p, digits, n);
+		memset(p + n, '0', K);
+		p += kk;
+	} else if (kk > 0 && kk <= 21) {
+		/* 1234e-2 -> 12.34 */
+		memcpy(p, digits, kk);
+		p[kk] = '.';
+		memcpy(p + kk + 1, digits + kk, n - kk);
+		p += n + 1;
+	} else if (kk > -6 && kk <= 0) {
+		/* 1234e-6 -> 0.001234 */
+		p[0] = '0';
+		p[1] = '.';
+		memset(p + 2, '0', -kk);
+		memcpy(p + 2 - kk, digits, n);
+		p += 2 - kk + n;
+	} else {
+		/* 1234e30 -> 1.234e33 */
+		*p++ = digits[0];
+		if (n > 1) {
+			*p++ = '.';
+			memcpy(p, digits + 1, n - 1);
+			p += n - 1;
+		}
+		*p++ = 'e';
+		p += eh_fmt_i64(p, kk - 1);
+	}
+	return p - buf;
+}
+
+/* the 128bit product, as hi:lo */
+static inline uint64_t mul_u64(uint64_t a, uint64_t b, uint64_t *hi)
+{
+#ifdef __SIZEOF_INT128__
+	__extension__ typedef unsigned __int128 uint128_t;
+	uint128_t p = (uint128_t)a * b;
+	*hi = p >> 64;
+	return (uint64_t)p;
+#else
+	uint64_t a1 = a >> 32, a0 = a & 0xffffffff;
+	uint64_t b1 = b >> 32, b0 = b & 0xffffffff;
+	uint64_t p11 = a1 * b1, p10 = a1 * b0, p01 = a0 * b1, p00 = a0 * b0;
+	uint64_t mid = (p00 >> 32) + (p10 & 0xffffffff) + (p01 & 0xffffffff);
+	*hi = p11 + (p10 >> 32) + (p01 >> 32) + (mid >> 32);
+	return (mid << 32) | (p00 & 0xffffffff);
+#endif
+}
+
+/*
+ * floor(frac * 10^prec / 2^k) for frac < 2^53 and k > 0, and how the
+ * remainder compares to half of 2^k: -1, 0 or 1
+ */
+static uint64_t fixed_digits(uint64_t frac, unsigned prec, unsigned k, int *half)
+{
+	uint64_t hi, lo = mul_u64(frac, powers10[prec], &hi), q, r_hi, h_hi, h_lo;
+
+	if (k >= 128) {
+		/* below 2^117, far from half of 2^128 */
+		*half = -1;
+		return 0;
+	} else if (k > 64) {
+		q = hi >> (k - 64);
+		r_hi = hi & ((1ULL << (k - 64)) - 1);
+		h_hi = 1ULL << (k - 65);
+		h_lo = 0;
+	} else if (k == 64) {
+		q = hi;
+		r_hi = h_hi = 0;
+		h_lo = 1ULL << 63;
+	} else {
+		q = (hi << (64 - k)) | (lo >> k);
+		lo &= (1ULL << k) - 1;
+		r_hi = h_hi = 0;
+		h_lo = 1ULL << (k - 1);
+	}
+
+	if (r_hi != h_hi)
+		*half = r_hi < h_hi ? -1 : 1;
+	else
+		*half = lo < h_lo ? -1 : lo > h_lo;
+	return q;
+}
+
+/** v with exactly prec decimals, prec up to 19
+ *
+ * The digits come from the exact binary value, rounded to nearest with
+ * ties to even, so it matches printf("%.*f"). buf must have
+ * EH_FMT_DOUBLE_SIZE bytes.
+ *
+ * Returns: the length, 0 if prec is above 19 or |v| is 2^63 or more
+ */
+size_t eh_fmt_double_fixed(char *buf, double v, unsigned prec)
+{
+	uint64_t bits = dbl_bits(v), m, ip, fp;
+	int e, half;
+	char *p = buf;
+	size_t l;
+
+	if (prec >= ELEMENTS(powers10))
+		return 0;
+
+	if ((l = fmt_special(buf, bits)) > 0 && (bits & DP_EXPONENT) == DP_EXPONENT)
+		return l;
+
+	/* |v| = m * 2^e */
+	m = bits & DP_SIGNIFICAND;
+	e = (bits & DP_EXPONENT) >> 52;
+	if (e > 0) {
+		m |= DP_HIDDEN_BIT;
+		e -= DP_BIAS;
+	} else {
+		e = 1 - DP_BIAS;
+	}
+
+	if (e >= 0) {
+		/* whole, with all 53 bits */
+		if (e > 63 - 53)
+			return 0;
+		ip = m << e;
+		fp = 0;
+	} else {
+		unsigned k = -e;
+
+		ip = k < 64 ? m >> k : 0;
+		fp = fixed_digits(k < 64 ? m & ((1ULL << k) - 1) : m, prec, k, &half);
+
+		if (half > 0 || (half == 0 && ((prec ? fp : ip) & 1)))
+			fp++;
+		if (fp == powers10[prec]) {
+			/* rounded up to the next unit */
+			fp = 0;
+			ip++;
+		}
+	}
+
+	if (bits >> 63)
+		*p++ = '-';
+
+	p += eh_fmt_u64(p, ip);
+	if (prec > 0) {
+		*p++ = '.';
+		p += eh_fmt_u64_pad(p, fp, prec);
+	}
+	return p - buf;
+}
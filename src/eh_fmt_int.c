@@ -28,15 +28,99 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "eh.h"
 #include "eh_fmt.h"
 
+static const char digits2[200] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* writes n backwards, two digits at a time, ending at p */
+static inline void fmt_u64_back(char *p, uint64_t n)
+{
+	/* 32bit divisions are cheaper once it fits */
+	while (n > UINT32_MAX) {
+		unsigned i = (n % 100) * 2;
+		n /= 100;
+		p -= 2;
+		memcpy(p, digits2 + i, 2);
+	}
+
+	for (uint32_t m = n; ; ) {
+		if (m < 10) {
+			*--p = '0' + m;
+			break;
+		} else if (m < 100) {
+			p -= 2;
+			memcpy(p, digits2 + m * 2, 2);
+			break;
+		}
+
+		p -= 2;
+		memcpy(p, digits2 + (m % 100) * 2, 2);
+		m /= 100;
+	}
+}
+
 size_t eh_fmt_unsigned(char *buf, register unsigned n)
 {
-	size_t l = eh_fmt_unsigned_len(n, 10);
-	char *p = buf+l;
-	for (; p>buf; n/=10)
-		*--p = n%10 + '0';
+	return eh_fmt_u64(buf, n);
+}
+
+size_t eh_fmt_u64(char *buf, uint64_t n)
+{
+	size_t l = eh_fmt_u64_len(n);
+	fmt_u64_back(buf + l, n);
 	return l;
 }
+
+size_t eh_fmt_i64(char *buf, int64_t n)
+{
+	if (n < 0) {
+		*buf = '-';
+		return 1 + eh_fmt_u64(buf + 1, -(uint64_t)n);
+	}
+	return eh_fmt_u64(buf, n);
+}
+
+size_t eh_fmt_u64_pad(char *buf, uint64_t n, unsigned width)
+{
+	size_t l = eh_fmt_u64_len(n);
+
+	if (l < width) {
+		memset(buf, '0', width - l);
+		l = width;
+	}
+	fmt_u64_back(buf + l, n);
+	return l;
+}
+
+#define hexa "0123456789abcdef"
+
+size_t eh_fmt_x64_pad(char *buf, uint64_t n, unsigned width)
+{
+	size_t l = eh_fmt_x64_len(n);
+	char *p;
+
+	if (l < width)
+		l = width;
+
+	for (p = buf + l; p > buf; n >>= 4)
+		*--p = hexa[n & 0xf];
+	return l;
+}
+
+size_t eh_fmt_x64(char *buf, uint64_t n)
+{
+	return eh_fmt_x64_pad(buf, n, 0);
+}
@@ -0,0 +1,300 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_alloc.h"
+#include "eh_scan.h"
+#include "eh_frame.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+void eh_frame_init(struct eh_frame *self, enum eh_frame_mode mode,
+		   struct eh_frame_cb *cb, size_t inline_size, size_t max_size)
+{
+	assert(self != NULL);
+	assert(cb != NULL && cb->on_frame != NULL);
+	assert(inline_size > 0 && inline_size <= max_size);
+
+	*self = (struct eh_frame) {
+		.mode = mode,
+		.header_size = 4,
+		.big_endian = true,
+		.inline_size = inline_size,
+		.max_size = max_size,
+		.cb = cb,
+	};
+}
+
+void eh_frame_finish(struct eh_frame *self)
+{
+	if (self->big)
+		eh_free(self->big);
+	self->big_len = self->big_size = 0;
+}
+
+void eh_frame_set_length(struct eh_frame *self, unsigned header_size, bool big_endian)
+{
+	assert(header_size == 1 || header_size == 2 ||
+	       header_size == 4 || header_size == 8);
+
+	self->header_size = header_size;
+	self->big_endian = big_endian;
+}
+
+/* first '\n' from i, or len */
+static size_t find_lf(const char *p, size_t i, size_t len)
+{
+#ifdef HAVE_SSE2
+	const __m128i lf = _mm_set1_epi8('\n');
+
+	for (; i + 16 <= len; i += 16) {
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + i)), lf));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+	if (i < len) {
+		const char *q = memchr(p + i, '\n', len - i);
+		if (q)
+			return q - p;
+	}
+	return len;
+}
+
+/*
+ * length header of the frame at data.
+ * Returns: header size, 0:incomplete, -1:malformed
+ */
+static int frame_header(struct eh_frame *self, const unsigned char *p, size_t len,
+			uint64_t *size, size_t *trailer)
+{
+	uint64_t v = 0;
+	unsigned i;
+
+	*trailer = 0;
+
+	switch (self->mode) {
+	case EH_FRAME_LENGTH:
+		if (len < self->header_size)
+			return 0;
+		for (i = 0; i < self->header_size; i++) {
+			unsigned b = self->big_endian ? i : self->header_size - 1 - i;
+			v = v << 8 | p[b];
+		}
+		*size = v;
+		return self->header_size;
+	case EH_FRAME_VARINT:
+		for (i = 0; i < len && i < 10; i++) {
+			v |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+			if ((p[i] & 0x80) == 0) {
+				*size = v;
+				return i + 1;
+			}
+		}
+		return i < 10 ? 0 : -1;
+	case EH_FRAME_NETSTRING: {
+		ssize_t l = eh_scan_u64((const char *)p, len, size);
+		if (l < 0)
+			return -1;
+		if ((size_t)l == len)
+			return l < 20 ? 0 : -1;
+		if (l == 0 || p[l] != ':')
+			return -1;
+		*trailer = 1; /* "," */
+		return l + 1;
+	}
+	default:
+		assert(0);
+		return -1;
+	}
+}
+
+static ssize_t deliver(struct eh_frame *self, const char *data, size_t len, ssize_t ret)
+{
+	if (!self->cb->on_frame(self, data, len)) {
+		errno = ECANCELED;
+		return -1;
+	}
+	return ret;
+}
+
+/* continues a frame too big to be handled in place */
+static ssize_t assemble(struct eh_frame *self, const char *data, size_t len)
+{
+	size_t n;
+
+	if (self->mode == EH_FRAME_LINE) {
+		size_t lf = find_lf(data, 0, len);
+		bool done = (lf < len);
+
+		if (self->big_len + lf > self->max_size)
+			goto too_big;
+
+		/* grow by 4, every step copies it all */
+		if (self->big_len + lf > self->big_size) {
+			size_t size = self->big_size * 4;
+			char *p;
+
+			while (size < self->big_len + lf)
+				size *= 4;
+			if (size > self->max_size)
+				size = self->max_size;
+			if ((p = eh_alloc(size)) == NULL)
+				return -1;
+
+			memcpy(p, self->big, self->big_len);
+			eh_free(self->big);
+			self->big = p;
+			self->big_size = size;
+		}
+
+		memcpy(self->big + self->big_len, data, lf);
+		self->big_len += lf;
+		if (!done)
+			return len;
+
+		n = self->big_len;
+		if (n > 0 && self->big[n-1] == '\r')
+			n--;
+		len = lf + 1;
+	} else {
+		n = self->big_size - self->big_len;
+		if (len < n) {
+			memcpy(self->big + self->big_len, data, len);
+			self->big_len += len;
+			return len;
+		}
+
+		memcpy(self->big + self->big_len, data, n);
+		len = n;
+		n = self->big_size;
+		if (self->mode == EH_FRAME_NETSTRING && self->big[--n] != ',') {
+			errno = EBADMSG;
+			return -1;
+		}
+	}
+
+	/* complete */
+	{
+		ssize_t ret = deliver(self, self->big, n, len);
+		eh_frame_finish(self);
+		return ret;
+	}
+too_big:
+	errno = EMSGSIZE;
+	return -1;
+}
+
+/* starts assembling a frame on the heap with what's there of it */
+static ssize_t spill(struct eh_frame *self, size_t size, const char *data,
+		     size_t len, size_t skip)
+{
+	if ((self->big = eh_alloc(size)) == NULL)
+		return -1;
+
+	self->big_size = size;
+	self->big_len = len - skip;
+	memcpy(self->big, data + skip, len - skip);
+	return len;
+}
+
+/** Handles the next frame, or a piece of one
+ *
+ * Meant to be returned from on_read(), which calls it again while it
+ * consumes.
+ */
+ssize_t eh_frame_read(struct eh_frame *self, const char *data, size_t len)
+{
+	size_t trailer, total;
+	uint64_t size;
+	int h;
+
+	assert(self != NULL);
+
+	if (len == 0)
+		return 0;
+	else if (self->big)
+		return assemble(self, data, len);
+
+	if (self->mode == EH_FRAME_LINE) {
+		size_t lf = find_lf(data, self->scanned, len);
+
+		if (lf < len) {
+			size_t n = (lf > 0 && data[lf-1] == '\r') ? lf - 1 : lf;
+			self->scanned = 0;
+			return deliver(self, data, n, lf + 1);
+		} else if (len < self->inline_size) {
+			self->scanned = len;
+			return 0;
+		} else if (len > self->max_size) {
+			goto too_big;
+		}
+
+		self->scanned = 0;
+		return spill(self, len, data, len, 0);
+	}
+
+	if ((h = frame_header(self, (const unsigned char *)data, len, &size, &trailer)) <= 0) {
+		if (h == 0)
+			return 0;
+		errno = EBADMSG;
+		return -1;
+	}
+
+	if (size > self->max_size)
+		goto too_big;
+	total = h + size + trailer;
+
+	if (total <= len) {
+		if (trailer && data[total - 1] != ',') {
+			errno = EBADMSG;
+			return -1;
+		}
+		return deliver(self, data + h, size, total);
+	} else if (total <= self->inline_size) {
+		return 0; /* wait for the rest in place */
+	}
+
+	return spill(self, size + trailer, data, len, h);
+too_big:
+	errno = EMSGSIZE;
+	return -1;
+}
@@ -0,0 +1,90 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EH_FRAME_H
+#define _EH_FRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * splits a byte stream into frames, meant to be called from
+ * eh_connection_cb.on_read(). frames that fit are delivered in place,
+ * bigger ones are assembled on the heap.
+ */
+enum eh_frame_mode {
+	EH_FRAME_LINE,		/**< up to "\n" or "\r\n", not included */
+	EH_FRAME_LENGTH,	/**< fixed size length header, see eh_frame_set_length() */
+	EH_FRAME_VARINT,	/**< LEB128 length header */
+	EH_FRAME_NETSTRING,	/**< "<len>:<payload>," */
+};
+
+struct eh_frame;
+
+struct eh_frame_cb {
+	/** a whole frame, only valid during the call. false closes */
+	bool (*on_frame) (struct eh_frame *, const char *, size_t);
+};
+
+struct eh_frame {
+	enum eh_frame_mode mode;
+	unsigned header_size;	/* of EH_FRAME_LENGTH */
+	bool big_endian;
+
+	size_t inline_size;
+	size_t max_size;
+	size_t scanned;		/* of an incomplete line */
+
+	/* frame being assembled on the heap */
+	char *big;
+	size_t big_len;
+	size_t big_size;	/* EH_FRAME_LINE grows it, the rest know it */
+
+	struct eh_frame_cb *cb;
+};
+
+/*
+ * inline_size is the biggest frame, with its header, handled in place,
+ * normally the size of the read buffer. bigger ones up to max_size are
+ * assembled on the heap.
+ */
+void eh_frame_init(struct eh_frame *self, enum eh_frame_mode mode,
+		   struct eh_frame_cb *cb, size_t inline_size, size_t max_size);
+void eh_frame_finish(struct eh_frame *self);
+
+/* 1, 2, 4 or 8 bytes. 4, big endian, by default */
+void eh_frame_set_length(struct eh_frame *self, unsigned header_size, bool big_endian);
+
+/*
+ * Returns: n:bytes consumed, 0:needs more data, -1:errno
+ * (EBADMSG malformed, EMSGSIZE over max_size, ENOMEM, ECANCELED by on_frame)
+ */
+ssize_t eh_frame_read(struct eh_frame *self, const char *data, size_t len);
+
+#endif /* !_EH_FRAME_H */
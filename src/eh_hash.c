@@ -0,0 +1,172 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "eh_alloc.h"
+#include "eh_hash.h"
+
+#define STEP	2	/* old buckets moved per insert, the next doubling
+			 * is at least old_size inserts away */
+
+static inline bool in_old(struct eh_hash *self, uint32_t hash)
+{
+	return self->old != NULL && (hash & (self->old_size - 1)) >= self->migrated;
+}
+
+static void migrate(struct eh_hash *self, size_t n)
+{
+	while (n-- > 0 && self->migrated < self->old_size) {
+		struct eh_hash_node *node = self->old[self->migrated], *next;
+
+		self->old[self->migrated++] = NULL;
+		for (; node; node = next) {
+			struct eh_hash_node **b = &self->buckets[node->hash & (self->size - 1)];
+
+			next = node->next;
+			node->next = *b;
+			*b = node;
+		}
+	}
+
+	if (self->migrated == self->old_size) {
+		eh_free(self->old);
+		self->old_size = self->migrated = 0;
+	}
+}
+
+/* doubles, chains just get longer if it can't */
+static void grow(struct eh_hash *self)
+{
+	struct eh_hash_node **buckets;
+
+	if (self->old != NULL)
+		migrate(self, self->old_size);
+
+	if ((buckets = eh_zalloc(2 * self->size * sizeof(*buckets))) == NULL)
+		return;
+
+	self->old = self->buckets;
+	self->old_size = self->size;
+	self->migrated = 0;
+
+	self->buckets = buckets;
+	self->size *= 2;
+}
+
+/** Returns: 0:ok, -1:errno */
+int eh_hash_init(struct eh_hash *self, size_t size_hint)
+{
+	size_t size = 16;
+
+	while (size < size_hint)
+		size <<= 1;
+
+	if ((self->buckets = eh_zalloc(size * sizeof(*self->buckets))) == NULL)
+		return -1;
+
+	self->size = size;
+	self->count = 0;
+
+	self->old = NULL;
+	self->old_size = self->migrated = 0;
+	return 0;
+}
+
+/** Releases the buckets, the nodes are the caller's */
+void eh_hash_finish(struct eh_hash *self)
+{
+	if (self->old != NULL)
+		eh_free(self->old);
+	eh_free(self->buckets);
+
+	self->size = self->count = 0;
+	self->old_size = self->migrated = 0;
+}
+
+void eh_hash_insert(struct eh_hash *self, struct eh_hash_node *node, uint32_t hash)
+{
+	struct eh_hash_node **b;
+
+	if (self->old != NULL)
+		migrate(self, STEP);
+	else if (self->count >= self->size)
+		grow(self);
+
+	node->hash = hash;
+	b = _eh_hash_bucket(self, hash);
+	node->next = *b;
+	*b = node;
+	self->count++;
+}
+
+void eh_hash_del(struct eh_hash *self, struct eh_hash_node *node)
+{
+	for (struct eh_hash_node **p = _eh_hash_bucket(self, node->hash); *p; p = &(*p)->next) {
+		if (*p == node) {
+			*p = node->next;
+			self->count--;
+			return;
+		}
+	}
+}
+
+/* what's left of the old buckets first, then the new ones */
+struct eh_hash_node *eh_hash_next(struct eh_hash *self, struct eh_hash_node *node)
+{
+	bool old;
+	size_t i;
+
+	if (node != NULL) {
+		if (node->next != NULL)
+			return node->next;
+
+		old = in_old(self, node->hash);
+		i = (node->hash & ((old ? self->old_size : self->size) - 1)) + 1;
+	} else {
+		old = (self->old != NULL);
+		i = self->migrated;
+	}
+
+	if (old) {
+		for (; i < self->old_size; i++) {
+			if (self->old[i] != NULL)
+				return self->old[i];
+		}
+		i = 0;
+	}
+
+	for (; i < self->size; i++) {
+		if (self->buckets[i] != NULL)
+			return self->buckets[i];
+	}
+	return NULL;
+}
@@ -0,0 +1,105 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EH_HASH_H
+#define _EH_HASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Chained hash table of embedded nodes
+ *
+ * The caller hashes its keys and compares them. When the table doubles,
+ * the old buckets move over a few per insert, so no single insert pays
+ * for the whole rehash. Until then lookups check both tables.
+ */
+struct eh_hash_node {
+	struct eh_hash_node *next;	/**< next node on the same bucket */
+	uint32_t hash;			/**< hash of the node's key */
+};
+
+struct eh_hash {
+	struct eh_hash_node **buckets;
+	size_t size;			/**< power of 2 */
+	size_t count;
+
+	struct eh_hash_node **old;	/**< previous buckets, while resizing */
+	size_t old_size;
+	size_t migrated;		/**< old buckets already moved */
+};
+
+int eh_hash_init(struct eh_hash *self, size_t size_hint);
+void eh_hash_finish(struct eh_hash *self);
+
+void eh_hash_insert(struct eh_hash *self, struct eh_hash_node *node, uint32_t hash);
+void eh_hash_del(struct eh_hash *self, struct eh_hash_node *node);
+
+/* the bucket a hash is on, old or new */
+static inline struct eh_hash_node **_eh_hash_bucket(struct eh_hash *self, uint32_t hash)
+{
+	if (self->old != NULL && (hash & (self->old_size - 1)) >= self->migrated)
+		return &self->old[hash & (self->old_size - 1)];
+	return &self->buckets[hash & (self->size - 1)];
+}
+
+/** First node with that hash that match() accepts
+ *
+ * Inline so match() is too, and lookups in a row overlap their misses.
+ */
+static inline struct eh_hash_node *eh_hash_find(struct eh_hash *self, uint32_t hash,
+						bool (*match) (const struct eh_hash_node *, const void *),
+						const void *key)
+{
+	for (struct eh_hash_node *node = *_eh_hash_bucket(self, hash); node; node = node->next) {
+		if (node->hash == hash && match(node, key))
+			return node;
+	}
+	return NULL;
+}
+
+/** Walks every node, NULL starts. Nodes can be deleted but not inserted */
+struct eh_hash_node *eh_hash_next(struct eh_hash *self, struct eh_hash_node *node);
+
+#define eh_hash_foreach(H, I) for(struct eh_hash_node *I = eh_hash_next((H), NULL); (I); (I) = eh_hash_next((H), (I)))
+#define eh_hash_foreach2(H, I, N) for(struct eh_hash_node *I = eh_hash_next((H), NULL), *N = (I) ? eh_hash_next((H), (I)) : NULL; (I); (I) = (N), (N) = (I) ? eh_hash_next((H), (I)) : NULL)
+
+#define eh_hash_count(H)	((H)->count)
+
+/** FNV-1a, for keys without a better one */
+static inline uint32_t eh_hash_bytes(const void *data, size_t len)
+{
+	const unsigned char *s = data;
+	uint32_t h = 2166136261u;
+
+	while (len--)
+		h = (h ^ *s++) * 16777619u;
+	return h;
+}
+
+#endif /* !_EH_HASH_H */
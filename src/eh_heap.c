@@ -0,0 +1,273 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#include "eh.h"
+#include "eh_alloc.h"
+#include "eh_watcher.h"
+#include "eh_heap.h"
+
+#define D		4
+#define PARENT(I)	(((I) - 1) / D)
+#define CHILD(I)	((I) * D + 1)
+
+static inline void place(struct eh_heap *self, size_t i, struct eh_heap_entry e)
+{
+	self->entries[i] = e;
+	e.node->index = i;
+}
+
+static void sift_up(struct eh_heap *self, size_t i)
+{
+	struct eh_heap_entry e = self->entries[i];
+
+	while (i > 0) {
+		size_t p = PARENT(i);
+
+		if (self->entries[p].key <= e.key)
+			break;
+		place(self, i, self->entries[p]);
+		i = p;
+	}
+	place(self, i, e);
+}
+
+static void sift_down(struct eh_heap *self, size_t i)
+{
+	struct eh_heap_entry e = self->entries[i];
+
+	for (;;) {
+		size_t c = CHILD(i), end = c + D, m = c;
+
+		if (c >= self->count)
+			break;
+		if (end > self->count)
+			end = self->count;
+
+		while (++c < end) {
+			if (self->entries[c].key < self->entries[m].key)
+				m = c;
+		}
+
+		if (self->entries[m].key >= e.key)
+			break;
+		place(self, i, self->entries[m]);
+		i = m;
+	}
+	place(self, i, e);
+}
+
+/* after the key at i changed in either direction */
+static void sift(struct eh_heap *self, size_t i)
+{
+	if (i > 0 && self->entries[i].key < self->entries[PARENT(i)].key)
+		sift_up(self, i);
+	else
+		sift_down(self, i);
+}
+
+/** Returns: 0:ok, -1:errno */
+int eh_heap_init(struct eh_heap *self, size_t size_hint)
+{
+	size_t size = 16;
+
+	while (size < size_hint)
+		size <<= 1;
+
+	if ((self->entries = eh_alloc(size * sizeof(*self->entries))) == NULL)
+		return -1;
+
+	self->size = size;
+	self->count = 0;
+	return 0;
+}
+
+/** Releases the array, the nodes still in are left queued */
+void eh_heap_finish(struct eh_heap *self)
+{
+	eh_free(self->entries);
+	self->size = self->count = 0;
+}
+
+/** Returns: 0:ok, -1:errno */
+int eh_heap_insert(struct eh_heap *self, struct eh_heap_node *node, double key)
+{
+	assert(!eh_heap_queued(node));
+
+	if (self->count == self->size) {
+		struct eh_heap_entry *entries = eh_alloc(2 * self->size * sizeof(*entries));
+
+		if (entries == NULL)
+			return -1;
+
+		memcpy(entries, self->entries, self->count * sizeof(*entries));
+		eh_free(self->entries);
+		self->entries = entries;
+		self->size *= 2;
+	}
+
+	self->entries[self->count] = (struct eh_heap_entry) { key, node };
+	sift_up(self, self->count++);
+	return 0;
+}
+
+void eh_heap_del(struct eh_heap *self, struct eh_heap_node *node)
+{
+	size_t i = node->index;
+
+	assert(i < self->count && self->entries[i].node == node);
+
+	node->index = EH_HEAP_NONE;
+	if (i != --self->count) {
+		place(self, i, self->entries[self->count]);
+		sift(self, i);
+	}
+}
+
+void eh_heap_update(struct eh_heap *self, struct eh_heap_node *node, double key)
+{
+	size_t i = node->index;
+
+	assert(i < self->count && self->entries[i].node == node);
+
+	self->entries[i].key = key;
+	sift(self, i);
+}
+
+struct eh_heap_node *eh_heap_pop(struct eh_heap *self)
+{
+	struct eh_heap_node *node = eh_heap_top(self);
+
+	if (node != NULL)
+		eh_heap_del(self, node);
+	return node;
+}
+
+/*
+ * deadline queue
+ */
+static void eh_heap_timer_arm(struct eh_heap_timer *self)
+{
+	ev_timer_stop(self->loop, &self->timer);
+
+	if (self->heap.count > 0) {
+		ev_tstamp after = self->heap.entries[0].key - ev_now(self->loop);
+
+		eh_timer_set(&self->timer, after > 0. ? after : 0., 0.);
+		ev_timer_start(self->loop, &self->timer);
+	}
+}
+
+/* entries of the subtree at i with a key not after key */
+static size_t eh_heap_count_until(const struct eh_heap *self, size_t i, double key)
+{
+	size_t n = 0, c, end;
+
+	if (i >= self->count || self->entries[i].key > key)
+		return 0;
+
+	for (c = CHILD(i), end = c + D; c < end && c < self->count; c++)
+		n += eh_heap_count_until(self, c, key);
+	return n + 1;
+}
+
+/*
+ * only as many nodes as had expired on entry, so one that on_expire()
+ * adds again with after <= 0 can't keep this loop going forever
+ */
+static void eh_heap_timer_cb(struct ev_loop *loop, ev_timer *w, int UNUSED(revents))
+{
+	struct eh_heap_timer *self = w->data;
+	ev_tstamp now = ev_now(loop);
+	size_t n = eh_heap_count_until(&self->heap, 0, now);
+
+	while (n-- > 0 && self->heap.count > 0 && self->heap.entries[0].key <= now)
+		self->on_expire(self, eh_heap_pop(&self->heap));
+
+	eh_heap_timer_arm(self);
+}
+
+/** Returns: 0:ok, -1:errno */
+int eh_heap_timer_init(struct eh_heap_timer *self, struct ev_loop *loop,
+		       void (*on_expire) (struct eh_heap_timer *, struct eh_heap_node *),
+		       size_t size_hint)
+{
+	assert(loop != NULL);
+	assert(on_expire != NULL);
+
+	if (eh_heap_init(&self->heap, size_hint) < 0)
+		return -1;
+
+	eh_timer_init(&self->timer, eh_heap_timer_cb, self, 0., 0.);
+	self->loop = loop;
+	self->on_expire = on_expire;
+	return 0;
+}
+
+void eh_heap_timer_finish(struct eh_heap_timer *self)
+{
+	ev_timer_stop(self->loop, &self->timer);
+	eh_heap_finish(&self->heap);
+}
+
+/** Expires node after that long, or moves it if already queued
+ *
+ * Returns: 0:ok, -1:errno
+ */
+int eh_heap_timer_add(struct eh_heap_timer *self, struct eh_heap_node *node,
+		      ev_tstamp after)
+{
+	struct eh_heap_node *top = eh_heap_top(&self->heap);
+	ev_tstamp key = ev_now(self->loop) + after;
+
+	if (eh_heap_queued(node))
+		eh_heap_update(&self->heap, node, key);
+	else if (eh_heap_insert(&self->heap, node, key) < 0)
+		return -1;
+
+	/* only when the earliest changed */
+	if (top != eh_heap_top(&self->heap) || top == node)
+		eh_heap_timer_arm(self);
+	return 0;
+}
+
+void eh_heap_timer_cancel(struct eh_heap_timer *self, struct eh_heap_node *node)
+{
+	bool top = (node->index == 0);
+
+	if (!eh_heap_queued(node))
+		return;
+
+	eh_heap_del(&self->heap, node);
+	if (top)
+		eh_heap_timer_arm(self);
+}
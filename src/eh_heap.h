@@ -0,0 +1,111 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EH_HEAP_H
+#define _EH_HEAP_H
+
+#include <ev.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/** 4-ary min-heap of embedded nodes
+ *
+ * Keys are cached next to the node pointers, so sifting doesn't touch
+ * the nodes but to update their index, and the index makes deleting or
+ * updating any node O(log n).
+ */
+#define EH_HEAP_NONE	((size_t)-1)
+
+struct eh_heap_node {
+	size_t index;		/**< position in the heap, EH_HEAP_NONE if not in */
+};
+
+struct eh_heap_entry {
+	double key;
+	struct eh_heap_node *node;
+};
+
+struct eh_heap {
+	struct eh_heap_entry *entries;
+	size_t count;
+	size_t size;
+};
+
+static inline void eh_heap_node_init(struct eh_heap_node *self)
+{
+	self->index = EH_HEAP_NONE;
+}
+
+static inline bool eh_heap_queued(const struct eh_heap_node *self)
+{
+	return self->index != EH_HEAP_NONE;
+}
+
+int eh_heap_init(struct eh_heap *self, size_t size_hint);
+void eh_heap_finish(struct eh_heap *self);
+
+int eh_heap_insert(struct eh_heap *self, struct eh_heap_node *node, double key);
+void eh_heap_del(struct eh_heap *self, struct eh_heap_node *node);
+void eh_heap_update(struct eh_heap *self, struct eh_heap_node *node, double key);
+struct eh_heap_node *eh_heap_pop(struct eh_heap *self);
+
+/** Node with the smallest key, NULL when empty */
+static inline struct eh_heap_node *eh_heap_top(struct eh_heap *self)
+{
+	return self->count > 0 ? self->entries[0].node : NULL;
+}
+
+static inline double eh_heap_key(struct eh_heap *self, const struct eh_heap_node *node)
+{
+	return self->entries[node->index].key;
+}
+
+/*
+ * deadline queue, one ev_timer armed for the earliest of many deadlines.
+ * keys are ev_now() based, and on_expire() gets each expired node already
+ * out of the queue, free to add it again. one added again already expired
+ * waits for the next round.
+ */
+struct eh_heap_timer {
+	struct eh_heap heap;
+	ev_timer timer;
+	struct ev_loop *loop;
+
+	void (*on_expire) (struct eh_heap_timer *, struct eh_heap_node *);
+};
+
+int eh_heap_timer_init(struct eh_heap_timer *self, struct ev_loop *loop,
+		       void (*on_expire) (struct eh_heap_timer *, struct eh_heap_node *),
+		       size_t size_hint);
+void eh_heap_timer_finish(struct eh_heap_timer *self);
+
+int eh_heap_timer_add(struct eh_heap_timer *self, struct eh_heap_node *node,
+		      ev_tstamp after);
+void eh_heap_timer_cancel(struct eh_heap_timer *self, struct eh_heap_node *node);
+
+#endif /* !_EH_HEAP_H */
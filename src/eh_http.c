@@ -0,0 +1,432 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_scan.h"
+#include "eh_http.h"
+
+#define MAX_CHUNK_LINE	1024	/* arbitrary */
+
+void eh_http_parser_init(struct eh_http_parser *self, struct eh_http_parser_cb *cb,
+			 struct eh_http_header *headers, size_t headers_size)
+{
+	assert(self != NULL);
+	assert(cb != NULL && cb->on_request != NULL);
+	assert(headers != NULL || headers_size == 0);
+
+	*self = (struct eh_http_parser) {
+		.state = EH_HTTP_HEAD,
+		.headers = headers,
+		.headers_size = headers_size,
+		.cb = cb,
+	};
+}
+
+/*
+ * end of the head, just after the empty line, or 0 if it's not there yet.
+ * bare LFs are accepted as line ends.
+ */
+static size_t find_head_end(const char *data, size_t from, size_t len)
+{
+	const char *p = data + from, *end = data + len, *lf;
+
+	for (; (lf = memchr(p, '\n', end - p)) != NULL; p = lf + 1) {
+		if (lf + 1 < end && lf[1] == '\n')
+			return lf + 2 - data;
+		if (lf + 2 < end && lf[1] == '\r' && lf[2] == '\n')
+			return lf + 3 - data;
+	}
+	return 0;
+}
+
+/* tchar of RFC 7230, alphanumerics and "!#$%&'*+-.^_`|~" */
+static const uint8_t tchar[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0x00 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,	/* 0x10 */
+	0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,	/* 0x20 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,	/* 0x30 */
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 0x40 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,	/* 0x50 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 0x60 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,	/* 0x70 */
+	/* 0x80 and above are none */
+};
+
+static inline bool is_tchar(unsigned char c)
+{
+	return tchar[c];
+}
+
+/* one line, without its end. NULL if there is none */
+static inline const char *next_line(const char *p, const char *end, size_t *len)
+{
+	const char *lf = memchr(p, '\n', end - p);
+
+	if (lf == NULL)
+		return NULL;
+
+	*len = lf - p;
+	if (*len > 0 && p[*len - 1] == '\r')
+		(*len)--;
+	return lf + 1;
+}
+
+static inline bool token_eq(const char *s, size_t len, const char *token)
+{
+	return strlen(token) == len && strncasecmp(s, token, len) == 0;
+}
+
+/* any element of a comma separated list */
+static bool list_has(const char *s, size_t len, const char *token)
+{
+	const char *end = s + len, *comma;
+
+	for (; s < end; s = comma + 1) {
+		const char *e;
+
+		if ((comma = memchr(s, ',', end - s)) == NULL)
+			comma = end;
+		for (; s < comma && (*s == ' ' || *s == '\t'); s++)
+			;
+		for (e = comma; e > s && (e[-1] == ' ' || e[-1] == '\t'); e--)
+			;
+		if (token_eq(s, e - s, token))
+			return true;
+	}
+	return false;
+}
+
+/* last element of a comma separated list */
+static inline bool list_ends_with(const char *s, size_t len, const char *token)
+{
+	const char *p = s + len;
+
+	while (p > s && p[-1] != ',')
+		p--;
+	for (; p < s + len && (*p == ' ' || *p == '\t'); p++)
+		;
+	return token_eq(p, s + len - p, token);
+}
+
+/* "METHOD SP target SP HTTP/1.x" */
+static int parse_request_line(struct eh_http_request *req, const char *p, size_t len)
+{
+	const char *end = p + len, *sp;
+
+	for (sp = p; sp < end && is_tchar(*sp); sp++)
+		;
+	if (sp == p || sp == end || *sp != ' ')
+		return -1;
+	req->method = p;
+	req->method_len = sp - p;
+
+	p = sp + 1;
+	if ((sp = memchr(p, ' ', end - p)) == NULL || sp == p)
+		return -1;
+	req->target = p;
+	req->target_len = sp - p;
+
+	p = sp + 1;
+	if (end - p != 8 || memcmp(p, "HTTP/1.", 7) != 0 ||
+	    (p[7] != '0' && p[7] != '1'))
+		return -1;
+	req->version = 10 + (p[7] - '0');
+	return 0;
+}
+
+/*
+ * "name: value" up to its line end, the value without surrounding spaces.
+ * Returns: the length of the line, 0 if it isn't whole yet, -1 if it's
+ * malformed
+ */
+static ssize_t parse_header(struct eh_http_header *h, const char *p, const char *end)
+{
+	const char *colon, *lf, *v;
+
+	for (colon = p; colon < end && is_tchar(*colon); colon++)
+		;
+	if (colon == end)
+		return 0;
+	if (colon == p || *colon != ':')
+		return -1; /* also obsolete line folding */
+
+	if ((lf = memchr(colon + 1, '\n', end - colon - 1)) == NULL)
+		return 0;
+
+	h->name = p;
+	h->name_len = colon - p;
+
+	end = lf;
+	if (end > colon + 1 && end[-1] == '\r')
+		end--;
+	for (v = colon + 1; v < end && (*v == ' ' || *v == '\t'); v++)
+		;
+	for (; end > v && (end[-1] == ' ' || end[-1] == '\t'); end--)
+		;
+	h->value = v;
+	h->value_len = end - v;
+	return lf + 1 - p;
+}
+
+/* framing and persistence, out of the parsed headers */
+static int parse_semantics(struct eh_http_request *req)
+{
+	bool has_length = false, closes = false;
+
+	req->content_length = 0;
+	req->chunked = false;
+	req->keep_alive = (req->version >= 11);
+
+	for (size_t i = 0; i < req->headers_count; i++) {
+		const struct eh_http_header *h = &req->headers[i];
+
+		if (token_eq(h->name, h->name_len, "content-length")) {
+			uint64_t v;
+			ssize_t l = eh_scan_u64(h->value, h->value_len, &v);
+
+			if (l <= 0 || (size_t)l != h->value_len ||
+			    (has_length && v != req->content_length))
+				return -1;
+			req->content_length = v;
+			has_length = true;
+		} else if (token_eq(h->name, h->name_len, "transfer-encoding")) {
+			if (!list_ends_with(h->value, h->value_len, "chunked"))
+				return -1; /* can't tell where the body ends */
+			req->chunked = true;
+		} else if (token_eq(h->name, h->name_len, "connection")) {
+			/* "TE, close" closes too, and close beats keep-alive */
+			if (list_has(h->value, h->value_len, "close"))
+				closes = true;
+			else if (list_has(h->value, h->value_len, "keep-alive"))
+				req->keep_alive = true;
+		}
+	}
+
+	if (closes)
+		req->keep_alive = false;
+
+	/* both are a smuggling vector, refuse */
+	if (req->chunked && has_length)
+		return -1;
+	return 0;
+}
+
+static ssize_t parse_head(struct eh_http_parser *self, const char *data, size_t len)
+{
+	struct eh_http_request req = { .headers = self->headers };
+	const char *p = data, *line, *end;
+	size_t head, l;
+
+	/* empty lines before a request are ignored */
+	for (l = 0; l < len && (data[l] == '\r' || data[l] == '\n'); l++)
+		;
+	if (l > 0) {
+		self->scanned = 0;
+		return l;
+	}
+
+	/* the head didn't fit before, parse it once its end is there */
+	if (self->scanned > 0) {
+		if (find_head_end(data, self->scanned > 3 ? self->scanned - 3 : 0, len) == 0)
+			goto incomplete;
+		self->scanned = 0;
+	}
+
+	/* a single pass, every line is parsed as it's found */
+	end = data + len;
+	if ((p = next_line(line = p, end, &l)) == NULL)
+		goto incomplete;
+	if (parse_request_line(&req, line, l) < 0)
+		goto bad;
+
+	for (;;) {
+		ssize_t n;
+
+		/* up to the empty line */
+		if (p < end && *p == '\n') {
+			p++;
+			break;
+		} else if (end - p < 2) {
+			goto incomplete;
+		} else if (p[0] == '\r' && p[1] == '\n') {
+			p += 2;
+			break;
+		}
+
+		if (req.headers_count == self->headers_size) {
+			errno = E2BIG;
+			return -1;
+		}
+		if ((n = parse_header(&req.headers[req.headers_count], p, end)) == 0)
+			goto incomplete;
+		else if (n < 0)
+			goto bad;
+		req.headers_count++;
+		p += n;
+	}
+	head = p - data;
+
+	if (parse_semantics(&req) < 0)
+		goto bad;
+
+	if (!self->cb->on_request(self, &req))
+		goto cancel;
+
+	if (req.chunked) {
+		self->state = EH_HTTP_CHUNK_SIZE;
+	} else if (req.content_length > 0) {
+		self->state = EH_HTTP_BODY;
+		self->remaining = req.content_length;
+	} else if (self->cb->on_complete && !self->cb->on_complete(self)) {
+		goto cancel;
+	}
+	return head;
+incomplete:
+	self->scanned = len;
+	return 0;
+bad:
+	errno = EBADMSG;
+	return -1;
+cancel:
+	errno = ECANCELED;
+	return -1;
+}
+
+static ssize_t parse_body(struct eh_http_parser *self, const char *data, size_t len,
+			  enum eh_http_parser_state next)
+{
+	size_t l = len < self->remaining ? len : self->remaining;
+
+	if (self->cb->on_body && !self->cb->on_body(self, data, l))
+		goto cancel;
+
+	if ((self->remaining -= l) == 0) {
+		self->state = next;
+		if (next == EH_HTTP_HEAD && self->cb->on_complete &&
+		    !self->cb->on_complete(self))
+			goto cancel;
+	}
+	return l;
+cancel:
+	errno = ECANCELED;
+	return -1;
+}
+
+/* chunk size lines, the CRLF after the data, and the trailer */
+static ssize_t parse_chunk_line(struct eh_http_parser *self, const char *data, size_t len)
+{
+	const char *next;
+	size_t l;
+	ssize_t n;
+
+	if ((next = next_line(data, data + len, &l)) == NULL) {
+		if (len > MAX_CHUNK_LINE)
+			goto bad;
+		return 0;
+	}
+
+	switch (self->state) {
+	case EH_HTTP_CHUNK_SIZE:
+		/* hex size, maybe followed by extensions */
+		n = eh_scan_x64(data, l, &self->remaining);
+		if (n <= 0 || ((size_t)n < l && data[n] != ';' &&
+				data[n] != ' ' && data[n] != '\t'))
+			goto bad;
+		self->state = self->remaining ? EH_HTTP_CHUNK_DATA : EH_HTTP_TRAILER;
+		break;
+	case EH_HTTP_CHUNK_END:
+		if (l != 0)
+			goto bad;
+		self->state = EH_HTTP_CHUNK_SIZE;
+		break;
+	case EH_HTTP_TRAILER:
+		/* trailer fields are skipped */
+		if (l == 0) {
+			self->state = EH_HTTP_HEAD;
+			if (self->cb->on_complete && !self->cb->on_complete(self)) {
+				errno = ECANCELED;
+				return -1;
+			}
+		}
+		break;
+	default:
+		assert(0);
+	}
+	return next - data;
+bad:
+	errno = EBADMSG;
+	return -1;
+}
+
+/** Parses as much as it can of one request
+ *
+ * Meant to be returned from on_read(), which calls it again while it
+ * consumes, so pipelined requests are handled one after the other.
+ */
+ssize_t eh_http_parse(struct eh_http_parser *self, const char *data, size_t len)
+{
+	assert(self != NULL);
+
+	if (len == 0)
+		return 0;
+
+	switch (self->state) {
+	case EH_HTTP_HEAD:
+		return parse_head(self, data, len);
+	case EH_HTTP_BODY:
+		return parse_body(self, data, len, EH_HTTP_HEAD);
+	case EH_HTTP_CHUNK_DATA:
+		return parse_body(self, data, len, EH_HTTP_CHUNK_END);
+	default:
+		return parse_chunk_line(self, data, len);
+	}
+}
+
+/** First header called name, case insensitive */
+const struct eh_http_header *eh_http_header_find(const struct eh_http_request *req,
+						 const char *name)
+{
+	size_t l = strlen(name);
+
+	for (size_t i = 0; i < req->headers_count; i++) {
+		const struct eh_http_header *h = &req->headers[i];
+		if (h->name_len == l && strncasecmp(h->name, name, l) == 0)
+			return h;
+	}
+	return NULL;
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EH_HTTP_H
+#define _EH_HTTP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * incremental HTTP/1.1 request parser, meant to be called from
+ * eh_connection_cb.on_read(). everything handed to the callbacks points
+ * into the given data and is only valid during the call.
+ */
+struct eh_http_header {
+	const char *name;
+	const char *value;
+	size_t name_len;
+	size_t value_len;
+};
+
+struct eh_http_request {
+	const char *method;
+	const char *target;
+	size_t method_len;
+	size_t target_len;
+	unsigned version;	/**< 10 or 11 */
+
+	struct eh_http_header *headers;
+	size_t headers_count;
+
+	uint64_t content_length;
+	bool chunked;
+	bool keep_alive;
+};
+
+struct eh_http_parser;
+
+struct eh_http_parser_cb {
+	/** the request head is complete. false closes */
+	bool (*on_request) (struct eh_http_parser *, struct eh_http_request *);
+	/** a piece of the body, already de-chunked. false closes */
+	bool (*on_body) (struct eh_http_parser *, const char *, size_t);
+	/** the whole request is in, the next one may follow. false closes */
+	bool (*on_complete) (struct eh_http_parser *);
+};
+
+enum eh_http_parser_state {
+	EH_HTTP_HEAD,
+	EH_HTTP_BODY,
+	EH_HTTP_CHUNK_SIZE,
+	EH_HTTP_CHUNK_DATA,
+	EH_HTTP_CHUNK_END,
+	EH_HTTP_TRAILER,
+};
+
+struct eh_http_parser {
+	enum eh_http_parser_state state;
+	size_t scanned;		/* of the head so far, to resume the search */
+	uint64_t remaining;	/* of the body or chunk */
+
+	struct eh_http_header *headers;
+	size_t headers_size;
+
+	struct eh_http_parser_cb *cb;
+};
+
+void eh_http_parser_init(struct eh_http_parser *self, struct eh_http_parser_cb *cb,
+			 struct eh_http_header *headers, size_t headers_size);
+
+/*
+ * Returns: n:bytes consumed, 0:needs more data, -1:errno
+ * (EBADMSG malformed, E2BIG too many headers, ECANCELED by a callback)
+ */
+ssize_t eh_http_parse(struct eh_http_parser *self, const char *data, size_t len);
+
+const struct eh_http_header *eh_http_header_find(const struct eh_http_request *req,
+						 const char *name);
+
+#endif /* !_EH_HTTP_H */
@@ -0,0 +1,257 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "eh.h"
+#include "eh_alloc.h"
+#include "eh_connection.h"
+#include "eh_hub.h"
+
+struct eh_hub_topic {
+	struct eh_hash_node node;
+
+	struct eh_list subscribers;
+	size_t count;
+
+	size_t len;
+	char name[];
+};
+
+struct key {
+	const char *name;
+	size_t len;
+};
+
+/* a subscriber on a topic, listed on both */
+struct subscription {
+	struct eh_list by_topic;
+	struct eh_list by_subscriber;
+
+	struct eh_hub_topic *topic;
+	struct eh_hub_subscriber *sub;
+};
+
+static bool match(const struct eh_hash_node *node, const void *data)
+{
+	const struct eh_hub_topic *t = container_of(node, struct eh_hub_topic, node);
+	const struct key *key = data;
+
+	return t->len == key->len && memcmp(t->name, key->name, key->len) == 0;
+}
+
+static struct eh_hub_topic *lookup(struct eh_hub *self, const char *name,
+				   size_t len, uint32_t h)
+{
+	struct key key = { name, len };
+	struct eh_hash_node *node = eh_hash_find(&self->topics, h, match, &key);
+
+	return node ? container_of(node, struct eh_hub_topic, node) : NULL;
+}
+
+static void drop(struct eh_hub *self, struct subscription *s)
+{
+	struct eh_hub_topic *t = s->topic;
+
+	eh_list_del(&s->by_topic);
+	eh_list_del(&s->by_subscriber);
+	eh_free(s);
+
+	if (--t->count == 0) {
+		eh_hash_del(&self->topics, &t->node);
+		eh_free(t);
+	}
+}
+
+/** Returns: 0:ok, -1:errno */
+int eh_hub_init(struct eh_hub *self, size_t size_hint)
+{
+	return eh_hash_init(&self->topics, size_hint);
+}
+
+/** Releases every topic, subscribers are left with none */
+void eh_hub_finish(struct eh_hub *self)
+{
+	eh_hash_foreach2(&self->topics, node, next) {
+		struct eh_hub_topic *t = container_of(node, struct eh_hub_topic, node);
+
+		eh_list_foreach2(&t->subscribers, item, tmp) {
+			struct subscription *s = container_of(item,
+					struct subscription, by_topic);
+
+			eh_list_del(&s->by_subscriber);
+			eh_free(s);
+		}
+		eh_free(t);
+	}
+
+	eh_hash_finish(&self->topics);
+}
+
+void eh_hub_subscriber_init(struct eh_hub_subscriber *self,
+			    struct eh_connection *conn, size_t max_pending,
+			    enum eh_hub_policy policy)
+{
+	self->conn = conn;
+	eh_list_init(&self->subscriptions);
+
+	self->max_pending = max_pending;
+	self->policy = policy;
+	self->dropped = 0;
+}
+
+int eh_hub_subscribe(struct eh_hub *self, struct eh_hub_subscriber *sub,
+		     const char *topic, size_t len)
+{
+	uint32_t h = eh_hash_bytes(topic, len);
+	struct eh_hub_topic *t = lookup(self, topic, len, h);
+	struct subscription *s;
+
+	if (t == NULL) {
+		if ((t = eh_alloc(sizeof(*t) + len)) == NULL)
+			return -1;
+
+		eh_list_init(&t->subscribers);
+		t->count = 0;
+		t->len = len;
+		memcpy(t->name, topic, len);
+
+		eh_hash_insert(&self->topics, &t->node, h);
+	} else {
+		eh_list_foreach(&sub->subscriptions, item) {
+			s = container_of(item, struct subscription, by_subscriber);
+			if (s->topic == t)
+				return 0;
+		}
+	}
+
+	if ((s = eh_alloc(sizeof(*s))) == NULL) {
+		if (t->count == 0) {
+			eh_hash_del(&self->topics, &t->node);
+			eh_free(t);
+		}
+		return -1;
+	}
+
+	s->topic = t;
+	s->sub = sub;
+	eh_list_append(&t->subscribers, &s->by_topic);
+	eh_list_append(&sub->subscriptions, &s->by_subscriber);
+	t->count++;
+	return 1;
+}
+
+int eh_hub_unsubscribe(struct eh_hub *self, struct eh_hub_subscriber *sub,
+		       const char *topic, size_t len)
+{
+	struct eh_hub_topic *t = lookup(self, topic, len, eh_hash_bytes(topic, len));
+
+	if (t == NULL)
+		return 0;
+
+	eh_list_foreach(&sub->subscriptions, item) {
+		struct subscription *s = container_of(item, struct subscription,
+						      by_subscriber);
+		if (s->topic == t) {
+			drop(self, s);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void eh_hub_unsubscribe_all(struct eh_hub *self, struct eh_hub_subscriber *sub)
+{
+	eh_list_foreach2(&sub->subscriptions, item, next)
+		drop(self, container_of(item, struct subscription, by_subscriber));
+}
+
+/*
+ * subscribers over max_pending miss it. those to disconnect are closed
+ * from the loop, as the publisher can be one of them, or any connection
+ * in the middle of its own callbacks.
+ */
+static ssize_t deliver(struct eh_hub_topic *t, struct eh_payload *payload)
+{
+	ssize_t n = 0;
+
+	eh_list_foreach(&t->subscribers, item) {
+		struct subscription *s = container_of(item, struct subscription,
+						      by_topic);
+		struct eh_hub_subscriber *sub = s->sub;
+
+		if (sub->max_pending > 0 &&
+		    eh_connection_pending(sub->conn) >= sub->max_pending) {
+			sub->dropped++;
+			if (sub->policy == EH_HUB_DISCONNECT)
+				eh_connection_close(sub->conn);
+		} else if (eh_connection_write_payload(sub->conn, payload) < 0) {
+			sub->dropped++;
+		} else {
+			n++;
+		}
+	}
+	return n;
+}
+
+ssize_t eh_hub_publish(struct eh_hub *self, const char *topic, size_t len,
+		       struct eh_payload *payload)
+{
+	struct eh_hub_topic *t = lookup(self, topic, len, eh_hash_bytes(topic, len));
+
+	return t ? deliver(t, payload) : 0;
+}
+
+/** Same, for data not in a payload yet. Only copied once, if at all */
+ssize_t eh_hub_publish_data(struct eh_hub *self, const char *topic, size_t len,
+			    const char *data, size_t data_len)
+{
+	struct eh_hub_topic *t = lookup(self, topic, len, eh_hash_bytes(topic, len));
+	struct eh_payload *payload;
+	ssize_t n;
+
+	if (t == NULL)
+		return 0;
+	else if ((payload = eh_payload_new(data, data_len)) == NULL)
+		return -1;
+
+	n = deliver(t, payload);
+	eh_payload_put(payload);
+	return n;
+}
+
+size_t eh_hub_subscribers(struct eh_hub *self, const char *topic, size_t len)
+{
+	struct eh_hub_topic *t = lookup(self, topic, len, eh_hash_bytes(topic, len));
+
+	return t ? t->count : 0;
+}
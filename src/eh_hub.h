@@ -0,0 +1,93 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EH_HUB_H
+#define _EH_HUB_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <eh_list.h>
+#include <eh_hash.h>
+#include <eh_payload.h>
+
+struct eh_connection;
+
+/*
+ * topic based fan-out. connections subscribe to topics by name and a
+ * publish queues one shared payload on every subscriber. what's
+ * published within a loop iteration goes out in one writev() per
+ * subscriber.
+ */
+enum eh_hub_policy {
+	EH_HUB_DROP,		/**< skip messages while over max_pending */
+	EH_HUB_DISCONNECT,	/**< eh_connection_close() it */
+};
+
+struct eh_hub_topic;
+
+/** Embedded next to the eh_connection it delivers to */
+struct eh_hub_subscriber {
+	struct eh_connection *conn;
+	struct eh_list subscriptions;
+
+	size_t max_pending;		/**< eh_connection_pending() limit, 0 is none */
+	enum eh_hub_policy policy;
+	unsigned long dropped;
+};
+
+struct eh_hub {
+	struct eh_hash topics;
+};
+
+int eh_hub_init(struct eh_hub *self, size_t size_hint);
+void eh_hub_finish(struct eh_hub *self);
+
+void eh_hub_subscriber_init(struct eh_hub_subscriber *self,
+			    struct eh_connection *conn, size_t max_pending,
+			    enum eh_hub_policy policy);
+
+/* 1:subscribed, 0:already was, -1:errno */
+int eh_hub_subscribe(struct eh_hub *self, struct eh_hub_subscriber *sub,
+		     const char *topic, size_t len);
+/* 1:unsubscribed, 0:wasn't */
+int eh_hub_unsubscribe(struct eh_hub *self, struct eh_hub_subscriber *sub,
+		       const char *topic, size_t len);
+/** Mandatory before the subscriber goes away, on_close() is a good place */
+void eh_hub_unsubscribe_all(struct eh_hub *self, struct eh_hub_subscriber *sub);
+
+/* n:subscribers reached, -1:errno */
+ssize_t eh_hub_publish(struct eh_hub *self, const char *topic, size_t len,
+		       struct eh_payload *payload);
+ssize_t eh_hub_publish_data(struct eh_hub *self, const char *topic, size_t len,
+			    const char *data, size_t data_len);
+
+/** Number of subscribers of a topic */
+size_t eh_hub_subscribers(struct eh_hub *self, const char *topic, size_t len);
+
+#endif /* !_EH_HUB_H */
@@ -28,10 +28,14 @@
  */
 
 #include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <stddef.h>	/* offsetof() */
 #include <stdarg.h>
 #include <stdio.h>
+#include <pthread.h>
 
+#include <time.h>
 #include <sys/uio.h>
 #include <sys/time.h>
 
@@ -39,7 +43,9 @@
 #include "eh_fd.h"
 #include "eh_fmt.h"
 #include "eh_list.h"
+#include "eh_hash.h"
 #include "eh_alloc.h"
+#include "eh_watcher.h"
 
 #include "eh_log.h"
 
@@ -49,15 +55,33 @@
 static struct eh_list loggers;
 enum eh_log_level eh_log_default_level = EH_LOG_TRACE; /* MAX */
 
+/* registry of allocated loggers, by name. allocated on first use */
+static struct eh_hash registry;
+
+/* levels set by name or name prefix */
+struct eh_log_rule {
+	struct eh_list rules;
+
+	enum eh_log_level level;
+	size_t len;
+	bool prefix;
+	char name[];
+};
+static struct eh_list rules;
+
+/* loggers and rules are shared by all threads, levels are read without it */
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void eh_log_set_default_level(enum eh_log_level level)
 {
-	eh_log_default_level = level;
+	__atomic_store_n(&eh_log_default_level, level, __ATOMIC_RELAXED);
 }
 
 void eh_log_init(enum eh_log_level level)
 {
 	eh_list_init(&loggers);
-	eh_log_default_level = level;
+	eh_list_init(&rules);
+	__atomic_store_n(&eh_log_default_level, level, __ATOMIC_RELAXED);
 }
 
 void eh_log_finish(void)
@@ -66,13 +90,129 @@ void eh_log_finish(void)
 		struct eh_logger *o = container_of(item, struct eh_logger, loggers);
 		eh_logger_del(o);
 	}
+	eh_list_foreach2(&rules, item, next) {
+		struct eh_log_rule *o = container_of(item, struct eh_log_rule, rules);
+		eh_list_del(item);
+		eh_free(o);
+	}
+
+	if (registry.buckets)
+		eh_hash_finish(&registry);
+}
+
+static inline uint32_t eh_logger_hash(const char *name)
+{
+	return eh_hash_bytes(name, strlen(name));
+}
+
+static bool registry_match(const struct eh_hash_node *node, const void *name)
+{
+	const struct eh_logger *o = container_of(node, struct eh_logger, registry);
+	return strcmp(o->name, name) == 0;
+}
+
+static void registry_add(struct eh_logger *new, uint32_t hash)
+{
+	new->registry.hash = hash;
+	new->registry.next = NULL;
+
+	if (registry.buckets == NULL && eh_hash_init(&registry, 64) < 0)
+		return; /* out of memory, only reachable through the list */
+
+	eh_hash_insert(&registry, &new->registry, hash);
+}
+
+static void registry_del(struct eh_logger *self)
+{
+	if (registry.buckets)
+		eh_hash_del(&registry, &self->registry);
+}
+
+static inline bool eh_log_rule_match(const struct eh_log_rule *rule, const char *name)
+{
+	if (rule->prefix)
+		return strncmp(name, rule->name, rule->len) == 0;
+	else
+		return strcmp(name, rule->name) == 0;
+}
+
+/* level for a new logger, the longest matching rule wins, exact names first */
+static enum eh_log_level eh_logger_initial_level(const char *name)
+{
+	enum eh_log_level level = __atomic_load_n(&eh_log_default_level, __ATOMIC_RELAXED);
+	size_t best = 0;
+
+	eh_list_foreach(&rules, item) {
+		struct eh_log_rule *o = container_of(item, struct eh_log_rule, rules);
+		size_t score = 2 * o->len + (o->prefix ? 1 : 2);
+
+		if (score > best && eh_log_rule_match(o, name)) {
+			level = o->level;
+			best = score;
+		}
+	}
+	return level;
+}
+
+/** Sets the level of a logger, or of a whole tree of them
+ *
+ * A pattern ending in '*' matches every name starting with what comes
+ * before it, "server.conn.*" or "*" for example. It applies to existing
+ * loggers and to those created later. The most specific pattern wins.
+ *
+ * Returns: 0:ok, -1:out of memory
+ */
+int eh_log_set_level(const char *pattern, enum eh_log_level level)
+{
+	size_t l = strlen(pattern);
+	bool prefix = (l > 0 && pattern[l-1] == '*');
+	struct eh_log_rule *rule = NULL;
+
+	if (prefix)
+		l--;
+
+	pthread_mutex_lock(&registry_lock);
+	eh_list_foreach(&rules, item) {
+		struct eh_log_rule *o = container_of(item, struct eh_log_rule, rules);
+		if (o->prefix == prefix && o->len == l && memcmp(o->name, pattern, l) == 0) {
+			rule = o;
+			break;
+		}
+	}
+
+	if (rule == NULL) {
+		rule = eh_alloc(sizeof(*rule) + l + 1);
+		if (rule == NULL) {
+			pthread_mutex_unlock(&registry_lock);
+			return -1;
+		}
+
+		rule->len = l;
+		rule->prefix = prefix;
+		memcpy(rule->name, pattern, l);
+		rule->name[l] = '\0';
+		eh_list_append(&rules, &rule->rules);
+	}
+	rule->level = level;
+
+	eh_list_foreach(&loggers, item) {
+		struct eh_logger *o = container_of(item, struct eh_logger, loggers);
+		if (eh_log_rule_match(rule, o->name))
+			o->level = eh_logger_initial_level(o->name);
+	}
+	pthread_mutex_unlock(&registry_lock);
+	return 0;
 }
 
 /* preallocated loggers */
 void eh_logger_init2(struct eh_logger *new, const char *name)
 {
 	new->name = name;
-	new->level = eh_log_default_level;
+	pthread_mutex_lock(&registry_lock);
+	new->level = eh_logger_initial_level(name);
+	pthread_mutex_unlock(&registry_lock);
+	new->registry.hash = 0;
+	new->registry.next = NULL;
 
 	/* don't place them on the list until eh_logger_del learns to distinguish */
 	eh_list_init(&new->loggers);
@@ -106,7 +246,9 @@ void eh_logger_initf(struct eh_logger *new, char *buf, size_t buf_size, const ch
 /*
  * loggers allocation
  */
-struct eh_logger *eh_logger_new(const char *name)
+
+/* called with the registry locked */
+static struct eh_logger *eh_logger_new2(const char *name, uint32_t hash)
 {
 	size_t l = strlen(name)+1;
 	struct eh_logger *new = eh_alloc(sizeof(struct eh_logger) + l);
@@ -114,12 +256,25 @@ struct eh_logger *eh_logger_new(const char *name)
 		new->name = (char *)new + sizeof(struct eh_logger);
 		memcpy((char *)new->name, name, l);
 
-		new->level = eh_log_default_level;
+		new->level = eh_logger_initial_level(name);
 		eh_list_append(&loggers, &new->loggers);
+		registry_add(new, hash);
 	}
 	return new;
 }
 
+struct eh_logger *eh_logger_new(const char *name)
+{
+	uint32_t hash = eh_logger_hash(name);
+	struct eh_logger *new;
+
+	pthread_mutex_lock(&registry_lock);
+	new = eh_logger_new2(name, hash);
+	pthread_mutex_unlock(&registry_lock);
+
+	return new;
+}
+
 struct eh_logger *eh_logger_newf(const char *fmt, ...)
 {
 	char buf[128]; /* arbitrary size */
@@ -134,12 +289,28 @@ struct eh_logger *eh_logger_newf(const char *fmt, ...)
 
 struct eh_logger *eh_logger_get(const char *name)
 {
-	eh_list_foreach(&loggers, item) {
-		struct eh_logger *o = container_of(item, struct eh_logger, loggers);
-		if (strcmp(name, o->name) == 0)
-			return o;
+	uint32_t hash = eh_logger_hash(name);
+	struct eh_logger *o = NULL;
+
+	pthread_mutex_lock(&registry_lock);
+	if (registry.buckets) {
+		struct eh_hash_node *node = eh_hash_find(&registry, hash, registry_match, name);
+		if (node) {
+			o = container_of(node, struct eh_logger, registry);
+			goto done;
+		}
+	} else {
+		/* registry couldn't be allocated */
+		eh_list_foreach(&loggers, item) {
+			o = container_of(item, struct eh_logger, loggers);
+			if (strcmp(name, o->name) == 0)
+				goto done;
+		}
 	}
-	return eh_logger_new(name);
+	o = eh_logger_new2(name, hash);
+done:
+	pthread_mutex_unlock(&registry_lock);
+	return o;
 }
 
 struct eh_logger *eh_logger_getf(const char *fmt, ...)
@@ -156,43 +327,304 @@ struct eh_logger *eh_logger_getf(const char *fmt, ...)
 
 void eh_logger_del(struct eh_logger *self)
 {
+	pthread_mutex_lock(&registry_lock);
+	registry_del(self);
 	eh_list_del(&self->loggers);
+	pthread_mutex_unlock(&registry_lock);
+
 	eh_free(self);
 }
 
 /*
  * log writter
  */
+/*
+ * rate limiting
+ */
+unsigned eh_log_limit_rate;
+__thread unsigned long eh_log_tick;
+static unsigned eh_log_limit_burst;
+
+/** Limits every call site to rate lines per second, allowing bursts
+ *
+ * 0 disables the limit, which is the default.
+ */
+void eh_log_set_rate_limit(unsigned rate, unsigned burst)
+{
+	__atomic_store_n(&eh_log_limit_burst, burst > 0 ? burst : 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&eh_log_limit_rate, rate, __ATOMIC_RELAXED);
+}
+
+/* adds tokens, clamped to burst even if it was lowered since */
+static void eh_log_limit_refill(struct eh_log_limit *self, unsigned long add,
+				unsigned burst)
+{
+	unsigned t = __atomic_load_n(&self->tokens, __ATOMIC_RELAXED), n;
+
+	do {
+		n = (t >= burst || add >= burst - t) ? burst : t + add;
+	} while (!__atomic_compare_exchange_n(&self->tokens, &t, n, true,
+					      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ * slow path of eh_log_limit(), refills the bucket if time has passed.
+ * the thread that moves stamp forward is the one that refills.
+ */
+bool _eh_log_limit(struct eh_log_limit *self, const char *name, enum eh_log_level level)
+{
+	unsigned rate = __atomic_load_n(&eh_log_limit_rate, __ATOMIC_RELAXED);
+	unsigned burst = __atomic_load_n(&eh_log_limit_burst, __ATOMIC_RELAXED);
+	unsigned long now = eh_log_tick, stamp, add;
+	unsigned n;
+
+	if (rate == 0)
+		return true; /* disabled meanwhile */
+
+	__atomic_store_n(&self->checked, now, __ATOMIC_RELAXED);
+	if (now == 0) {
+		struct timespec t;
+		clock_gettime(CLOCK_REALTIME_COARSE, &t);
+		now = (unsigned long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+	}
+
+	stamp = __atomic_load_n(&self->stamp, __ATOMIC_RELAXED);
+	if (now < stamp && stamp - now < 1000) {
+		/* another thread refilled after we read the clock */
+	} else if (stamp == 0 || now < stamp) {
+		/* first use, or the clock went back */
+		if (__atomic_compare_exchange_n(&self->stamp, &stamp, now, false,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			eh_log_limit_refill(self, burst, burst);
+	} else if ((add = (now - stamp) * rate / 1000) > 0) {
+		/* keep the remainder for the next refill */
+		if (__atomic_compare_exchange_n(&self->stamp, &stamp,
+						stamp + add * 1000 / rate, false,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			eh_log_limit_refill(self, add, burst);
+	}
+
+	if (!eh_log_limit_take(self)) {
+		eh_log_limit_suppress(self, name, level);
+		return false;
+	}
+
+	if ((n = __atomic_exchange_n(&self->suppressed, 0, __ATOMIC_RELAXED)) > 0)
+		eh_log_rawf(name, level, 0, NULL, 0, "%u messages suppressed", n);
+	return true;
+}
+
+/* sites with suppressed lines, pushed lock-free and taken whole by the flush */
+static struct eh_log_limit *eh_log_limit_pending;
+
+void _eh_log_limit_pending(struct eh_log_limit *self, const char *name,
+			   enum eh_log_level level)
+{
+	struct eh_log_limit *head;
+	bool no = false;
+
+	if (!__atomic_compare_exchange_n(&self->pending, &no, true, false,
+					 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return; /* already queued */
+
+	self->name = name;
+	self->level = level;
+	head = __atomic_load_n(&eh_log_limit_pending, __ATOMIC_RELAXED);
+	do {
+		self->next = head;
+	} while (!__atomic_compare_exchange_n(&eh_log_limit_pending, &head, self, true,
+					      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/** Reports the lines suppressed by sites that haven't spoken since
+ *
+ * Called once per second by the eh_log_timestamp_start() watcher.
+ */
+void eh_log_limit_flush(void)
+{
+	struct eh_log_limit *self, *next;
+	unsigned n;
+
+	if (__atomic_load_n(&eh_log_limit_pending, __ATOMIC_RELAXED) == NULL)
+		return;
+
+	self = __atomic_exchange_n(&eh_log_limit_pending, NULL, __ATOMIC_ACQUIRE);
+	for (; self != NULL; self = next) {
+		next = self->next;
+		/* unqueue before taking the count, later lines queue it again */
+		__atomic_store_n(&self->pending, false, __ATOMIC_SEQ_CST);
+		if ((n = __atomic_exchange_n(&self->suppressed, 0, __ATOMIC_SEQ_CST)) > 0)
+			eh_log_rawf(self->name, self->level, 0, NULL, 0,
+				    "%u messages suppressed", n);
+	}
+}
+
 static int _eh_log_stderr_timestamp;
-void eh_log_stderr_timestamp(int enabled)
+void eh_log_stderr_timestamp(int mode)
 {
-	_eh_log_stderr_timestamp = (enabled != 0);
+	if (mode != EH_LOG_TIMESTAMP_ISO8601)
+		mode = (mode != 0);
+	__atomic_store_n(&_eh_log_stderr_timestamp, mode, __ATOMIC_RELAXED);
 }
 
-ssize_t eh_log_stderr(const char *name, enum eh_log_level level, int code,
-		   const char *dump, size_t dump_len,
-		   const char *str, ssize_t str_len)
+/*
+ * timestamps, rendered once per second and patched for the microseconds.
+ * the time is either fed by the loop or taken on demand, per thread.
+ */
+static __thread struct {
+	bool fed;
+	struct timeval now;
+
+	int mode;
+	time_t sec;
+	size_t frac;	/* offset of the microseconds */
+	size_t len;
+	char buf[40];	/* "[YYYY-MM-DDTHH:MM:SS.uuuuuuZ] " */
+} ts;
+
+static __thread ev_check ts_watcher;
+
+/* exactly w digits */
+static inline void fmt_digits(char *p, unsigned n, unsigned w)
 {
-	struct iovec v[9];
+	while (w--) {
+		p[w] = '0' + n % 10;
+		n /= 10;
+	}
+}
+
+static void ts_render_sec(int mode, time_t sec)
+{
+	char *p = ts.buf;
+	*p++ = '[';
+
+	if (mode == EH_LOG_TIMESTAMP_ISO8601) {
+		struct tm tm;
+		gmtime_r(&sec, &tm);
+
+		fmt_digits(p, tm.tm_year + 1900, 4); p += 4; *p++ = '-';
+		fmt_digits(p, tm.tm_mon + 1, 2); p += 2; *p++ = '-';
+		fmt_digits(p, tm.tm_mday, 2); p += 2; *p++ = 'T';
+		fmt_digits(p, tm.tm_hour, 2); p += 2; *p++ = ':';
+		fmt_digits(p, tm.tm_min, 2); p += 2; *p++ = ':';
+		fmt_digits(p, tm.tm_sec, 2); p += 2;
+	} else {
+		p += eh_fmt_u64(p, sec);
+	}
+	*p++ = '.';
+	ts.frac = p - ts.buf;
+	p += 6;
+
+	if (mode == EH_LOG_TIMESTAMP_ISO8601)
+		*p++ = 'Z';
+	*p++ = ']';
+	*p++ = ' ';
+
+	ts.len = p - ts.buf;
+	ts.mode = mode;
+	ts.sec = sec;
+}
+
+/* 0 if timestamps are disabled */
+static size_t eh_log_timestamp(const char **str)
+{
+	int mode = __atomic_load_n(&_eh_log_stderr_timestamp, __ATOMIC_RELAXED);
 	struct timeval tv;
 
-	char buf[1024]; /* arbitrary */
-	char *p = buf;
-	int l=0, l2, pl=sizeof(buf);
+	if (mode == EH_LOG_TIMESTAMP_NONE)
+		return 0;
+	else if (ts.fed)
+		tv = ts.now;
+	else if (gettimeofday(&tv, NULL) != 0)
+		return 0;
 
-	/* "[%.3f] " */
-	if (_eh_log_stderr_timestamp && gettimeofday(&tv, NULL) == 0) {
-		l2 = snprintf(p, pl, "[%lu.%06lu] ",
-			     (unsigned long)tv.tv_sec,
-			     (unsigned long)tv.tv_usec);
+	if (tv.tv_sec != ts.sec || ts.mode != mode)
+		ts_render_sec(mode, tv.tv_sec);
+	fmt_digits(ts.buf + ts.frac, tv.tv_usec, 6);
 
-		v[l++] = (struct iovec) { p, l2 };
-		p += l2;
-		pl -= l2;
+	*str = ts.buf;
+	return ts.len;
+}
+
+/** Sets the time used for timestamps until the next update
+ *
+ * A negative value goes back to asking the system on each line.
+ */
+void eh_log_timestamp_update(double now)
+{
+	if (now < 0) {
+		ts.fed = false;
+		eh_log_tick = 0;
+	} else {
+		ts.now.tv_sec = (time_t)now;
+		ts.now.tv_usec = (suseconds_t)((now - ts.now.tv_sec) * 1000000);
+		ts.fed = true;
+		eh_log_tick = (unsigned long)(now * 1000);
+	}
+}
+
+static void ts_callback(struct ev_loop *loop, ev_check *UNUSED(w), int UNUSED(revents))
+{
+	static double flushed;
+	ev_tstamp now = ev_now(loop);
+
+	eh_log_timestamp_update(now);
+	if (now - flushed >= 1.) {
+		flushed = now;
+		eh_log_limit_flush();
+	}
+}
+
+/** Takes timestamps from ev_now() once per loop iteration */
+void eh_log_timestamp_start(struct ev_loop *loop)
+{
+	if (eh_check_active(&ts_watcher))
+		return;
+
+	eh_check_init(&ts_watcher, ts_callback, NULL);
+	eh_watcher_set_priority(&ts_watcher, EV_MAXPRI);
+	eh_check_start(&ts_watcher, loop);
+	ev_unref(loop); /* housekeeping, doesn't keep ev_run() going */
+
+	eh_log_timestamp_update(ev_now(loop));
+}
+
+void eh_log_timestamp_stop(struct ev_loop *loop)
+{
+	if (eh_check_active(&ts_watcher)) {
+		ev_ref(loop);
+		eh_check_stop(&ts_watcher, loop);
+	}
+	eh_log_timestamp_update(-1);
+}
+
+/* room eh_log_iov() needs for the formatted pieces, the dump may grow x4 */
+static inline size_t eh_log_iov_size(const char *dump, size_t dump_len)
+{
+	return 64 + (dump ? 4 * dump_len : 0);
+}
+
+/* splits a log line in up to 9 pieces, using buf for the formatted ones */
+static int eh_log_iov(struct iovec *v, char *buf, size_t pl,
+		      const char *name, enum eh_log_level level, int code,
+		      const char *dump, size_t dump_len,
+		      const char *str, ssize_t str_len)
+{
+	char *p = buf;
+	int l=0, l2;
+
+	/* "[sec.usec] " */
+	{
+		const char *t;
+		if ((l2 = eh_log_timestamp(&t)) > 0)
+			v[l++] = (struct iovec) { (void*)t, l2 };
 	}
 
 	/* "<?> " */
-	l2 = snprintf(p, pl, "<%u> ", level);
+	p[0] = '<';
+	l2 = 1 + eh_fmt_unsigned(p+1, level);
+	p[l2++] = '>';
+	p[l2++] = ' ';
 	v[l++] = (struct iovec) { p, l2 };
 	p += l2;
 	pl -= l2;
@@ -203,7 +635,11 @@ ssize_t eh_log_stderr(const char *name, enum eh_log_level level, int code,
 
 		if (code > 0) {
 			/* ": code: " */
-			l2 = snprintf(p, pl, ": %u: ", code);
+			p[0] = ':';
+			p[1] = ' ';
+			l2 = 2 + eh_fmt_unsigned(p+2, code);
+			p[l2++] = ':';
+			p[l2++] = ' ';
 			v[l++] = (struct iovec) { p, l2 };
 			p += l2;
 			pl -= l2;
@@ -213,7 +649,9 @@ ssize_t eh_log_stderr(const char *name, enum eh_log_level level, int code,
 		}
 	} else if (code > 0) {
 		/* "code: " */
-		l2 =snprintf(p, pl, ": %u: "+2, code);
+		l2 = eh_fmt_unsigned(p, code);
+		p[l2++] = ':';
+		p[l2++] = ' ';
 		v[l++] = (struct iovec) { p, l2 };
 		p += l2;
 		pl -= l2;
@@ -228,12 +666,15 @@ ssize_t eh_log_stderr(const char *name, enum eh_log_level level, int code,
 	if (dump) {
 		v[l++] = (struct iovec) { ": \"", 3 };
 
-		l2 = eh_fmt_cstr(p, pl, dump, dump_len);
+		l2 = eh_fmt_cstr(p, pl - 24, dump, dump_len); /* room for the suffix */
 		v[l++] = (struct iovec) { p, l2 };
 		p += l2;
 		pl -= l2;
 
-		l2 = snprintf(p, pl, "\" (%zu)", dump_len);
+		/* "\" (%zu)" */
+		memcpy(p, "\" (", 3);
+		l2 = 3 + eh_fmt_u64(p+3, dump_len);
+		p[l2++] = ')';
 		v[l++] = (struct iovec) { p, l2 };
 		p += l2;
 		pl -= l2;
@@ -242,7 +683,163 @@ ssize_t eh_log_stderr(const char *name, enum eh_log_level level, int code,
 	/* "\n" */
 	v[l++] = (struct iovec) { "\n", 1 };
 
-	return eh_writev(2, v, l);
+	return l;
+}
+
+ssize_t eh_log_stderr(const char *name, enum eh_log_level level, int code,
+		   const char *dump, size_t dump_len,
+		   const char *str, ssize_t str_len)
+{
+	struct iovec v[9];
+	char buf[512], *p = buf;
+	size_t pl = eh_log_iov_size(dump, dump_len);
+	ssize_t ret;
+	int l;
+
+	/* big dumps are escaped on the heap, truncated if that fails */
+	if (unlikely(pl > sizeof(buf)) && (p = eh_alloc(pl)) == NULL) {
+		p = buf;
+		pl = sizeof(buf);
+	}
+
+	l = eh_log_iov(v, p, pl, name, level, code,
+		       dump, dump_len, str, str_len);
+
+	/*
+	 * every thread formats on its own stack and the line goes out in a
+	 * single writev(), which a pipe keeps whole up to PIPE_BUF and a file
+	 * opened with O_APPEND keeps whole always. only longer lines to a pipe
+	 * may be split among others.
+	 */
+	ret = eh_writev(2, v, l);
+
+	if (p != buf)
+		eh_free(p);
+	return ret;
+}
+
+/* appends n bytes of s at *len, as much as fits, counting it all */
+static inline void put(char *out, size_t size, size_t *len, const char *s, size_t n)
+{
+	if (*len < size)
+		memcpy(out + *len, s, n < size - *len ? n : size - *len);
+	*len += n;
+}
+
+/* appends pre, n and post, formatted in place when there is room */
+static inline void put_num(char *out, size_t size, size_t *len,
+			   const char *pre, uint64_t n, const char *post)
+{
+	char buf[32], *p = buf;
+	size_t l = strlen(pre);
+
+	if (*len < size && size - *len >= sizeof(buf))
+		p = out + *len;
+
+	memcpy(p, pre, l);
+	l += eh_fmt_u64(p + l, n);
+	memcpy(p + l, post, strlen(post));
+	l += strlen(post);
+
+	if (p == buf)
+		put(out, size, len, buf, l);
+	else
+		*len += l;
+}
+
+/* appends the escaped dump, in place when it surely fits */
+static void put_cstr(char *out, size_t size, size_t *len, const char *s, size_t n)
+{
+	char buf[256];
+
+	if (*len < size && size - *len >= 4 * n) {
+		*len += eh_fmt_cstr(out + *len, size - *len, s, n);
+		return;
+	}
+
+	/* it will be truncated, but the whole length is still wanted */
+	for (size_t c; n > 0; s += c, n -= c) {
+		c = n < sizeof(buf) / 4 ? n : sizeof(buf) / 4;
+		put(out, size, len, buf, eh_fmt_cstr(buf, sizeof(buf), s, c));
+	}
+}
+
+/* str is the format when ap is given, consumed by it */
+static size_t eh_log_render(char *out, size_t out_size,
+			    const char *name, enum eh_log_level level, int code,
+			    const char *dump, size_t dump_len,
+			    const char *str, ssize_t str_len, va_list *ap)
+{
+	size_t len = 0, l;
+	const char *t;
+
+	/* "[sec.usec] " */
+	if ((l = eh_log_timestamp(&t)) > 0)
+		put(out, out_size, &len, t, l);
+
+	/* "<?> " */
+	put_num(out, out_size, &len, "<", level, "> ");
+
+	/* "name: ", "name: code: " or "code: " */
+	if (name) {
+		put(out, out_size, &len, name, strlen(name));
+		if (code > 0)
+			put_num(out, out_size, &len, ": ", code, ": ");
+		else
+			put(out, out_size, &len, ": ", 2);
+	} else if (code > 0) {
+		put_num(out, out_size, &len, "", code, ": ");
+	}
+
+	/* "...", its terminator is overwritten by what follows */
+	if (ap) {
+		int l2 = vsnprintf(len < out_size ? out + len : NULL,
+				   len < out_size ? out_size - len : 0, str, *ap);
+		if (l2 > 0)
+			len += l2;
+	} else {
+		put(out, out_size, &len, str, str_len < 0 ? strlen(str) : (size_t)str_len);
+	}
+
+	/* optional data dump, ": \"...\" (%zu)" */
+	if (dump) {
+		put(out, out_size, &len, ": \"", 3);
+		put_cstr(out, out_size, &len, dump, dump_len);
+		put_num(out, out_size, &len, "\" (", dump_len, ")");
+	}
+
+	put(out, out_size, &len, "\n", 1);
+	return len;
+}
+
+/** Renders a log line as eh_log_stderr() would, straight into out
+ *
+ * Returns: the length of the whole line, of which only out_size bytes
+ * are written. like snprintf() but without terminator.
+ */
+size_t eh_log_format(char *out, size_t out_size,
+		     const char *name, enum eh_log_level level, int code,
+		     const char *dump, size_t dump_len,
+		     const char *str, ssize_t str_len)
+{
+	return eh_log_render(out, out_size, name, level, code,
+			     dump, dump_len, str, str_len, NULL);
+}
+
+/** eh_log_format() with the message formatted in place, ap is left untouched */
+size_t eh_log_formatv(char *out, size_t out_size,
+		      const char *name, enum eh_log_level level, int code,
+		      const char *dump, size_t dump_len,
+		      const char *fmt, va_list ap)
+{
+	va_list aq;
+	size_t len;
+
+	va_copy(aq, ap);
+	len = eh_log_render(out, out_size, name, level, code,
+			    dump, dump_len, fmt, -1, &aq);
+	va_end(aq);
+	return len;
 }
 
 eh_log_f eh_log_raw = eh_log_stderr;
@@ -252,18 +849,54 @@ void eh_log_set_backend(eh_log_f f)
 	eh_log_raw = f;
 }
 
+/* backend taking the format and arguments as they come, NULL for none */
+eh_log_vf eh_log_rawv;
+
+void eh_log_set_backendv(eh_log_vf f)
+{
+	eh_log_rawv = f;
+}
+
 ssize_t eh_log_rawf(const char *name, enum eh_log_level level, int code,
 		   const char *dump, size_t dump_len,
 		   const char *fmt, ...)
 {
-	char buf[1024]; /* arbitrary */
-	size_t l;
+	char buf[512], *p = buf;
+	ssize_t ret;
+	int l;
 	va_list ap;
 
+	if (eh_log_rawv) {
+		ssize_t l2;
+
+		va_start(ap, fmt);
+		l2 = eh_log_rawv(name, level, code, dump, dump_len, fmt, ap);
+		va_end(ap);
+
+		return l2;
+	}
+
 	va_start(ap, fmt);
 	l = vsnprintf(buf, sizeof(buf), fmt, ap);
-	/* TODO: validate l */
 	va_end(ap);
 
-	return eh_log_raw(name, level, code, dump, dump_len, buf, l);
+	if (unlikely(l < 0)) {
+		return -1;
+	} else if (unlikely((size_t)l >= sizeof(buf))) {
+		/* long line, format it again on the heap. truncated if that fails */
+		if ((p = eh_alloc(l + 1)) == NULL) {
+			p = buf;
+			l = sizeof(buf) - 1;
+		} else {
+			va_start(ap, fmt);
+			vsnprintf(p, l + 1, fmt, ap);
+			va_end(ap);
+		}
+	}
+
+	ret = eh_log_raw(name, level, code, dump, dump_len, p, l);
+
+	if (p != buf)
+		eh_free(p);
+	return ret;
 }
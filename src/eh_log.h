@@ -29,6 +29,12 @@
 #ifndef _EH_LOG_H
 #define _EH_LOG_H
 
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <eh_hash.h>
+
 enum eh_log_level {
 	EH_LOG_EMERG,
 	EH_LOG_ALERT,
@@ -46,6 +52,8 @@ struct eh_logger {
 
 	enum eh_log_level level;
 	const char *name;
+
+	struct eh_hash_node registry;
 };
 
 /*
@@ -55,6 +63,7 @@ void eh_log_init(enum eh_log_level level);
 void eh_log_finish(void);
 
 void eh_log_set_default_level(enum eh_log_level level);
+int eh_log_set_level(const char *pattern, enum eh_log_level level);
 
 /*
  * logger
@@ -85,35 +94,191 @@ static inline int eh_logger_level(const struct eh_logger *self, enum eh_log_leve
 /*
  * log writter
  */
+struct ev_loop;
+
 
 typedef ssize_t (*eh_log_f) (const char *, enum eh_log_level, int,
 			     const char *, size_t,
 			     const char *, ssize_t);
+typedef ssize_t (*eh_log_vf) (const char *, enum eh_log_level, int,
+			      const char *, size_t,
+			      const char *, va_list);
 
 void eh_log_set_backend(eh_log_f);
+void eh_log_set_backendv(eh_log_vf);
 
 ssize_t eh_log_stderr(const char *name, enum eh_log_level level, int code,
 		   const char *dump, size_t dump_len,
 		   const char *str, ssize_t str_len);
 
-void eh_log_stderr_timestamp(int enabled);
+enum eh_log_timestamp {
+	EH_LOG_TIMESTAMP_NONE,
+	EH_LOG_TIMESTAMP_EPOCH,		/**< "[sec.usec] " */
+	EH_LOG_TIMESTAMP_ISO8601,	/**< "[YYYY-MM-DDTHH:MM:SS.usecZ] " */
+};
+
+void eh_log_stderr_timestamp(int mode);
+
+void eh_log_timestamp_start(struct ev_loop *loop);
+void eh_log_timestamp_stop(struct ev_loop *loop);
+void eh_log_timestamp_update(double now);
+
+size_t eh_log_format(char *buf, size_t buf_size,
+		     const char *name, enum eh_log_level level, int code,
+		     const char *dump, size_t dump_len,
+		     const char *str, ssize_t str_len);
+size_t eh_log_formatv(char *buf, size_t buf_size,
+		      const char *name, enum eh_log_level level, int code,
+		      const char *dump, size_t dump_len,
+		      const char *fmt, va_list ap);
+
+/*
+ * asynchronous log writter, every thread queues its lines on its own ring
+ * and a background thread writes them all to fd. install with
+ * eh_log_set_backend(eh_log_async) and eh_log_set_backendv(eh_log_asyncv)
+ */
+enum eh_log_async_policy {
+	EH_LOG_ASYNC_DROP,	/**< discard lines when the ring is full */
+	EH_LOG_ASYNC_BLOCK,	/**< wait for the writer to make room */
+};
+
+int eh_log_async_init(int fd, size_t ring_size, enum eh_log_async_policy policy);
+void eh_log_async_finish(void);
+
+ssize_t eh_log_async(const char *name, enum eh_log_level level, int code,
+		     const char *dump, size_t dump_len,
+		     const char *str, ssize_t str_len);
+ssize_t eh_log_asyncv(const char *name, enum eh_log_level level, int code,
+		      const char *dump, size_t dump_len,
+		      const char *fmt, va_list ap);
 
-eh_log_f eh_log_raw;
+unsigned long eh_log_async_dropped(void);
+
+/*
+ * binary log writter, formatting is deferred to eh_log_binary_decode().
+ * records refer to format strings by address, so they must be constant.
+ * install with eh_log_set_backend(eh_log_binary) and
+ * eh_log_set_backendv(eh_log_binaryv)
+ */
+int eh_log_binary_init(const char *path, size_t size);
+void eh_log_binary_finish(void);
+
+ssize_t eh_log_binary(const char *name, enum eh_log_level level, int code,
+		      const char *dump, size_t dump_len,
+		      const char *str, ssize_t str_len);
+ssize_t eh_log_binaryv(const char *name, enum eh_log_level level, int code,
+		       const char *dump, size_t dump_len,
+		       const char *fmt, va_list ap);
+ssize_t eh_log_binaryf(const char *name, enum eh_log_level level, int code,
+		       const char *dump, size_t dump_len,
+		       const char *fmt, ...) TYPECHECK_PRINTF(6, 7);
+
+unsigned long eh_log_binary_dropped(void);
+ssize_t eh_log_binary_decode(const char *path, int fd);
+
+/*
+ * file log writter, lines are appended to a memory-mapped segment that is
+ * rotated by size. install with eh_log_set_backend(eh_log_file) and
+ * eh_log_set_backendv(eh_log_filev)
+ */
+int eh_log_file_init(const char *path, size_t size, unsigned keep);
+void eh_log_file_finish(void);
+
+int eh_log_file_sync(void);
+void eh_log_file_start(struct ev_loop *loop, float interval);
+void eh_log_file_stop(struct ev_loop *loop);
+
+ssize_t eh_log_file(const char *name, enum eh_log_level level, int code,
+		    const char *dump, size_t dump_len,
+		    const char *str, ssize_t str_len);
+ssize_t eh_log_filev(const char *name, enum eh_log_level level, int code,
+		     const char *dump, size_t dump_len,
+		     const char *fmt, va_list ap);
+
+extern eh_log_f eh_log_raw;
+extern eh_log_vf eh_log_rawv;
 
 ssize_t eh_log_rawf(const char *name, enum eh_log_level level, int code,
 		   const char *dump, size_t dump_len,
 		   const char *fmt, ...) TYPECHECK_PRINTF(6, 7);
 
+/*
+ * rate limiting, a token bucket per call site.
+ * suppressed lines are counted and reported when the site speaks again,
+ * or by eh_log_limit_flush() if it doesn't.
+ */
+struct eh_log_limit {
+	unsigned long stamp;	/* last refill, in ms */
+	unsigned long checked;	/* eh_log_tick of the last refill attempt */
+	unsigned tokens;
+	unsigned suppressed;
+
+	/* pending list, for eh_log_limit_flush() */
+	struct eh_log_limit *next;
+	const char *name;
+	enum eh_log_level level;
+	bool pending;
+};
+
+extern unsigned eh_log_limit_rate;	/* lines per second, 0 disables */
+extern __thread unsigned long eh_log_tick;	/* ms, fed by this thread's loop, 0 if not */
+
+void eh_log_set_rate_limit(unsigned rate, unsigned burst);
+
+bool _eh_log_limit(struct eh_log_limit *, const char *, enum eh_log_level);
+void _eh_log_limit_pending(struct eh_log_limit *, const char *, enum eh_log_level);
+void eh_log_limit_flush(void);
+
+/* counts a suppressed line, the first one queues the site for flushing */
+static inline void eh_log_limit_suppress(struct eh_log_limit *self, const char *name,
+					 enum eh_log_level level)
+{
+	if (__atomic_add_fetch(&self->suppressed, 1, __ATOMIC_RELAXED) == 1)
+		_eh_log_limit_pending(self, name, level);
+}
+
+/* sites are shared among threads, tokens are taken atomically and never
+ * below 0 */
+static inline bool eh_log_limit_take(struct eh_log_limit *self)
+{
+	unsigned t = __atomic_load_n(&self->tokens, __ATOMIC_RELAXED);
+
+	while (t > 0) {
+		if (__atomic_compare_exchange_n(&self->tokens, &t, t - 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			return true;
+	}
+	return false;
+}
+
+static inline bool eh_log_limit(struct eh_log_limit *self, const char *name,
+				enum eh_log_level level)
+{
+	if (likely(__atomic_load_n(&eh_log_limit_rate, __ATOMIC_RELAXED) == 0)) {
+		return true;
+	} else if (likely(eh_log_limit_take(self))) {
+		return true;
+	} else if (eh_log_tick != 0 &&
+		   __atomic_load_n(&self->checked, __ATOMIC_RELAXED) == eh_log_tick) {
+		/* same loop iteration, nothing to refill */
+		eh_log_limit_suppress(self, name, level);
+		return false;
+	}
+	return _eh_log_limit(self, name, level);
+}
+
 /*
  * log filters
  */
 #define eh_log2(S, L, C, D, DL, M, ML)	do { \
-	if (eh_logger_level(S, L)) \
+	static struct eh_log_limit _eh_log_site; \
+	if (eh_logger_level(S, L) && eh_log_limit(&_eh_log_site, eh_logger_name(S), L)) \
 		eh_log_raw(eh_logger_name(S), L, C, D, DL, M, ML); \
 	} while(0)
 
 #define eh_log2f(S, L, C, D, DL, F, ...)	do { \
-	if (eh_logger_level(S, L)) \
+	static struct eh_log_limit _eh_log_site; \
+	if (eh_logger_level(S, L) && eh_log_limit(&_eh_log_site, eh_logger_name(S), L)) \
 		eh_log_rawf(eh_logger_name(S), L, C, D, DL, F, __VA_ARGS__); \
 	} while(0)
 
@@ -122,41 +287,96 @@ ssize_t eh_log_rawf(const char *name, enum eh_log_level level, int code,
 
 /*
  * helper wrappers
+ *
+ * levels above EH_LOG_COMPILE_LEVEL compile to nothing, arguments included.
+ * it can be set per translation unit before including this header, using
+ * the numeric value of enum eh_log_level. by default trace and debug are
+ * only kept when NDEBUG is not defined.
  */
+#ifndef EH_LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define EH_LOG_COMPILE_LEVEL	6 /* EH_LOG_INFO */
+#else
+#define EH_LOG_COMPILE_LEVEL	8 /* EH_LOG_DEBUG */
+#endif
+#endif
+
 #define eh_log_emerg2(S, ...)	eh_log2(S,  EH_LOG_EMERG, __VA_ARGS__, -1)
 #define eh_log_emerg2f(S, ...)	eh_log2f(S, EH_LOG_EMERG, __VA_ARGS__)
 #define eh_log_emerg(S, ...)	eh_log(S,  EH_LOG_EMERG, __VA_ARGS__, -1)
 #define eh_log_emergf(S, ...)	eh_logf(S, EH_LOG_EMERG, __VA_ARGS__)
 
+#if EH_LOG_COMPILE_LEVEL >= 1
 #define eh_log_alert2(S, ...)	eh_log2(S,  EH_LOG_ALERT, __VA_ARGS__, -1)
 #define eh_log_alert2f(S, ...)	eh_log2f(S, EH_LOG_ALERT, __VA_ARGS__)
 #define eh_log_alert(S, ...)	eh_log(S,  EH_LOG_ALERT, __VA_ARGS__, -1)
 #define eh_log_alertf(S, ...)	eh_logf(S, EH_LOG_ALERT, __VA_ARGS__)
+#else
+#define eh_log_alert2(...)
+#define eh_log_alert2f(...)
+#define eh_log_alert(...)
+#define eh_log_alertf(...)
+#endif
 
+#if EH_LOG_COMPILE_LEVEL >= 2
 #define eh_log_crit2(S, ...)	eh_log2(S,  EH_LOG_CRIT, __VA_ARGS__, -1)
 #define eh_log_crit2f(S, ...)	eh_log2f(S, EH_LOG_CRIT, __VA_ARGS__)
 #define eh_log_crit(S, ...)	eh_log(S,  EH_LOG_CRIT, __VA_ARGS__, -1)
 #define eh_log_critf(S, ...)	eh_logf(S, EH_LOG_CRIT, __VA_ARGS__)
+#else
+#define eh_log_crit2(...)
+#define eh_log_crit2f(...)
+#define eh_log_crit(...)
+#define eh_log_critf(...)
+#endif
 
+#if EH_LOG_COMPILE_LEVEL >= 3
 #define eh_log_err2(S, ...)	eh_log2(S,  EH_LOG_ERR, __VA_ARGS__, -1)
 #define eh_log_err2f(S, ...)	eh_log2f(S, EH_LOG_ERR, __VA_ARGS__)
 #define eh_log_err(S, ...)	eh_log(S,  EH_LOG_ERR, __VA_ARGS__, -1)
 #define eh_log_errf(S, ...)	eh_logf(S, EH_LOG_ERR, __VA_ARGS__)
+#else
+#define eh_log_err2(...)
+#define eh_log_err2f(...)
+#define eh_log_err(...)
+#define eh_log_errf(...)
+#endif
 
+#if EH_LOG_COMPILE_LEVEL >= 4
 #define eh_log_warn2(S, ...)	eh_log2(S,  EH_LOG_WARNING, __VA_ARGS__, -1)
 #define eh_log_warn2f(S, ...)	eh_log2f(S, EH_LOG_WARNING, __VA_ARGS__)
 #define eh_log_warn(S, ...)	eh_log(S,  EH_LOG_WARNING, __VA_ARGS__, -1)
 #define eh_log_warnf(S, ...)	eh_logf(S, EH_LOG_WARNING, __VA_ARGS__)
+#else
+#define eh_log_warn2(...)
+#define eh_log_warn2f(...)
+#define eh_log_warn(...)
+#define eh_log_warnf(...)
+#endif
 
+#if EH_LOG_COMPILE_LEVEL >= 5
 #define eh_log_notice2(S, ...)	eh_log2(S,  EH_LOG_NOTICE, __VA_ARGS__, -1)
 #define eh_log_notice2f(S, ...)	eh_log2f(S, EH_LOG_NOTICE, __VA_ARGS__)
 #define eh_log_notice(S, ...)	eh_log(S,  EH_LOG_NOTICE, __VA_ARGS__, -1)
 #define eh_log_noticef(S, ...)	eh_logf(S, EH_LOG_NOTICE, __VA_ARGS__)
+#else
+#define eh_log_notice2(...)
+#define eh_log_notice2f(...)
+#define eh_log_notice(...)
+#define eh_log_noticef(...)
+#endif
 
+#if EH_LOG_COMPILE_LEVEL >= 6
 #define eh_log_info2(S, ...)	eh_log2(S,  EH_LOG_INFO, __VA_ARGS__, -1)
 #define eh_log_info2f(S, ...)	eh_log2f(S, EH_LOG_INFO, __VA_ARGS__)
 #define eh_log_info(S, ...)	eh_log(S,  EH_LOG_INFO, __VA_ARGS__, -1)
 #define eh_log_infof(S, ...)	eh_logf(S, EH_LOG_INFO, __VA_ARGS__)
+#else
+#define eh_log_info2(...)
+#define eh_log_info2f(...)
+#define eh_log_info(...)
+#define eh_log_infof(...)
+#endif
 
 #define eh_log_syserr2(S, C, D, DL, M) \
 	eh_log_err2f(S, C, D, DL, M ": %s", strerror(errno))
@@ -168,7 +388,7 @@ ssize_t eh_log_rawf(const char *name, enum eh_log_level level, int code,
 #define eh_log_syserrf(S, C, F, ...) \
 	eh_log_errf(S, C, F ": %s", __VA_ARGS__, strerror(errno))
 
-#ifndef NDEBUG
+#if EH_LOG_COMPILE_LEVEL >= 7
 #define _eh_log_debug(S, L, C, D, DL, M) \
 	eh_log2f(S, L, C, D, DL, "%s:%u: %s: " M, __FILE__, __LINE__, __func__)
 #define _eh_log_debugf(S, L, C, D, DL, F, ...) \
@@ -178,16 +398,21 @@ ssize_t eh_log_rawf(const char *name, enum eh_log_level level, int code,
 #define eh_log_trace2f(S, C, D, DL, F, ...)	_eh_log_debugf(S, EH_LOG_TRACE, C, D, DL, F, __VA_ARGS__)
 #define eh_log_trace(S, C, M)			_eh_log_debug(S,  EH_LOG_TRACE, C, NULL, 0, M)
 #define eh_log_tracef(S, C, F, ...)		_eh_log_debugf(S, EH_LOG_TRACE, C, NULL, 0, F, __VA_ARGS__)
-#define eh_log_debug2(S, C, D, DL, M)		_eh_log_debug(S,  EH_LOG_DEBUG, C, D, DL, M)
-#define eh_log_debug2f(S, C, D, DL, F, ...)	_eh_log_debugf(S, EH_LOG_DEBUG, C, D, DL, F, __VA_ARGS__)
-#define eh_log_debug(S, C, M)			_eh_log_debug(S,  EH_LOG_DEBUG, C, NULL, 0, M)
-#define eh_log_debugf(S, C, F, ...)		_eh_log_debugf(S, EH_LOG_DEBUG, C, NULL, 0, F, __VA_ARGS__)
 
 #else
 #define eh_log_trace2(...)
 #define eh_log_trace2f(...)
 #define eh_log_trace(...)
 #define eh_log_tracef(...)
+#endif
+
+#if EH_LOG_COMPILE_LEVEL >= 8
+#define eh_log_debug2(S, C, D, DL, M)		_eh_log_debug(S,  EH_LOG_DEBUG, C, D, DL, M)
+#define eh_log_debug2f(S, C, D, DL, F, ...)	_eh_log_debugf(S, EH_LOG_DEBUG, C, D, DL, F, __VA_ARGS__)
+#define eh_log_debug(S, C, M)			_eh_log_debug(S,  EH_LOG_DEBUG, C, NULL, 0, M)
+#define eh_log_debugf(S, C, F, ...)		_eh_log_debugf(S, EH_LOG_DEBUG, C, NULL, 0, F, __VA_ARGS__)
+
+#else
 #define eh_log_debug2(...)
 #define eh_log_debug2f(...)
 #define eh_log_debug(...)
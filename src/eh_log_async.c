@@ -0,0 +1,385 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <sys/uio.h>
+
+#include "eh.h"
+#include "eh_fd.h"
+#include "eh_list.h"
+#include "eh_alloc.h"
+
+#include "eh_log.h"
+
+/*
+ * every producing thread gets its own ring of bytes and a single writer
+ * drains them all, so lines are never interleaved and loops don't share
+ * anything but the list of rings. positions only grow and are masked by
+ * size-1 when used. the mutex is only taken to sleep and wake up.
+ */
+struct eh_log_ring {
+	struct eh_log_ring *next;
+	int owned;		/* a live thread produces on it */
+
+	unsigned long head;	/* written by the producer */
+	unsigned long tail;	/* written by the writer */
+	char buf[];
+};
+
+static struct {
+	struct eh_log_ring *rings;	/* only pushed to until finish */
+	size_t size;
+	int fd;
+	enum eh_log_async_policy policy;
+	unsigned gen;
+
+	unsigned long dropped;
+
+	int writer_waiting;
+	int producer_waiting;
+	bool stop;
+	bool running;		/* the writer was started */
+
+	pthread_t thread;
+	pthread_key_t key;
+	pthread_mutex_t mutex;
+	pthread_cond_t data;
+	pthread_cond_t room;
+} async;
+
+static __thread struct eh_log_ring *ring;
+static __thread unsigned ring_gen;
+
+#define load(V)		__atomic_load_n(&(V), __ATOMIC_SEQ_CST)
+#define store(V, X)	__atomic_store_n(&(V), (X), __ATOMIC_SEQ_CST)
+#define cas(V, E, X)	__atomic_compare_exchange_n(&(V), (E), (X), false, \
+						    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+/* a thread is gone, its ring can be adopted once drained */
+static void eh_log_ring_release(void *r)
+{
+	store(((struct eh_log_ring *)r)->owned, 0);
+}
+
+static struct eh_log_ring *eh_log_ring_get(void)
+{
+	struct eh_log_ring *r;
+	int zero = 0;
+
+	if (likely(ring != NULL && ring_gen == load(async.gen)))
+		return ring;
+
+	for (r = load(async.rings); r; r = r->next, zero = 0) {
+		if (cas(r->owned, &zero, 1))
+			goto found;
+	}
+
+	if ((r = eh_alloc(sizeof(*r) + async.size)) == NULL)
+		return NULL;
+
+	r->owned = 1;
+	r->head = r->tail = 0;
+	r->next = load(async.rings);
+	while (!cas(async.rings, &r->next, r))
+		;
+found:
+	pthread_setspecific(async.key, r);
+	ring_gen = load(async.gen);
+	ring = r;
+	return r;
+}
+
+static bool eh_log_async_pending(void)
+{
+	for (struct eh_log_ring *r = load(async.rings); r; r = r->next) {
+		if (load(r->head) != r->tail)
+			return true;
+	}
+	return false;
+}
+
+static void *eh_log_async_writer(void *UNUSED(arg))
+{
+	struct eh_log_ring *resume = NULL;
+
+	for (;;) {
+		struct eh_log_ring *r, *from[32];
+		unsigned long to[32];
+		struct iovec v[64];
+		int l = 0, n = 0;
+
+		/* whatever every ring has, in up to two pieces each */
+		r = resume ? resume : load(async.rings);
+		for (; r && n < (int)ELEMENTS(from); r = r->next) {
+			unsigned long head = load(r->head), tail = r->tail;
+			size_t off = tail & (async.size - 1), len = head - tail;
+
+			if (len == 0)
+				continue;
+
+			if (len > async.size - off) {
+				v[l++] = (struct iovec) { r->buf + off, async.size - off };
+				v[l++] = (struct iovec) { r->buf, len - (async.size - off) };
+			} else {
+				v[l++] = (struct iovec) { r->buf + off, len };
+			}
+			from[n] = r;
+			to[n++] = head;
+		}
+		resume = r; /* too many rings, continue there next time */
+
+		if (n > 0) {
+			eh_writev(async.fd, v, l);
+
+			for (int i = 0; i < n; i++)
+				store(from[i]->tail, to[i]);
+
+			if (load(async.producer_waiting)) {
+				pthread_mutex_lock(&async.mutex);
+				pthread_cond_broadcast(&async.room);
+				pthread_mutex_unlock(&async.mutex);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&async.mutex);
+		store(async.writer_waiting, 1);
+		while (!eh_log_async_pending() && !async.stop)
+			pthread_cond_wait(&async.data, &async.mutex);
+		store(async.writer_waiting, 0);
+		pthread_mutex_unlock(&async.mutex);
+
+		if (load(async.stop) && !eh_log_async_pending())
+			break; /* stopped and drained */
+	}
+	return NULL;
+}
+
+/** Starts the background writer
+ *
+ * ring_size is per producing thread and must be a power of 2
+ *
+ * Returns: 0:ok, -1:errno
+ */
+int eh_log_async_init(int fd, size_t ring_size, enum eh_log_async_policy policy)
+{
+	int e;
+
+	assert(fd >= 0);
+	assert(ring_size >= 4096 && (ring_size & (ring_size - 1)) == 0);
+	assert(async.rings == NULL);
+	assert(!async.running);
+
+	async.size = ring_size;
+	async.fd = fd;
+	async.policy = policy;
+	async.dropped = 0;
+	async.writer_waiting = async.producer_waiting = 0;
+	async.stop = false;
+	store(async.gen, async.gen + 1);
+
+	if ((e = pthread_key_create(&async.key, eh_log_ring_release)) != 0)
+		goto fail;
+
+	pthread_mutex_init(&async.mutex, NULL);
+	pthread_cond_init(&async.data, NULL);
+	pthread_cond_init(&async.room, NULL);
+
+	if ((e = pthread_create(&async.thread, NULL, eh_log_async_writer, NULL)) != 0) {
+		pthread_cond_destroy(&async.room);
+		pthread_cond_destroy(&async.data);
+		pthread_mutex_destroy(&async.mutex);
+		pthread_key_delete(async.key);
+		goto fail;
+	}
+	async.running = true;
+	return 0;
+fail:
+	errno = e;
+	return -1;
+}
+
+/** Flushes what's pending and stops the background writer
+ *
+ * Restore the previous backend, and stop logging from other threads,
+ * before calling it.
+ */
+void eh_log_async_finish(void)
+{
+	struct eh_log_ring *r, *next;
+
+	if (!async.running)
+		return;
+
+	pthread_mutex_lock(&async.mutex);
+	store(async.stop, true);
+	pthread_cond_signal(&async.data);
+	pthread_cond_broadcast(&async.room);
+	pthread_mutex_unlock(&async.mutex);
+
+	pthread_join(async.thread, NULL);
+
+	pthread_cond_destroy(&async.room);
+	pthread_cond_destroy(&async.data);
+	pthread_mutex_destroy(&async.mutex);
+	pthread_key_delete(async.key);
+
+	for (r = async.rings; r; r = next) {
+		next = r->next;
+		eh_free(r);
+	}
+	async.rings = NULL;
+	async.running = false;
+	store(async.gen, async.gen + 1);
+}
+
+unsigned long eh_log_async_dropped(void)
+{
+	return load(async.dropped);
+}
+
+static inline size_t room(struct eh_log_ring *r, unsigned long head)
+{
+	return async.size - (head - load(r->tail));
+}
+
+/* str is the format when ap is given */
+static inline size_t render(char *out, size_t out_size,
+			    const char *name, enum eh_log_level level, int code,
+			    const char *dump, size_t dump_len,
+			    const char *str, ssize_t str_len, va_list *ap)
+{
+	if (ap)
+		return eh_log_formatv(out, out_size, name, level, code,
+				      dump, dump_len, str, *ap);
+	return eh_log_format(out, out_size, name, level, code,
+			     dump, dump_len, str, str_len);
+}
+
+static ssize_t eh_log_async_write(const char *name, enum eh_log_level level, int code,
+				  const char *dump, size_t dump_len,
+				  const char *str, ssize_t str_len, va_list *ap)
+{
+	char line[512], *p = line;
+	struct eh_log_ring *r = eh_log_ring_get();
+	unsigned long head;
+	size_t len, off, contig;
+
+	if (unlikely(r == NULL))
+		goto drop;
+	head = r->head;
+	off = head & (async.size - 1);
+
+	/* straight into the ring when it fits without wrapping */
+	contig = room(r, head);
+	if (contig > async.size - off)
+		contig = async.size - off;
+
+	len = render(r->buf + off, contig, name, level, code,
+		     dump, dump_len, str, str_len, ap);
+	if (likely(len <= contig))
+		goto commit;
+
+	/* otherwise render it aside and copy it in, once there is room */
+	if (unlikely(len > async.size))
+		len = async.size; /* truncated to the whole ring */
+
+	if (len > sizeof(line) && (p = eh_alloc(len)) == NULL)
+		goto drop;
+	render(p, len, name, level, code, dump, dump_len, str, str_len, ap);
+	p[len-1] = '\n';
+
+	if (unlikely(room(r, head) < len)) {
+		if (async.policy == EH_LOG_ASYNC_DROP)
+			goto drop_free;
+
+		pthread_mutex_lock(&async.mutex);
+		__atomic_add_fetch(&async.producer_waiting, 1, __ATOMIC_SEQ_CST);
+		while (room(r, head) < len && !async.stop)
+			pthread_cond_wait(&async.room, &async.mutex);
+		__atomic_sub_fetch(&async.producer_waiting, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&async.mutex);
+
+		if (room(r, head) < len)
+			goto drop_free;
+	}
+
+	if (len > async.size - off) {
+		memcpy(r->buf + off, p, async.size - off);
+		memcpy(r->buf, p + (async.size - off), len - (async.size - off));
+	} else {
+		memcpy(r->buf + off, p, len);
+	}
+
+	if (p != line)
+		eh_free(p);
+commit:
+	store(r->head, head + len);
+	if (load(async.writer_waiting)) {
+		pthread_mutex_lock(&async.mutex);
+		pthread_cond_signal(&async.data);
+		pthread_mutex_unlock(&async.mutex);
+	}
+	return len;
+drop_free:
+	if (p != line)
+		eh_free(p);
+drop:
+	__atomic_add_fetch(&async.dropped, 1, __ATOMIC_RELAXED);
+	errno = ENOBUFS;
+	return -1;
+}
+
+/* log writter */
+ssize_t eh_log_async(const char *name, enum eh_log_level level, int code,
+		     const char *dump, size_t dump_len,
+		     const char *str, ssize_t str_len)
+{
+	return eh_log_async_write(name, level, code, dump, dump_len,
+				  str, str_len, NULL);
+}
+
+/* log writter formatting the message straight into the ring */
+ssize_t eh_log_asyncv(const char *name, enum eh_log_level level, int code,
+		      const char *dump, size_t dump_len,
+		      const char *fmt, va_list ap)
+{
+	ssize_t ret;
+	va_list aq;
+
+	va_copy(aq, ap);
+	ret = eh_log_async_write(name, level, code, dump, dump_len, fmt, -1, &aq);
+	va_end(aq);
+	return ret;
+}
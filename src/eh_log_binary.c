@@ -0,0 +1,708 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "eh.h"
+#include "eh_fd.h"
+#include "eh_list.h"
+#include "eh_alloc.h"
+
+#include "eh_log.h"
+
+/*
+ * binary log file layout, all records 8 bytes aligned:
+ *
+ *   header | record | record | ... | zeros
+ *
+ * format strings are written once as EH_LOG_BINARY_DEF records identified by
+ * their address, log records refer to them and carry the raw arguments.
+ */
+#define EH_LOG_BINARY_MAGIC	"EHLOGB1"
+
+enum {
+	EH_LOG_BINARY_END,
+	EH_LOG_BINARY_DEF,
+	EH_LOG_BINARY_LOG,
+};
+
+struct eh_log_binary_header {
+	char magic[8];
+	uint64_t size;
+	uint64_t used;
+};
+
+struct eh_log_binary_record {
+	uint32_t type;
+	uint32_t len;		/* whole record, padding included */
+};
+
+struct eh_log_binary_def {
+	struct eh_log_binary_record r;
+	uint64_t id;
+	/* char str[]; */
+};
+
+struct eh_log_binary_log {
+	struct eh_log_binary_record r;
+	uint64_t fmt;
+	uint64_t ts;		/* nanoseconds since the epoch */
+	int32_t level;
+	int32_t code;
+	uint32_t name_len;
+	uint32_t dump_len;
+	/* char name[name_len], dump[dump_len], padding, args... */
+};
+
+#define ALIGN8(N)	(((N) + 7) & ~(size_t)7)
+
+/*
+ * printf conversions
+ */
+enum arg_type {
+	ARG_NONE,
+	ARG_INT, ARG_LONG, ARG_LLONG, ARG_INTMAX, ARG_SIZE, ARG_PTRDIFF,
+	ARG_DOUBLE, ARG_LDOUBLE,
+	ARG_STR, ARG_PTR,
+	ARG_ERRNO,		/* %m, errno when logged */
+};
+
+struct conv {
+	enum arg_type type;
+	bool is_signed;
+	unsigned stars;		/* '*' width and/or precision */
+	int prec;		/* -1 none, PREC_STAR for '*' */
+};
+
+#define PREC_STAR	-2
+
+/* parses the conversion starting at s (after the '%'), returns its end */
+static const char *conv_parse(const char *s, struct conv *c)
+{
+	enum { L_NONE, L_HH, L_H, L_L, L_LL, L_J, L_Z, L_T, L_LD } len = L_NONE;
+
+	*c = (struct conv) { ARG_NONE, false, 0, -1 };
+
+	while (*s && strchr("-+ #0'I", *s))
+		s++;
+	if (*s == '*')
+		s++, c->stars++;
+	while (*s >= '0' && *s <= '9')
+		s++;
+	if (*s == '.') {
+		s++;
+		c->prec = 0;
+		if (*s == '*')
+			s++, c->stars++, c->prec = PREC_STAR;
+		while (*s >= '0' && *s <= '9' && c->prec < 100000)
+			c->prec = c->prec * 10 + (*s++ - '0');
+		while (*s >= '0' && *s <= '9')
+			s++;
+	}
+
+	switch (*s) {
+	case 'h':
+		len = (s[1] == 'h') ? (s++, L_HH) : L_H;
+		s++;
+		break;
+	case 'l':
+		len = (s[1] == 'l') ? (s++, L_LL) : L_L;
+		s++;
+		break;
+	case 'q': len = L_LL; s++; break;
+	case 'j': len = L_J; s++; break;
+	case 'z': case 'Z': len = L_Z; s++; break;
+	case 't': len = L_T; s++; break;
+	case 'L': len = L_LD; s++; break;
+	}
+
+	switch (*s) {
+	case 'd': case 'i':
+		c->is_signed = true;
+		/* fall through */
+	case 'u': case 'o': case 'x': case 'X':
+		switch (len) {
+		case L_L: c->type = ARG_LONG; break;
+		case L_LL: case L_LD: c->type = ARG_LLONG; break;
+		case L_J: c->type = ARG_INTMAX; break;
+		case L_Z: c->type = ARG_SIZE; break;
+		case L_T: c->type = ARG_PTRDIFF; break;
+		default: c->type = ARG_INT;
+		}
+		break;
+	case 'c':
+		c->type = ARG_INT;
+		break;
+	case 'e': case 'E': case 'f': case 'F':
+	case 'g': case 'G': case 'a': case 'A':
+		c->type = (len == L_LD) ? ARG_LDOUBLE : ARG_DOUBLE;
+		break;
+	case 's':
+		c->type = ARG_STR;
+		break;
+	case 'p': case 'n':
+		c->type = ARG_PTR;
+		break;
+	case 'm':
+		c->type = ARG_ERRNO;
+		break;
+	case '\0':
+		return s;
+	}
+	return s + 1;
+}
+
+/*
+ * writer
+ */
+
+/* the decoder mirrors this cache, so a definition is always found on its slot */
+#define SEEN_SLOTS	256
+#define seen_slot(ID)	(((ID) >> 3) % SEEN_SLOTS)
+
+static struct {
+	char *map;
+	size_t size;
+	size_t pos;
+	unsigned long dropped;
+
+	const char *seen[SEEN_SLOTS];	/* format strings already defined */
+} out;
+
+/* records and the formats cache are shared by all threads */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void *out_reserve(size_t len)
+{
+	if (unlikely(len > out.size - out.pos))
+		return NULL;
+	return out.map + out.pos;
+}
+
+static inline void out_commit(size_t len)
+{
+	struct eh_log_binary_header *h = (void *)out.map;
+	out.pos += len;
+	h->used = out.pos;
+}
+
+static bool define(const char *fmt)
+{
+	unsigned i = seen_slot((uintptr_t)fmt);
+
+	if (likely(out.seen[i] == fmt))
+		return true;
+	else {
+		size_t l = strlen(fmt) + 1;
+		size_t len = ALIGN8(sizeof(struct eh_log_binary_def) + l);
+		struct eh_log_binary_def *d = out_reserve(len);
+
+		if (d == NULL)
+			return false;
+
+		d->r = (struct eh_log_binary_record) { EH_LOG_BINARY_DEF, len };
+		d->id = (uintptr_t)fmt;
+		memcpy(d + 1, fmt, l);
+		out_commit(len);
+
+		out.seen[i] = fmt;
+		return true;
+	}
+}
+
+/* copies the arguments described by fmt, returns bytes used or -1 if they don't fit */
+static ssize_t put_args(char *p, size_t size, const char *fmt, va_list ap, int err)
+{
+	char *start = p, *end = p + size;
+
+	while ((fmt = strchr(fmt, '%')) != NULL) {
+		struct conv c;
+		uint64_t v = 0;
+
+		if (fmt[1] == '%') {
+			fmt += 2;
+			continue;
+		}
+		fmt = conv_parse(fmt + 1, &c);
+
+		for (unsigned i = 0; i < c.stars; i++) {
+			if (end - p < 8)
+				return -1;
+			v = (int64_t)va_arg(ap, int);
+			memcpy(p, &v, 8);
+			p += 8;
+		}
+		if (c.prec == PREC_STAR) /* the last star, negative is none */
+			c.prec = (int64_t)v < 0 ? -1 : (int)v;
+
+		switch (c.type) {
+		case ARG_NONE:
+			continue;
+		case ARG_STR: {
+			const char *s = va_arg(ap, const char *);
+			uint64_t l;
+
+			if (s == NULL)
+				s = "(null)";
+			/* with a precision s needn't be terminated */
+			l = c.prec < 0 ? strlen(s) : strnlen(s, c.prec);
+
+			if ((size_t)(end - p) < ALIGN8(8 + l + 1))
+				return -1;
+			memcpy(p, &l, 8);
+			memcpy(p + 8, s, l);
+			p[8 + l] = '\0';
+			p += ALIGN8(8 + l + 1);
+			continue;
+		}
+		case ARG_DOUBLE:
+		case ARG_LDOUBLE: {
+			double d = (c.type == ARG_DOUBLE) ? va_arg(ap, double)
+							  : (double)va_arg(ap, long double);
+			memcpy(&v, &d, 8);
+			break;
+		}
+		case ARG_PTR:
+			v = (uintptr_t)va_arg(ap, void *);
+			break;
+		case ARG_ERRNO:
+			v = err;
+			break;
+		case ARG_INT:
+			v = c.is_signed ? (uint64_t)va_arg(ap, int) : va_arg(ap, unsigned);
+			break;
+		case ARG_LONG:
+			v = c.is_signed ? (uint64_t)va_arg(ap, long) : va_arg(ap, unsigned long);
+			break;
+		case ARG_LLONG:
+			v = va_arg(ap, unsigned long long);
+			break;
+		case ARG_INTMAX:
+			v = va_arg(ap, uintmax_t);
+			break;
+		case ARG_SIZE:
+			v = va_arg(ap, size_t);
+			break;
+		case ARG_PTRDIFF:
+			v = va_arg(ap, ptrdiff_t);
+			break;
+		}
+
+		if (end - p < 8)
+			return -1;
+		memcpy(p, &v, 8);
+		p += 8;
+	}
+	return p - start;
+}
+
+ssize_t eh_log_binaryv(const char *name, enum eh_log_level level, int code,
+		       const char *dump, size_t dump_len,
+		       const char *fmt, va_list ap)
+{
+	struct eh_log_binary_log *r;
+	struct timespec ts;
+	int err = errno; /* for %m */
+	size_t name_len = name ? strlen(name) : 0;
+	size_t len = ALIGN8(sizeof(*r) + name_len + dump_len);
+	ssize_t l;
+	char *p;
+
+	assert(out.map != NULL);
+
+	pthread_mutex_lock(&lock);
+	if (unlikely(!define(fmt)) || (r = out_reserve(len)) == NULL)
+		goto drop;
+
+	p = (char *)(r + 1);
+	l = put_args(p + (len - sizeof(*r)), out.size - out.pos - len, fmt, ap, err);
+	if (unlikely(l < 0))
+		goto drop;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	*r = (struct eh_log_binary_log) {
+		.r = { EH_LOG_BINARY_LOG, len + l },
+		.fmt = (uintptr_t)fmt,
+		.ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec,
+		.level = level,
+		.code = code,
+		.name_len = name_len,
+		.dump_len = dump ? dump_len : 0,
+	};
+	memcpy(p, name, name_len);
+	if (dump)
+		memcpy(p + name_len, dump, dump_len);
+
+	out_commit(len + l);
+	pthread_mutex_unlock(&lock);
+	return len + l;
+drop:
+	out.dropped++;
+	pthread_mutex_unlock(&lock);
+	errno = ENOSPC;
+	return -1;
+}
+
+ssize_t eh_log_binary(const char *name, enum eh_log_level level, int code,
+		      const char *dump, size_t dump_len,
+		      const char *str, ssize_t str_len)
+{
+	return eh_log_binaryf(name, level, code, dump, dump_len, "%.*s",
+			      (int)(str_len < 0 ? strlen(str) : (size_t)str_len), str);
+}
+
+ssize_t eh_log_binaryf(const char *name, enum eh_log_level level, int code,
+		       const char *dump, size_t dump_len,
+		       const char *fmt, ...)
+{
+	ssize_t l;
+	va_list ap;
+
+	va_start(ap, fmt);
+	l = eh_log_binaryv(name, level, code, dump, dump_len, fmt, ap);
+	va_end(ap);
+
+	return l;
+}
+
+unsigned long eh_log_binary_dropped(void)
+{
+	return out.dropped;
+}
+
+/** Maps a log file of the given size, allocated on disk up front
+ *
+ * Returns: 0:ok, -1:errno (ENOSPC if the disk can't hold it)
+ */
+int eh_log_binary_init(const char *path, size_t size)
+{
+	struct eh_log_binary_header *h;
+	int fd;
+
+	assert(out.map == NULL);
+	assert(size > sizeof(*h));
+
+	if ((fd = eh_open(path, O_RDWR|O_CREAT|O_TRUNC, 1, 0644)) < 0)
+		return -1;
+
+	/* really allocated, a sparse file would SIGBUS on a full disk */
+	if ((errno = posix_fallocate(fd, 0, size)) != 0)
+		goto fail;
+
+	h = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED)
+		goto fail;
+	eh_close(&fd);
+
+	*h = (struct eh_log_binary_header) {
+		.magic = EH_LOG_BINARY_MAGIC,
+		.size = size,
+		.used = sizeof(*h),
+	};
+
+	out.map = (char *)h;
+	out.size = size;
+	out.pos = sizeof(*h);
+	out.dropped = 0;
+	memset(out.seen, 0, sizeof(out.seen));
+	return 0;
+fail:
+	{
+		int e = errno;
+		eh_close(&fd);
+		errno = e;
+	}
+	return -1;
+}
+
+/** Flushes and unmaps the log file, restore the previous backends first */
+void eh_log_binary_finish(void)
+{
+	if (out.map == NULL)
+		return;
+
+	msync(out.map, out.pos, MS_SYNC);
+	munmap(out.map, out.size);
+	out.map = NULL;
+}
+
+/*
+ * decoder
+ */
+#define render(V)	( \
+	c.stars == 0 ? snprintf(p, room, spec, V) : \
+	c.stars == 1 ? snprintf(p, room, spec, (int)s[0], V) : \
+		       snprintf(p, room, spec, (int)s[0], (int)s[1], V))
+
+/*
+ * replays a format with the stored arguments. like snprintf() returns
+ * the whole length, of which only size bytes are written.
+ */
+static size_t render_msg(char *buf, size_t size, const char *fmt,
+			 const char *args, const char *args_end)
+{
+	size_t len = 0;
+
+	while (*fmt) {
+		const char *f = fmt;
+		char spec[32], *p = len < size ? buf + len : NULL;
+		size_t room = len < size ? size - len : 0;
+		int64_t s[2] = { 0, 0 };
+		uint64_t v = 0;
+		struct conv c;
+		int l;
+
+		if (*fmt != '%' || fmt[1] == '%') {
+			if (p)
+				*p = *fmt;
+			len++;
+			fmt += (*fmt == '%') ? 2 : 1;
+			continue;
+		}
+
+		fmt = conv_parse(fmt + 1, &c);
+		if (c.type == ARG_NONE || (size_t)(fmt - f) >= sizeof(spec))
+			continue;
+
+		memcpy(spec, f, fmt - f);
+		spec[fmt - f] = '\0';
+
+		for (unsigned i = 0; i < c.stars && args + 8 <= args_end; i++, args += 8)
+			memcpy(&s[i], args, 8);
+
+		if (args + 8 > args_end)
+			break;
+		memcpy(&v, args, 8);
+		args += 8;
+
+		switch (c.type) {
+		case ARG_STR:
+			/* stored inline, NUL terminated */
+			if (v >= (uint64_t)(args_end - args) || args[v] != '\0')
+				goto done;
+			l = render(args);
+			args += ALIGN8(8 + v + 1) - 8;
+			break;
+		case ARG_ERRNO:
+			spec[fmt - f - 1] = 's';
+			l = render(strerror((int)v));
+			break;
+		case ARG_DOUBLE:
+		case ARG_LDOUBLE: {
+			double d;
+			memcpy(&d, &v, 8);
+			if (c.type == ARG_LDOUBLE)
+				l = render((long double)d);
+			else
+				l = render(d);
+			break;
+		}
+		case ARG_PTR:
+			if (fmt[-1] == 'n')
+				continue;
+			l = render((void *)(uintptr_t)v);
+			break;
+		case ARG_LONG:
+			l = render((long)v);
+			break;
+		case ARG_LLONG:
+			l = render((long long)v);
+			break;
+		case ARG_INTMAX:
+			l = render((intmax_t)v);
+			break;
+		case ARG_SIZE:
+			l = render((size_t)v);
+			break;
+		case ARG_PTRDIFF:
+			l = render((ptrdiff_t)v);
+			break;
+		default:
+			l = render((int)v);
+		}
+
+		if (l < 0)
+			break;
+		len += l;
+	}
+done:
+	return len;
+}
+#undef render
+
+/* heap buffer only ever made bigger */
+struct grow {
+	char *p;
+	size_t size;
+};
+
+static bool reserve(struct grow *b, size_t size)
+{
+	char *p;
+
+	if (size <= b->size)
+		return true;
+	if ((p = eh_alloc(size)) == NULL)
+		return false;
+	if (b->p)
+		eh_free(b->p);
+	b->p = p;
+	b->size = size;
+	return true;
+}
+
+/** Renders a binary log file as text lines into fd
+ *
+ * Returns: number of records, -1:errno
+ */
+ssize_t eh_log_binary_decode(const char *path, int fd)
+{
+	const struct eh_log_binary_header *h;
+	struct {
+		uint64_t id;
+		const char *fmt;
+	} defs[SEEN_SLOTS] = {{ 0, NULL }};
+	struct grow msg = { NULL, 0 }, nbuf = { NULL, 0 }, line = { NULL, 0 };
+	struct stat st;
+	ssize_t count = 0;
+	size_t used;
+	char *map;
+	int in;
+
+	if ((in = eh_open(path, O_RDONLY, 1, 0)) < 0)
+		return -1;
+	if (fstat(in, &st) < 0 || (size_t)st.st_size < sizeof(*h)) {
+		eh_close(&in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, in, 0);
+	eh_close(&in);
+	if (map == MAP_FAILED)
+		return -1;
+
+	h = (const void *)map;
+	if (memcmp(h->magic, EH_LOG_BINARY_MAGIC, sizeof(h->magic)) != 0) {
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	used = h->used < (uint64_t)st.st_size ? h->used : (size_t)st.st_size;
+
+	for (size_t pos = sizeof(*h); pos + sizeof(struct eh_log_binary_record) <= used; ) {
+		const struct eh_log_binary_log *r = (const void *)(map + pos);
+		const char *name, *dump, *fmt, *args;
+		char ts[32];
+		size_t l, ll;
+
+		if (r->r.len < sizeof(r->r) || r->r.len > used - pos ||
+		    r->r.type == EH_LOG_BINARY_END)
+			break;
+		pos += r->r.len;
+
+		if (r->r.type == EH_LOG_BINARY_DEF) {
+			const struct eh_log_binary_def *d = (const void *)r;
+			unsigned i = seen_slot(d->id);
+
+			if (memchr(d + 1, '\0', r->r.len - sizeof(*d)) != NULL)
+				defs[i].id = d->id, defs[i].fmt = (const char *)(d + 1);
+			continue;
+		} else if (r->r.type != EH_LOG_BINARY_LOG) {
+			continue;
+		} else if (defs[seen_slot(r->fmt)].id != r->fmt) {
+			continue;
+		}
+		fmt = defs[seen_slot(r->fmt)].fmt;
+
+		name = (const char *)(r + 1);
+		dump = name + r->name_len;
+
+		args = map + pos - r->r.len + ALIGN8(sizeof(*r) + r->name_len + r->dump_len);
+
+		/* sized to the record, rendering again when it didn't fit */
+		l = render_msg(msg.p, msg.size, fmt, args, map + pos);
+		if (l >= msg.size) {
+			if (!reserve(&msg, l + 1))
+				goto nomem;
+			l = render_msg(msg.p, msg.size, fmt, args, map + pos);
+		}
+
+		/* names are stored without terminator */
+		if (!reserve(&nbuf, r->name_len + 1))
+			goto nomem;
+		memcpy(nbuf.p, name, r->name_len);
+		nbuf.p[r->name_len] = '\0';
+
+		snprintf(ts, sizeof(ts), "[%lu.%06lu] ",
+			 (unsigned long)(r->ts / 1000000000),
+			 (unsigned long)(r->ts % 1000000000) / 1000);
+		eh_write(fd, ts, strlen(ts));
+
+		for (int i = 0; i < 2; i++) {
+			ll = eh_log_format(line.p, line.size, r->name_len ? nbuf.p : NULL,
+					   r->level, r->code,
+					   r->dump_len ? dump : NULL, r->dump_len, msg.p, l);
+			if (ll <= line.size)
+				break;
+			else if (!reserve(&line, ll))
+				goto nomem;
+		}
+		eh_write(fd, line.p, ll);
+		count++;
+	}
+
+	goto done;
+nomem:
+	count = -1;
+done:
+	if (msg.p)
+		eh_free(msg.p);
+	if (nbuf.p)
+		eh_free(nbuf.p);
+	if (line.p)
+		eh_free(line.p);
+	munmap(map, st.st_size);
+	return count;
+}
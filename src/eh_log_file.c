@@ -0,0 +1,288 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "eh.h"
+#include "eh_fd.h"
+#include "eh_list.h"
+#include "eh_alloc.h"
+#include "eh_watcher.h"
+
+#include "eh_log.h"
+
+/*
+ * lines are rendered straight into a preallocated, memory-mapped segment.
+ * when it's full the file is trimmed to what was used and rotated into
+ * path.1, path.2, ... path.keep
+ */
+static struct {
+	char *path;
+	unsigned keep;
+
+	char *map;
+	size_t size;
+	size_t pos;
+	size_t synced;
+	int fd;
+
+	ev_timer timer;
+} out = { .fd = -1 };
+
+/* lines may come from several threads, the timer from another */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void eh_log_file_rotate(void)
+{
+	char from[PATH_MAX], to[PATH_MAX];
+
+	for (unsigned i = out.keep; i > 0; i--) {
+		if (i > 1)
+			snprintf(from, sizeof(from), "%s.%u", out.path, i - 1);
+		else
+			snprintf(from, sizeof(from), "%s", out.path);
+		snprintf(to, sizeof(to), "%s.%u", out.path, i);
+
+		rename(from, to);
+	}
+
+	if (out.keep == 0)
+		unlink(out.path);
+}
+
+/* MS_SYNC waits for the disk, rotation leaves that to the kernel */
+static int eh_log_file_close(int flags)
+{
+	int ret;
+
+	if (out.map == NULL)
+		return 0;
+
+	msync(out.map, out.pos, flags);
+	munmap(out.map, out.size);
+	out.map = NULL;
+
+	/* drop the unused preallocation */
+	ret = ftruncate(out.fd, out.pos);
+	eh_close(&out.fd);
+	return ret;
+}
+
+/* blocks are reserved up front, a full disk fails here instead of raising
+ * SIGBUS on a store into the map */
+static int eh_log_file_open(void)
+{
+	out.fd = eh_open(out.path, O_RDWR|O_CREAT|O_TRUNC, 1, 0644);
+	if (out.fd < 0)
+		return -1;
+
+	if ((errno = posix_fallocate(out.fd, 0, out.size)) != 0)
+		goto fail;
+
+	out.map = mmap(NULL, out.size, PROT_READ|PROT_WRITE, MAP_SHARED, out.fd, 0);
+	if (out.map == MAP_FAILED) {
+		out.map = NULL;
+		goto fail;
+	}
+
+	out.pos = out.synced = 0;
+	return 0;
+fail:
+	{
+		int e = errno;
+		eh_close(&out.fd);
+		unlink(out.path); /* nothing was logged on it */
+		errno = e;
+	}
+	return -1;
+}
+
+/** Opens path as a log segment of size bytes, rotating a previous one
+ *
+ * Returns: 0:ok, -1:errno (ENOSPC if the disk can't hold a segment)
+ */
+int eh_log_file_init(const char *path, size_t size, unsigned keep)
+{
+	size_t l = strlen(path) + 1;
+
+	assert(out.map == NULL);
+	assert(size >= 4096);
+
+	if ((out.path = eh_alloc(l)) == NULL)
+		return -1;
+	memcpy(out.path, path, l);
+
+	out.size = size;
+	out.keep = keep;
+
+	if (access(path, F_OK) == 0)
+		eh_log_file_rotate();
+
+	if (eh_log_file_open() < 0) {
+		eh_free(out.path);
+		return -1;
+	}
+	return 0;
+}
+
+/** Syncs, trims and closes the current segment, restore the previous backend first */
+void eh_log_file_finish(void)
+{
+	eh_log_file_close(MS_SYNC);
+	if (out.path)
+		eh_free(out.path);
+}
+
+/** Schedules what has been written since the last call to be flushed */
+int eh_log_file_sync(void)
+{
+	size_t from;
+	int ret;
+
+	pthread_mutex_lock(&lock);
+	if (out.map == NULL || out.synced == out.pos) {
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+
+	/* msync() wants page aligned addresses */
+	from = out.synced & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+	out.synced = out.pos;
+
+	ret = msync(out.map + from, out.pos - from, MS_ASYNC);
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+static void timer_callback(struct ev_loop *UNUSED(loop), ev_timer *UNUSED(w), int UNUSED(revents))
+{
+	eh_log_file_sync();
+}
+
+/** Calls eh_log_file_sync() every interval seconds
+ *
+ * The timer doesn't keep ev_run() going on its own.
+ */
+void eh_log_file_start(struct ev_loop *loop, float interval)
+{
+	if (eh_timer_active(&out.timer))
+		return;
+
+	eh_timer_init(&out.timer, timer_callback, NULL, interval, interval);
+	eh_timer_start(&out.timer, loop);
+	ev_unref(loop);
+}
+
+void eh_log_file_stop(struct ev_loop *loop)
+{
+	if (eh_timer_active(&out.timer)) {
+		ev_ref(loop);
+		eh_timer_stop(&out.timer, loop);
+	}
+	eh_log_file_sync();
+}
+
+/* str is the format when ap is given */
+static ssize_t eh_log_file_write(const char *name, enum eh_log_level level, int code,
+				 const char *dump, size_t dump_len,
+				 const char *str, ssize_t str_len, va_list *ap)
+{
+	size_t len;
+	bool rotated = false;
+
+	pthread_mutex_lock(&lock);
+	if (unlikely(out.map == NULL)) {
+		errno = EBADF;
+		goto fail;
+	}
+
+try_format:
+	if (ap)
+		len = eh_log_formatv(out.map + out.pos, out.size - out.pos,
+				     name, level, code, dump, dump_len, str, *ap);
+	else
+		len = eh_log_format(out.map + out.pos, out.size - out.pos,
+				    name, level, code, dump, dump_len, str, str_len);
+
+	/* it didn't fit, continue on a new segment */
+	if (unlikely(len > out.size - out.pos) && !rotated) {
+		eh_log_file_close(MS_ASYNC);
+		eh_log_file_rotate();
+		if (eh_log_file_open() < 0)
+			goto fail;
+
+		rotated = true;
+		goto try_format;
+	}
+
+	/* not even a whole segment is enough */
+	if (unlikely(len > out.size - out.pos)) {
+		len = out.size - out.pos;
+		out.map[out.pos + len - 1] = '\n';
+	}
+
+	out.pos += len;
+	pthread_mutex_unlock(&lock);
+	return len;
+fail:
+	pthread_mutex_unlock(&lock);
+	return -1;
+}
+
+/* log writter */
+ssize_t eh_log_file(const char *name, enum eh_log_level level, int code,
+		    const char *dump, size_t dump_len,
+		    const char *str, ssize_t str_len)
+{
+	return eh_log_file_write(name, level, code, dump, dump_len,
+				 str, str_len, NULL);
+}
+
+/* log writter formatting the message straight into the segment */
+ssize_t eh_log_filev(const char *name, enum eh_log_level level, int code,
+		     const char *dump, size_t dump_len,
+		     const char *fmt, va_list ap)
+{
+	ssize_t ret;
+	va_list aq;
+
+	va_copy(aq, ap);
+	ret = eh_log_file_write(name, level, code, dump, dump_len, fmt, -1, &aq);
+	va_end(aq);
+	return ret;
+}
@@ -0,0 +1,389 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_fmt.h"
+#include "eh_scan.h"
+#include "eh_buffer.h"
+#include "eh_resp.h"
+
+#define MAX_DEPTH	32
+#define MAX_INLINE	(64 * 1024)	/* arbitrary */
+
+/* a "\r\n" terminated line from p. NULL if incomplete */
+static inline const char *resp_line(const char *p, const char *end, size_t *len)
+{
+	const char *cr = memchr(p, '\r', end - p);
+
+	if (cr == NULL || cr + 1 >= end)
+		return NULL;
+
+	*len = cr - p;
+	return cr + 2;
+}
+
+/* signed integer filling the whole line */
+static inline int resp_int(const char *p, size_t len, int64_t *v)
+{
+	ssize_t l = eh_scan_i64(p, len, v);
+	return (l > 0 && (size_t)l == len) ? 0 : -1;
+}
+
+/* "PING foo\r\n" as an array of bulk strings */
+static ssize_t parse_inline(const char *data, size_t len, struct eh_resp_value *values,
+			    size_t values_size, size_t *count)
+{
+	const char *p, *eol;
+	const char *lf = memchr(data, '\n', len);
+	size_t n = 1;
+
+	if (lf == NULL) {
+		if (len > MAX_INLINE) {
+			errno = EBADMSG;
+			return -1;
+		}
+		return 0;
+	}
+
+	eol = (lf > data && lf[-1] == '\r') ? lf - 1 : lf;
+	values[0] = (struct eh_resp_value) { .type = EH_RESP_ARRAY };
+
+	for (p = data; p < eol; ) {
+		const char *sp;
+
+		if (*p == ' ' || *p == '\t') {
+			p++;
+			continue;
+		}
+		for (sp = p; sp < eol && *sp != ' ' && *sp != '\t'; sp++)
+			;
+		if (n == values_size) {
+			errno = E2BIG;
+			return -1;
+		}
+		values[n++] = (struct eh_resp_value) {
+			.type = EH_RESP_BULK, .str = p, .len = sp - p,
+		};
+		p = sp;
+	}
+
+	values[0].len = n - 1;
+	*count = n;
+	return lf + 1 - data;
+}
+
+/** Parses one whole value */
+ssize_t eh_resp_parse(const char *data, size_t len, struct eh_resp_value *values,
+		      size_t values_size, size_t *count)
+{
+	const char *p = data, *end = data + len;
+	size_t pending[MAX_DEPTH]; /* elements left of each open aggregate */
+	int depth = 0;
+	size_t n = 0;
+
+	assert(values != NULL && values_size > 0);
+
+	do {
+		struct eh_resp_value *v;
+		const char *line, *next;
+		size_t l;
+		int64_t i;
+
+		if (p == end)
+			return 0;
+		if (n == 0 && (*p == 0 || strchr("+-:$*_#,(!=%~|>", *p) == NULL))
+			return parse_inline(data, len, values, values_size, count);
+		if (n == values_size) {
+			errno = E2BIG;
+			return -1;
+		}
+		if ((next = resp_line(p + 1, end, &l)) == NULL)
+			return 0;
+		if (next[-1] != '\n')
+			goto bad;
+
+		v = &values[n++];
+		*v = (struct eh_resp_value) { .type = *p, .str = line = p + 1, .len = l };
+
+		switch (v->type) {
+		case EH_RESP_SIMPLE:
+		case EH_RESP_ERROR:
+		case EH_RESP_DOUBLE:
+		case EH_RESP_BIGNUM:
+			break;
+		case EH_RESP_INTEGER:
+			if (resp_int(line, l, &v->integer) < 0)
+				goto bad;
+			break;
+		case EH_RESP_NULL:
+			if (l != 0)
+				goto bad;
+			v->null = true;
+			v->len = 0;
+			break;
+		case EH_RESP_BOOLEAN:
+			if (l != 1 || (*line != 't' && *line != 'f'))
+				goto bad;
+			v->integer = (*line == 't');
+			break;
+		case EH_RESP_BULK:
+		case EH_RESP_BULK_ERROR:
+		case EH_RESP_VERBATIM:
+			if (resp_int(line, l, &i) < 0 || i < -1)
+				goto bad;
+			if (i == -1) {
+				v->null = true;
+				v->len = 0;
+				break;
+			}
+			if ((size_t)(end - next) < (uint64_t)i + 2)
+				return 0;
+			if (next[i] != '\r' || next[i+1] != '\n')
+				goto bad;
+			v->str = next;
+			v->len = i;
+			next += i + 2;
+			break;
+		case EH_RESP_ARRAY:
+		case EH_RESP_MAP:
+		case EH_RESP_SET:
+		case EH_RESP_ATTRIBUTE:
+		case EH_RESP_PUSH:
+			if (resp_int(line, l, &i) < 0 || i < -1)
+				goto bad;
+			v->str = NULL;
+			if (i == -1) {
+				v->null = true;
+				v->len = 0;
+				break;
+			}
+			/* every element takes at least one value */
+			if ((uint64_t)i >= values_size) {
+				errno = E2BIG;
+				return -1;
+			}
+			if (v->type == EH_RESP_MAP || v->type == EH_RESP_ATTRIBUTE)
+				i *= 2;
+			v->len = i;
+
+			if (i > 0) {
+				if (depth == MAX_DEPTH)
+					goto bad;
+				pending[depth++] = i + 1; /* decremented below */
+			}
+			break;
+		default:
+			goto bad;
+		}
+		p = next;
+
+		/* close the aggregates this value completes */
+		while (depth > 0 && --pending[depth - 1] == 0)
+			depth--;
+	} while (depth > 0);
+
+	*count = n;
+	return p - data;
+bad:
+	errno = EBADMSG;
+	return -1;
+}
+
+void eh_resp_init(struct eh_resp *self, struct eh_resp_cb *cb,
+		  struct eh_resp_value *values, size_t values_size)
+{
+	assert(self != NULL);
+	assert(cb != NULL && cb->on_command != NULL);
+	assert(values != NULL && values_size > 1);
+
+	*self = (struct eh_resp) {
+		.values = values,
+		.values_size = values_size,
+		.batch_max = EH_RESP_BATCH_MAX,
+		.cb = cb,
+	};
+}
+
+/** Caps the commands dispatched per eh_resp_read()
+ *
+ * The rest is left in the buffer, for on_read() to be called again or
+ * for the next loop iteration once the connection's budget is spent.
+ * 0 is unlimited.
+ */
+void eh_resp_set_batch(struct eh_resp *self, unsigned max)
+{
+	self->batch_max = max;
+}
+
+/** Dispatches the complete commands in data, in order */
+ssize_t eh_resp_read(struct eh_resp *self, const char *data, size_t len)
+{
+	size_t off = 0, batch = 0;
+
+	while (off < len && (self->batch_max == 0 || batch < self->batch_max)) {
+		struct eh_resp_value *v = self->values;
+		size_t count;
+		ssize_t l;
+
+		/* empty lines between inline commands */
+		if (data[off] == '\r' || data[off] == '\n') {
+			off++;
+			continue;
+		}
+
+		l = eh_resp_parse(data + off, len - off, v, self->values_size, &count);
+		if (l < 0)
+			goto fail;
+		else if (l == 0)
+			break;
+
+		/* commands are flat arrays of bulk strings */
+		if (v->type != EH_RESP_ARRAY || v->null || v->len + 1 != count)
+			goto bad;
+		for (size_t i = 1; i < count; i++) {
+			if (v[i].type != EH_RESP_BULK || v[i].null)
+				goto bad;
+		}
+
+		off += l;
+		batch++;
+		if (v->len > 0 && !self->cb->on_command(self, v + 1, v->len)) {
+			errno = ECANCELED;
+			goto fail;
+		}
+	}
+
+	if (batch > 0 && self->cb->on_batch)
+		self->cb->on_batch(self, batch);
+	return off;
+bad:
+	errno = EBADMSG;
+fail:
+	/* the replies to what was dispatched still go out */
+	if (batch > 0 && self->cb->on_batch) {
+		int e = errno;
+		self->cb->on_batch(self, batch);
+		errno = e;
+	}
+	return -1;
+}
+
+/*
+ * encoder
+ */
+/* "<type><n>\r\n" optionally followed by "<data>\r\n" */
+static ssize_t put_header(struct eh_buffer *b, char type, int64_t n,
+			  const char *data, size_t len, bool with_data)
+{
+	size_t hl = 1 + eh_fmt_i64_len(n) + 2;
+	size_t total = hl + (with_data ? len + 2 : 0);
+	char *p = eh_buffer_reserve(b, total);
+
+	if (p == NULL)
+		return -1;
+
+	*p = type;
+	p += 1 + eh_fmt_i64(p + 1, n);
+	memcpy(p, "\r\n", 2);
+	if (with_data) {
+		memcpy(p + 2, data, len);
+		memcpy(p + 2 + len, "\r\n", 2);
+	}
+
+	eh_buffer_commit(b, total);
+	return total;
+}
+
+/* "<type><str>\r\n" */
+static ssize_t put_line(struct eh_buffer *b, char type, const char *str, size_t len)
+{
+	char *p = eh_buffer_reserve(b, len + 3);
+
+	if (p == NULL)
+		return -1;
+
+	*p = type;
+	memcpy(p + 1, str, len);
+	memcpy(p + 1 + len, "\r\n", 2);
+	eh_buffer_commit(b, len + 3);
+	return len + 3;
+}
+
+/** "+str", which can't have CR or LF */
+ssize_t eh_resp_put_simple(struct eh_buffer *b, const char *str, size_t len)
+{
+	return put_line(b, EH_RESP_SIMPLE, str, len);
+}
+
+ssize_t eh_resp_put_error(struct eh_buffer *b, const char *str, size_t len)
+{
+	return put_line(b, EH_RESP_ERROR, str, len);
+}
+
+ssize_t eh_resp_put_integer(struct eh_buffer *b, int64_t n)
+{
+	return put_header(b, EH_RESP_INTEGER, n, NULL, 0, false);
+}
+
+ssize_t eh_resp_put_bulk(struct eh_buffer *b, const char *data, size_t len)
+{
+	return put_header(b, EH_RESP_BULK, len, data, len, true);
+}
+
+ssize_t eh_resp_put_null(struct eh_buffer *b, bool resp3)
+{
+	if (resp3)
+		return put_line(b, EH_RESP_NULL, "", 0);
+	return put_header(b, EH_RESP_BULK, -1, NULL, 0, false);
+}
+
+/** Header of an aggregate, for maps and attributes n is the number of pairs */
+ssize_t eh_resp_put_aggregate(struct eh_buffer *b, enum eh_resp_type type, size_t n)
+{
+	return put_header(b, type, n, NULL, 0, false);
+}
+
+ssize_t eh_resp_put_boolean(struct eh_buffer *b, bool v)
+{
+	return put_line(b, EH_RESP_BOOLEAN, v ? "t" : "f", 1);
+}
+
+ssize_t eh_resp_put_double(struct eh_buffer *b, double v)
+{
+	char buf[EH_FMT_DOUBLE_SIZE];
+	return put_line(b, EH_RESP_DOUBLE, buf, eh_fmt_double(buf, v));
+}
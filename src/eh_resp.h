@@ -0,0 +1,138 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EH_RESP_H
+#define _EH_RESP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct eh_buffer;
+
+/*
+ * RESP2/RESP3 (Redis serialization protocol) codec. values point into the
+ * parsed data and are only valid until it's consumed.
+ */
+enum eh_resp_type {
+	EH_RESP_SIMPLE		= '+',
+	EH_RESP_ERROR		= '-',
+	EH_RESP_INTEGER		= ':',
+	EH_RESP_BULK		= '$',
+	EH_RESP_ARRAY		= '*',
+	/* RESP3 */
+	EH_RESP_NULL		= '_',
+	EH_RESP_BOOLEAN		= '#',
+	EH_RESP_DOUBLE		= ',',
+	EH_RESP_BIGNUM		= '(',
+	EH_RESP_BULK_ERROR	= '!',
+	EH_RESP_VERBATIM	= '=',
+	EH_RESP_MAP		= '%',
+	EH_RESP_SET		= '~',
+	EH_RESP_ATTRIBUTE	= '|',
+	EH_RESP_PUSH		= '>',
+};
+
+/*
+ * values are flattened in pre-order, the elements of an aggregate follow
+ * it. len is the length of strings (including double and bignum text)
+ * or the number of direct elements of aggregates, a map of n pairs
+ * has 2n.
+ */
+struct eh_resp_value {
+	enum eh_resp_type type;
+	bool null;		/**< "$-1" or "*-1" of RESP2, and "_" */
+
+	const char *str;
+	size_t len;
+	int64_t integer;	/**< of integers and booleans */
+};
+
+/*
+ * one top level value, into up to values_size nodes
+ * Returns: n:bytes consumed, 0:incomplete, -1:errno (EBADMSG, E2BIG)
+ */
+ssize_t eh_resp_parse(const char *data, size_t len, struct eh_resp_value *values,
+		      size_t values_size, size_t *count);
+
+/*
+ * dispatch of commands, arrays of bulk strings or inline ones, as they
+ * come from clients
+ */
+struct eh_resp;
+
+struct eh_resp_cb {
+	/** argv are bulk strings, only valid during the call. false closes */
+	bool (*on_command) (struct eh_resp *, const struct eh_resp_value *argv, size_t argc);
+	/** after the commands of an eh_resp_read() were dispatched, even if it fails */
+	void (*on_batch) (struct eh_resp *, size_t count);
+};
+
+#define EH_RESP_BATCH_MAX	64
+
+struct eh_resp {
+	struct eh_resp_value *values;
+	size_t values_size;
+
+	/* commands per eh_resp_read(), 0 is unlimited */
+	unsigned batch_max;
+
+	struct eh_resp_cb *cb;
+};
+
+void eh_resp_init(struct eh_resp *self, struct eh_resp_cb *cb,
+		  struct eh_resp_value *values, size_t values_size);
+void eh_resp_set_batch(struct eh_resp *self, unsigned max);
+
+/*
+ * dispatches up to batch_max complete commands in data, meant to be
+ * returned from eh_connection_cb.on_read() so each batch counts as one
+ * message of eh_connection_set_budget()
+ * Returns: n:bytes consumed, 0:needs more data, -1:errno
+ */
+ssize_t eh_resp_read(struct eh_resp *self, const char *data, size_t len);
+
+/*
+ * replies, encoded straight into the buffer. each one is written whole
+ * or returns -1 (ENOSPC) leaving the buffer untouched.
+ */
+ssize_t eh_resp_put_simple(struct eh_buffer *b, const char *str, size_t len);
+ssize_t eh_resp_put_error(struct eh_buffer *b, const char *str, size_t len);
+ssize_t eh_resp_put_integer(struct eh_buffer *b, int64_t n);
+ssize_t eh_resp_put_bulk(struct eh_buffer *b, const char *data, size_t len);
+ssize_t eh_resp_put_null(struct eh_buffer *b, bool resp3);
+ssize_t eh_resp_put_aggregate(struct eh_buffer *b, enum eh_resp_type type, size_t n);
+ssize_t eh_resp_put_boolean(struct eh_buffer *b, bool v);
+ssize_t eh_resp_put_double(struct eh_buffer *b, double v);
+
+static inline ssize_t eh_resp_put_array(struct eh_buffer *b, size_t n)
+{
+	return eh_resp_put_aggregate(b, EH_RESP_ARRAY, n);
+}
+
+#endif /* !_EH_RESP_H */
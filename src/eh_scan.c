@@ -0,0 +1,224 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_scan.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_SWAR 1
+#endif
+
+#define ONES	0x0101010101010101ULL
+
+#ifdef HAVE_SWAR
+/* the 8 bytes at p are all decimal digits */
+static inline bool swar_is8(uint64_t x)
+{
+	return ((x & (ONES * 0xf0)) | (((x + ONES * 0x06) & (ONES * 0xf0)) >> 4))
+		== ONES * 0x33;
+}
+
+/* value of 8 digits, the first one on the lowest byte */
+static inline uint32_t swar_parse8(uint64_t x)
+{
+	x -= ONES * '0';
+	x = (x * 10) + (x >> 8);
+	x = (((x & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32))) +
+	     (((x >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32)))) >> 32;
+	return (uint32_t)x;
+}
+#endif
+
+ssize_t eh_scan_u64(const char *buf, size_t len, uint64_t *out)
+{
+	uint64_t v = 0;
+	size_t i = 0;
+
+#ifdef HAVE_SWAR
+	/* up to 16 digits can't overflow, 8 at a time */
+	for (; i < 16 && i + 8 <= len; i += 8) {
+		uint64_t x;
+
+		memcpy(&x, buf + i, 8);
+		if (!swar_is8(x))
+			break;
+		v = v * 100000000 + swar_parse8(x);
+	}
+#endif
+
+	for (; i < len; i++) {
+		unsigned d = (unsigned char)buf[i] - '0';
+
+		if (d > 9)
+			break;
+		if (unlikely(__builtin_mul_overflow(v, 10, &v) ||
+			     __builtin_add_overflow(v, d, &v))) {
+			errno = ERANGE;
+			return -1;
+		}
+	}
+
+	if (i > 0)
+		*out = v;
+	return i;
+}
+
+/* an optional '-' or '+' followed by decimal digits */
+ssize_t eh_scan_i64(const char *buf, size_t len, int64_t *out)
+{
+	bool neg = false;
+	size_t s = 0;
+	uint64_t v;
+	ssize_t l;
+
+	if (len > 0 && (buf[0] == '-' || buf[0] == '+')) {
+		neg = (buf[0] == '-');
+		s = 1;
+	}
+
+	if ((l = eh_scan_u64(buf + s, len - s, &v)) <= 0)
+		return l;
+
+	if (v > (uint64_t)INT64_MAX + neg) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	*out = neg ? (int64_t)(0 - v) : (int64_t)v;
+	return s + l;
+}
+
+/* value of a hex digit, 16 if it isn't one. without branches, as
+ * digits and letters come mixed */
+static inline unsigned hexval(unsigned char c)
+{
+	unsigned d = (c & 0xf) + 9 * (c >> 6);	/* '0'-'9', 'a'-'f' and 'A'-'F' */
+	unsigned ok = ((unsigned)(c - '0') < 10) | ((unsigned)((c | 0x20) - 'a') < 6);
+
+	return ok ? d : 16;
+}
+
+/* hexadecimal digits, without "0x" */
+ssize_t eh_scan_x64(const char *buf, size_t len, uint64_t *out)
+{
+	uint64_t v = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		unsigned d = hexval(buf[i]);
+
+		if (d > 15)
+			break;
+		if (unlikely(v >> 60)) {
+			errno = ERANGE;
+			return -1;
+		}
+		v = (v << 4) | d;
+	}
+
+	if (i > 0)
+		*out = v;
+	return i;
+}
+
+ssize_t eh_scan_unsigned(const char *buf, size_t len, unsigned *out)
+{
+	uint64_t v;
+	ssize_t l = eh_scan_u64(buf, len, &v);
+
+	if (l > 0) {
+		if (v > UINT_MAX) {
+			errno = ERANGE;
+			return -1;
+		}
+		*out = v;
+	}
+	return l;
+}
+
+#define CEC "abtnvfr"
+
+/* undoes eh_fmt_cstr(), other printable escapes stand for themselves */
+ssize_t eh_scan_cstr(char *buf, size_t buf_size, const char *data, size_t data_size)
+{
+	const char *end = data + data_size;
+	size_t len = 0;
+
+	while (data < end && len < buf_size) {
+		const char *bs = memchr(data, '\\', end - data);
+		size_t l = (bs ? bs : end) - data;
+		const char *e;
+		unsigned c;
+
+		/* plain run */
+		if (l > buf_size - len)
+			l = buf_size - len;
+		memcpy(buf + len, data, l);
+		len += l;
+		data += l;
+
+		if (data == end || len == buf_size)
+			break;
+
+		/* escape */
+		if (end - data < 2)
+			goto fail;
+
+		c = (unsigned char)data[1];
+		if (c == 'x') {
+			unsigned hi, lo;
+			if (end - data < 4 || (hi = hexval(data[2])) > 15 ||
+			    (lo = hexval(data[3])) > 15)
+				goto fail;
+			buf[len++] = hi << 4 | lo;
+			data += 4;
+			continue;
+		} else if (c == '0') {
+			c = 0;
+		} else if (c != 0 && (e = strchr(CEC, c)) != NULL) {
+			c = '\a' + (e - CEC);
+		} else if (c < 0x20 || c > 0x7e) {
+			goto fail;
+		}
+		buf[len++] = c;
+		data += 2;
+	}
+	return len;
+fail:
+	errno = EINVAL;
+	return -1;
+}
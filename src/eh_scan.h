@@ -0,0 +1,50 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EH_SCAN_H
+#define _EH_SCAN_H
+
+#include <stdint.h>
+
+/*
+ * parsing of numbers and escaped strings out of buffer slices, the
+ * counterpart of eh_fmt. nothing has to be terminated and nothing past
+ * len is touched.
+ *
+ * numbers return n:bytes consumed, 0:no digits, -1:overflow (ERANGE)
+ * and only store the value when n > 0.
+ */
+ssize_t eh_scan_u64(const char *buf, size_t len, uint64_t *out);
+ssize_t eh_scan_i64(const char *buf, size_t len, int64_t *out);
+ssize_t eh_scan_x64(const char *buf, size_t len, uint64_t *out);
+ssize_t eh_scan_unsigned(const char *buf, size_t len, unsigned *out);
+
+/* n:bytes written, -1:malformed escape (EINVAL). stops when buf is full */
+ssize_t eh_scan_cstr(char *buf, size_t buf_size, const char *data, size_t data_size);
+
+#endif /* !_EH_SCAN_H */
@@ -47,24 +47,6 @@
 #include "config.h"
 #endif
 
-/* 1:ok, 0:bad address, -1:errno */
-static int init_ipv4(struct sockaddr_in *sin, const char *addr, unsigned port)
-{
-	int e = 1;
-
-	sin->sin_family = AF_INET;
-	sin->sin_port = htons(port);
-
-	/* NULL, "", "0" and "*" mean any address */
-	if (addr == NULL || addr[0] == '\0' ||
-	    ((addr[0] == '0' || addr[0] == '*') && addr[1] == '\0'))
-		sin->sin_addr.s_addr = htonl(INADDR_ANY);
-	else
-		e = inet_pton(sin->sin_family, addr, &sin->sin_addr);
-
-	return e;
-}
-
 static int init_local(struct sockaddr_un *sun, const char *path)
 {
 	size_t l = 0;
@@ -140,7 +122,7 @@ int eh_server_ipv4_tcp(struct eh_server *self, const char *addr, unsigned port,
 	struct sockaddr_in sin;
 	int fd;
 
-	int e = init_ipv4(&sin, addr, port);
+	int e = eh_socket_init_ipv4(&sin, addr, port);
 	if (e != 1)
 		return e; /* 0 or -1 */
 
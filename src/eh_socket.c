@@ -82,6 +82,24 @@ socket_done:
 	return fd;
 }
 
+/* 1:ok, 0:bad address, -1:errno */
+int eh_socket_init_ipv4(struct sockaddr_in *sin, const char *addr, unsigned port)
+{
+	int e = 1;
+
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(port);
+
+	/* NULL, "", "0" and "*" mean any address */
+	if (addr == NULL || addr[0] == '\0' ||
+	    ((addr[0] == '0' || addr[0] == '*') && addr[1] == '\0'))
+		sin->sin_addr.s_addr = htonl(INADDR_ANY);
+	else
+		e = inet_pton(sin->sin_family, addr, &sin->sin_addr);
+
+	return e;
+}
+
 static inline ssize_t eh_socket_ntop_ipv4(char *str, size_t size, const struct sockaddr_in *sin)
 {
 	/* addr:port */
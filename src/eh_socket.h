@@ -30,6 +30,9 @@
 #define _EH_SOCKET_H
 
 int eh_socket(int family, int type, bool cloexec, bool nonblock);
+/* 1:ok, 0:bad address, -1:errno */
+int eh_socket_init_ipv4(struct sockaddr_in *sin, const char *addr, unsigned port);
+
 ssize_t eh_socket_ntop(char *dst, size_t dst_len, const struct sockaddr *sa, socklen_t sa_len);
 
 #endif /* !_EH_SOCKET_H */
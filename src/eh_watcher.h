@@ -105,7 +105,55 @@ static inline void eh_timer_init(ev_timer *w, void (*cb) (struct ev_loop *, ev_t
 	eh_watcher_set_data(w, data);
 }
 
+static inline void eh_timer_set(ev_timer *w, ev_tstamp after, ev_tstamp repeat)
+{
+	ev_timer_set(w, after, repeat);
+}
+
+static inline bool eh_timer_active(ev_timer *w)
+{
+	return ev_is_active(w);
+}
+
 #define eh_timer_start(W, L)	ev_timer_start(L, W)
 #define eh_timer_stop(W, L)	ev_timer_stop(L, W)
 
+/*
+ * ev_check
+ */
+static inline void eh_check_init(ev_check *w, void (*cb) (struct ev_loop *, ev_check *, int),
+				 void *data)
+{
+	eh_watcher_init(w, cb);
+	ev_check_set(w);
+	eh_watcher_set_data(w, data);
+}
+
+static inline bool eh_check_active(ev_check *w)
+{
+	return ev_is_active(w);
+}
+
+#define eh_check_start(W, L)	ev_check_start(L, W)
+#define eh_check_stop(W, L)	ev_check_stop(L, W)
+
+/*
+ * ev_idle
+ */
+static inline void eh_idle_init(ev_idle *w, void (*cb) (struct ev_loop *, ev_idle *, int),
+				void *data)
+{
+	eh_watcher_init(w, cb);
+	ev_idle_set(w);
+	eh_watcher_set_data(w, data);
+}
+
+static inline bool eh_idle_active(ev_idle *w)
+{
+	return ev_is_active(w);
+}
+
+#define eh_idle_start(W, L)	ev_idle_start(L, W)
+#define eh_idle_stop(W, L)	ev_idle_stop(L, W)
+
 #endif /* !_EH_WATCHER_H */
@@ -0,0 +1,215 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * one payload sent to many connections: copied into every write_buffer
+ * with eh_connection_write() against one shared eh_payload queued with
+ * eh_connection_write_payload(). reports the CPU to queue and to flush
+ * each fan-out, and the memory it holds until sent. the peers check
+ * every byte.
+ *
+ *   eh_broadcast_bench [connections] [size] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <malloc.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include <ev.h>
+
+#include "eh.h"
+#include "eh_payload.h"
+#include "eh_connection.h"
+
+struct conn {
+	struct eh_connection c;
+	int peer;
+	char rbuf[16];
+};
+
+static struct conn *conns;
+static char *wbufs;
+static unsigned n;
+static size_t size;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_close(struct eh_connection *UNUSED(c))
+{
+}
+
+static struct eh_connection_cb cb = { .on_close = on_close };
+
+static bool pending(void)
+{
+	for (unsigned i = 0; i < n; i++) {
+		if (eh_connection_pending(&conns[i].c) > 0)
+			return true;
+	}
+	return false;
+}
+
+/* what the peers got is the payload, whole */
+static bool drain(const char *data)
+{
+	static char buf[65536];
+	bool ok = true;
+
+	for (unsigned i = 0; i < n; i++) {
+		size_t got = 0;
+
+		while (got < size) {
+			ssize_t l = read(conns[i].peer, buf + got, size - got);
+			if (l <= 0)
+				return false;
+			got += l;
+		}
+		if (memcmp(buf, data, size) != 0)
+			ok = false;
+	}
+	return ok;
+}
+
+static int bench(struct ev_loop *loop, const char *label, bool shared,
+		 const char *data, unsigned rounds)
+{
+	double queue = 0, flush = 0;
+	size_t held = 0;
+	bool ok = true;
+
+	for (unsigned r = 0; r < rounds; r++) {
+		size_t before = mallinfo2().uordblks;
+		struct eh_payload *p = NULL;
+		double t = now();
+
+		if (shared) {
+			if ((p = eh_payload_new(data, size)) == NULL)
+				return -1;
+			for (unsigned i = 0; i < n; i++)
+				eh_connection_write_payload(&conns[i].c, p);
+			eh_payload_put(p);
+		} else {
+			for (unsigned i = 0; i < n; i++)
+				eh_connection_write(&conns[i].c, data, size);
+		}
+		queue += now() - t;
+
+		if (shared) {
+			held = mallinfo2().uordblks - before;
+		} else {
+			held = 0;
+			for (unsigned i = 0; i < n; i++)
+				held += eh_connection_pending(&conns[i].c);
+		}
+
+		t = now();
+		do {
+			ev_run(loop, EVRUN_NOWAIT);
+		} while (pending());
+		flush += now() - t;
+
+		if (!drain(data))
+			ok = false;
+	}
+
+	printf("  %-8s queue %8.0f us  flush %8.0f us  %6.0f ns/conn  held %9zu bytes\n",
+	       label, queue / rounds * 1e6, flush / rounds * 1e6,
+	       (queue + flush) / rounds / n * 1e9, held);
+	return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	struct ev_loop *loop = ev_default_loop(0);
+	struct rlimit rl;
+	unsigned rounds;
+	char *data;
+	int ret = 0;
+
+	n = argc > 1 ? (unsigned)atoi(argv[1]) : 8000;
+	size = argc > 2 ? (size_t)atol(argv[2]) : 1024;
+	rounds = argc > 3 ? (unsigned)atoi(argv[3]) : 20;
+	if (n == 0 || size == 0 || size > 32768 || rounds == 0) {
+		fprintf(stderr, "usage: %s [connections] [size<=32768] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	/* two descriptors per connection */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	conns = calloc(n, sizeof(*conns));
+	wbufs = malloc((size_t)n * size);
+	data = malloc(size);
+	if (conns == NULL || wbufs == NULL || data == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	for (size_t i = 0; i < size; i++)
+		data[i] = 'a' + i % 26;
+
+	for (unsigned i = 0; i < n; i++) {
+		int sv[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+			fprintf(stderr, "%s: connection %u: %s\n", argv[0], i, strerror(errno));
+			return 1;
+		}
+		fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+		conns[i].peer = sv[1];
+		eh_connection_init(&conns[i].c, sv[0], &cb, conns[i].rbuf,
+				   sizeof(conns[i].rbuf), wbufs + (size_t)i * size, size);
+		eh_connection_start(&conns[i].c, loop);
+	}
+
+	printf("%u connections, %zu bytes, %u rounds\n", n, size, rounds);
+	ret |= bench(loop, "copy", false, data, rounds);
+	ret |= bench(loop, "shared", true, data, rounds);
+
+	printf("check: %s\n", ret == 0 ? "ok" : "FAILED");
+	return ret == 0 ? 0 : 1;
+}
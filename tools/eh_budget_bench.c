@@ -0,0 +1,254 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * latency of light clients beside a heavy one. a thread pipelines lines
+ * into one connection as fast as it can while another pings the light
+ * ones in turn, one line and its reply at a time. every line costs the
+ * server a bit of work. eh_connection_set_budget() is what varies.
+ *
+ *   eh_budget_bench [pings] [light]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <ev.h>
+
+#include "eh.h"
+#include "eh_connection.h"
+
+#define MAX_LIGHT	64
+#define LINE		100
+
+struct conn {
+	struct eh_connection c;
+	bool heavy;
+	int peer;		/* the client's end */
+
+	char rbuf[65535];
+	char wbuf[4096];
+};
+
+static struct conn conns[MAX_LIGHT + 1];
+static unsigned light, pings;
+static size_t heavy_lines;
+static bool stop, heavy_done, light_done;
+static double *rtt;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile uint32_t sink;	/* keeps the work alive */
+
+/* what a handler might do with a line */
+static void work(const char *s, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (int k = 0; k < 4; k++) {
+		for (size_t i = 0; i < len; i++)
+			h = (h ^ (unsigned char)s[i]) * 16777619u;
+	}
+	sink = h;
+}
+
+static ssize_t on_read(struct eh_connection *c, char *data, size_t len)
+{
+	struct conn *self = container_of(c, struct conn, c);
+	char *nl = memchr(data, '\n', len);
+
+	if (nl == NULL)
+		return 0;
+
+	work(data, nl - data);
+	if (self->heavy)
+		heavy_lines++;
+	else if (eh_connection_write(c, "ok\n", 3) < 0)
+		return -1;
+	return nl - data + 1;
+}
+
+static void on_close(struct eh_connection *UNUSED(c))
+{
+}
+
+static struct eh_connection_cb cb = { .on_read = on_read, .on_close = on_close };
+
+static void *heavy(void *UNUSED(arg))
+{
+	static char chunk[LINE * 640];
+	int fd = conns[0].peer;
+
+	for (size_t i = 0; i < sizeof(chunk); i += LINE) {
+		memset(chunk + i, 'h', LINE - 1);
+		chunk[i + LINE - 1] = '\n';
+	}
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		if (write(fd, chunk, sizeof(chunk)) < 0 && errno != EINTR)
+			break;
+	}
+	__atomic_store_n(&heavy_done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void *pinger(void *UNUSED(arg))
+{
+	char buf[8];
+
+	for (unsigned i = 0; i < pings; i++) {
+		int fd = conns[1 + i % light].peer;
+		double t = now();
+		size_t got = 0;
+
+		if (write(fd, "ping\n", 5) != 5)
+			break;
+		while (got < 3) {
+			ssize_t l = read(fd, buf + got, sizeof(buf) - got);
+			if (l <= 0)
+				goto done;
+			got += l;
+		}
+		rtt[i] = now() - t;
+	}
+done:
+	__atomic_store_n(&light_done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static int bench(struct ev_loop *loop, unsigned messages)
+{
+	pthread_t h, p;
+	double t;
+
+	for (unsigned i = 0; i <= light; i++) {
+		struct conn *c = &conns[i];
+		int sv[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+			perror("socketpair");
+			return -1;
+		}
+		fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+		c->heavy = (i == 0);
+		c->peer = sv[1];
+		eh_connection_init(&c->c, sv[0], &cb, c->rbuf, sizeof(c->rbuf),
+				   c->wbuf, sizeof(c->wbuf));
+		eh_connection_set_budget(&c->c, 0, messages);
+		eh_connection_start(&c->c, loop);
+	}
+
+	stop = heavy_done = light_done = false;
+	heavy_lines = 0;
+	memset(rtt, 0, pings * sizeof(double));
+
+	t = now();
+	pthread_create(&h, NULL, heavy, NULL);
+	pthread_create(&p, NULL, pinger, NULL);
+	while (!__atomic_load_n(&light_done, __ATOMIC_ACQUIRE))
+		ev_run(loop, EVRUN_ONCE);
+	t = now() - t;
+
+	/* let the heavy writer finish its last write */
+	__atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+	while (!__atomic_load_n(&heavy_done, __ATOMIC_ACQUIRE))
+		ev_run(loop, EVRUN_NOWAIT);
+	pthread_join(h, NULL);
+	pthread_join(p, NULL);
+
+	for (unsigned i = 0; i <= light; i++) {
+		eh_connection_stop(&conns[i].c);
+		eh_connection_finish(&conns[i].c);
+		close(conns[i].peer);
+	}
+
+	qsort(rtt, pings, sizeof(double), cmp_double);
+	if (rtt[0] == 0) {
+		printf("  %5u  FAILED\n", messages);
+		return -1;
+	}
+
+	if (messages)
+		printf("  %5u", messages);
+	else
+		printf("  %5s", "none");
+	printf("   p50 %7.0f us   p99 %7.0f us   max %7.0f us   heavy %8.0f lines/s\n",
+	       rtt[pings / 2] * 1e6, rtt[pings * 99 / 100] * 1e6, rtt[pings - 1] * 1e6,
+	       heavy_lines / t);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct ev_loop *loop = ev_default_loop(0);
+	static const unsigned budgets[] = { 0, 1024, 256, 64, 16 };
+	int ret = 0;
+
+	pings = argc > 1 ? (unsigned)atoi(argv[1]) : 5000;
+	light = argc > 2 ? (unsigned)atoi(argv[2]) : 8;
+	if (pings == 0 || light == 0 || light > MAX_LIGHT) {
+		fprintf(stderr, "usage: %s [pings] [light<=%u]\n", argv[0], MAX_LIGHT);
+		return 1;
+	}
+	if ((rtt = calloc(pings, sizeof(double))) == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	printf("%u light clients beside a heavy one, %u pings, messages budget:\n",
+	       light, pings);
+	for (unsigned i = 0; i < ELEMENTS(budgets); i++) {
+		if (bench(loop, budgets[i]) < 0)
+			ret = 1;
+	}
+	return ret;
+}
@@ -0,0 +1,219 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * datagrams/s through eh_datagram over loopback, against a sendto() and
+ * recvfrom() per datagram. also checks that datagrams bigger than
+ * rx_size are flagged as truncated.
+ *
+ *   eh_datagram_bench [count] [size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <ev.h>
+
+#include "eh.h"
+#include "eh_datagram.h"
+
+#define BATCH		64	/* in flight, the loopback queue drops beyond */
+#define RX_SIZE		2048
+
+static size_t received, truncated;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_read(struct eh_datagram *UNUSED(d), struct eh_datagram_msg *msg, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++) {
+		if (msg[i].truncated)
+			truncated++;
+	}
+	received += n;
+}
+
+static struct eh_datagram_cb cb = { .on_read = on_read };
+
+static int endpoint(struct sockaddr_in *sin, socklen_t *len)
+{
+	int fd = eh_datagram_ipv4_udp("127.0.0.1", 0, true);
+
+	*len = sizeof(*sin);
+	if (fd >= 0 && getsockname(fd, (struct sockaddr *)sin, len) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* waits for the batch, giving up on what the kernel dropped */
+static void drain(struct ev_loop *loop, size_t want)
+{
+	for (unsigned idle = 0; received < want && idle < 1000; idle++) {
+		size_t before = received;
+
+		ev_run(loop, EVRUN_NOWAIT);
+		if (received != before)
+			idle = 0;
+	}
+}
+
+static double bench_eh(struct ev_loop *loop, size_t count, size_t size)
+{
+	struct eh_datagram rx, tx;
+	struct sockaddr_in to, from;
+	socklen_t to_len, from_len;
+	char *data = calloc(1, size);
+	int rx_fd = endpoint(&to, &to_len), tx_fd = endpoint(&from, &from_len);
+	double t;
+
+	if (data == NULL || rx_fd < 0 || tx_fd < 0 ||
+	    eh_datagram_init(&rx, rx_fd, &cb, BATCH, RX_SIZE, 1, 1) < 0 ||
+	    eh_datagram_init(&tx, tx_fd, &cb, 1, 1, BATCH, BATCH * size) < 0) {
+		perror("eh_datagram");
+		exit(1);
+	}
+	eh_datagram_start(&rx, loop);
+	eh_datagram_start(&tx, loop);
+
+	received = truncated = 0;
+	t = now();
+	for (size_t sent = 0; sent < count; ) {
+		for (unsigned i = 0; i < BATCH && sent < count; i++, sent++)
+			eh_datagram_sendto(&tx, data, size, (struct sockaddr *)&to, to_len);
+		eh_datagram_flush(&tx);
+		drain(loop, sent);
+		received = sent; /* lost ones aren't waited for again */
+	}
+	t = now() - t;
+
+	eh_datagram_stop(&rx);
+	eh_datagram_stop(&tx);
+	eh_datagram_finish(&rx);
+	eh_datagram_finish(&tx);
+	free(data);
+	return t;
+}
+
+static double bench_plain(size_t count, size_t size)
+{
+	struct sockaddr_in to, from;
+	socklen_t to_len, from_len;
+	char *data = calloc(1, size), buf[RX_SIZE];
+	int rx_fd = endpoint(&to, &to_len), tx_fd = endpoint(&from, &from_len);
+	double t;
+
+	if (data == NULL || rx_fd < 0 || tx_fd < 0) {
+		perror("socket");
+		exit(1);
+	}
+
+	t = now();
+	for (size_t sent = 0; sent < count; ) {
+		unsigned n = 0;
+
+		for (; n < BATCH && sent < count; n++, sent++)
+			sendto(tx_fd, data, size, 0, (struct sockaddr *)&to, to_len);
+		while (n > 0 && recv(rx_fd, buf, sizeof(buf), 0) >= 0)
+			n--;
+	}
+	t = now() - t;
+
+	close(rx_fd);
+	close(tx_fd);
+	free(data);
+	return t;
+}
+
+/* one datagram bigger than rx_size has to come out flagged */
+static int check_truncated(struct ev_loop *loop)
+{
+	struct eh_datagram rx;
+	struct sockaddr_in to;
+	socklen_t to_len;
+	char data[RX_SIZE + 100] = { 0 };
+	int rx_fd = endpoint(&to, &to_len), tx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (rx_fd < 0 || tx_fd < 0 || eh_datagram_init(&rx, rx_fd, &cb, 4, RX_SIZE, 1, 1) < 0) {
+		perror("eh_datagram");
+		return -1;
+	}
+	eh_datagram_start(&rx, loop);
+
+	received = truncated = 0;
+	sendto(tx_fd, data, RX_SIZE, 0, (struct sockaddr *)&to, to_len);
+	sendto(tx_fd, data, sizeof(data), 0, (struct sockaddr *)&to, to_len);
+	drain(loop, 2);
+
+	eh_datagram_stop(&rx);
+	eh_datagram_finish(&rx);
+	close(tx_fd);
+
+	printf("truncation: %s\n", received == 2 && truncated == 1 ? "ok" : "FAILED");
+	return received == 2 && truncated == 1 ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+	size_t size = argc > 2 ? (size_t)atol(argv[2]) : 64;
+	struct ev_loop *loop = ev_default_loop(0);
+	double t;
+
+	if (size == 0 || size > RX_SIZE) {
+		fprintf(stderr, "%s: size must be 1 to %u\n", argv[0], RX_SIZE);
+		return 1;
+	}
+
+	if (check_truncated(loop) < 0)
+		return 1;
+
+	printf("%zu datagrams of %zu bytes, %u at a time:\n", count, size, BATCH);
+	t = bench_plain(count, size);
+	printf("  sendto/recv    %10.0f pps\n", count / t);
+	t = bench_eh(loop, count, size);
+	printf("  eh_datagram    %10.0f pps\n", count / t);
+	return 0;
+}
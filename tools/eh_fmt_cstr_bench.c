@@ -0,0 +1,189 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * checks eh_fmt_cstr() against the byte at a time version it replaced,
+ * and compares their throughput on text-like and on binary data.
+ *
+ *   eh_fmt_cstr_bench [MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_fmt.h"
+
+#define hexa "0123456789abcdef"
+#define CEC "abtnvfr"
+
+static inline size_t ref_len(unsigned char c)
+{
+	if (c > 0x1f && c < 0x7f)
+		return (c == '"' || c == '\\') ? 2 : 1;
+	else if ((c >= '\a' && c <= '\r') || c == 0)
+		return 2;
+	return 4;
+}
+
+/* the scalar reference */
+static ssize_t ref_fmt_cstr(char *buf, size_t buf_size, const char *data, size_t data_size)
+{
+	size_t len = 0;
+	while (data_size-- > 0) {
+		unsigned char c = *data++;
+		size_t l = ref_len(c);
+
+		if (l > buf_size)
+			break;
+
+		switch (l) {
+		case 1:
+			*buf = c;
+			break;
+		case 2:
+			buf[0] = '\\';
+			if (c >= '\a' && c <= '\r')
+				c = CEC[c - '\a'];
+			else if (c == 0)
+				c = '0';
+			buf[1] = c;
+			break;
+		case 4:
+			buf[0] = '\\';
+			buf[1] = 'x';
+			buf[2] = hexa[(c & (0x0f << 4)) >> 4];
+			buf[3] = hexa[c & 0x0f];
+		}
+
+		buf_size -= l;
+		buf += l;
+		len += l;
+	}
+	return len;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* text protocol like, an escape now and then */
+static void fill_text(char *p, size_t n)
+{
+	static const char line[] = "GET /index.html HTTP/1.1\r\nHost: example.org\r\n"
+		"User-Agent: \"libeh\"\tbench\r\n\r\n";
+
+	for (size_t i = 0; i < n; i++)
+		p[i] = line[i % (sizeof(line) - 1)];
+}
+
+static void fill_binary(char *p, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		p[i] = rand();
+}
+
+static int check(void)
+{
+	char data[512], a[4 * 512], b[4 * 512];
+	unsigned fails = 0;
+
+	for (unsigned round = 0; round < 200000; round++) {
+		size_t n = rand() % sizeof(data), size = rand() % sizeof(a);
+		ssize_t la, lb;
+
+		if (round & 1)
+			fill_binary(data, n);
+		else
+			fill_text(data, n);
+		/* sprinkle specials over the text too */
+		for (unsigned k = rand() % 4; k > 0 && n > 0; k--)
+			data[rand() % n] = "\0\"\\\x7f\x80\x1f\n"[rand() % 7];
+
+		la = eh_fmt_cstr(a, size, data, n);
+		lb = ref_fmt_cstr(b, size, data, n);
+		if (la != lb || memcmp(a, b, la) != 0) {
+			if (fails++ < 10)
+				fprintf(stderr, "mismatch: n=%zu size=%zu got=%zd want=%zd\n",
+					n, size, la, lb);
+		}
+	}
+
+	printf("check: %s\n", fails ? "FAILED" : "ok");
+	return fails ? -1 : 0;
+}
+
+static void bench(const char *name, const char *data, size_t len, char *out,
+		  ssize_t (*f)(char *, size_t, const char *, size_t))
+{
+	size_t chunk = 4096, done = 0;
+	double t = now();
+
+	for (size_t off = 0; off < len; off += chunk)
+		done += f(out, 4 * chunk, data + off, len - off < chunk ? len - off : chunk);
+
+	t = now() - t;
+	printf("  %-8s %8.1f MB/s (%zu bytes out)\n", name, len / t / 1e6, done);
+}
+
+int main(int argc, char **argv)
+{
+	size_t len = (argc > 1 ? (size_t)atoi(argv[1]) : 64) << 20;
+	char *data = malloc(len), *out = malloc(4 * 4096);
+
+	if (data == NULL || out == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	if (check() < 0)
+		return 1;
+
+	fill_text(data, len);
+	printf("text:\n");
+	bench("scalar", data, len, out, ref_fmt_cstr);
+	bench("eh", data, len, out, eh_fmt_cstr);
+
+	fill_binary(data, len);
+	printf("binary:\n");
+	bench("scalar", data, len, out, ref_fmt_cstr);
+	bench("eh", data, len, out, eh_fmt_cstr);
+
+	free(data);
+	free(out);
+	return 0;
+}
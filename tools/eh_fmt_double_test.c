@@ -0,0 +1,217 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * round-trip test and benchmark of eh_fmt_double() and
+ * eh_fmt_double_fixed().
+ *
+ *   eh_fmt_double_test [step]
+ *
+ * every step-th float bit pattern, widened to double, has to read back
+ * through strtod() as the same value. step 1 makes it exhaustive, all
+ * 2^32 of them, which takes a while.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_fmt.h"
+
+#define RANDOM_ROUNDS	3000000
+
+static unsigned fails;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rand64(void)
+{
+	static uint64_t x = 88172645463325252ULL;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+
+static void fail(const char *what, double v, const char *got, const char *want)
+{
+	if (fails++ < 10)
+		fprintf(stderr, "%s: %.17g: got \"%s\", want \"%s\"\n", what, v, got, want);
+}
+
+static void roundtrip(double v)
+{
+	char buf[EH_FMT_DOUBLE_SIZE + 1];
+	double r;
+
+	buf[eh_fmt_double(buf, v)] = '\0';
+
+	if (isnan(v)) {
+		if (strcmp(buf, "nan") != 0)
+			fail("nan", v, buf, "nan");
+		return;
+	}
+
+	r = strtod(buf, NULL);
+	if (memcmp(&r, &v, sizeof(v)) != 0)
+		fail("roundtrip", v, buf, "same value");
+}
+
+static void fixed(double v, unsigned prec)
+{
+	char buf[EH_FMT_DOUBLE_SIZE + 1], want[EH_FMT_DOUBLE_SIZE + 1];
+
+	buf[eh_fmt_double_fixed(buf, v, prec)] = '\0';
+	snprintf(want, sizeof(want), "%.*f", (int)prec, v);
+	if (strcmp(buf, want) != 0)
+		fail("fixed", v, buf, want);
+}
+
+static double to_double(uint64_t bits)
+{
+	double v;
+	memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+/* halves and near halves, where scaling in double used to round wrong */
+static void check_fixed_ties(void)
+{
+	static const struct {
+		double v;
+		unsigned prec;
+	} ties[] = {
+		{ 0.05, 1 }, { 0.075, 2 }, { 0.0005, 3 }, { 0.15, 1 }, { 0.25, 1 },
+		{ 0.35, 1 }, { 0.125, 2 }, { 0.375, 2 }, { 0.5, 0 }, { 1.5, 0 },
+		{ 2.5, 0 }, { -2.5, 0 }, { 0.999, 2 }, { 9.9999999999, 9 },
+		{ 1e-300, 19 }, { 5e-324, 19 }, { 4.35, 1 }, { 1.005, 2 },
+		{ 9223372036854774784.0, 3 }, { -0.0, 2 }, { -0.001, 2 },
+		{ 0.1, 19 }, { 123456.654321, 5 },
+	};
+	char buf[EH_FMT_DOUBLE_SIZE + 1];
+
+	for (unsigned i = 0; i < ELEMENTS(ties); i++)
+		fixed(ties[i].v, ties[i].prec);
+
+	/* what doesn't fit is refused */
+	if (eh_fmt_double_fixed(buf, 1.0, 20) != 0)
+		fail("fixed prec 20", 1.0, "something", "nothing");
+	if (eh_fmt_double_fixed(buf, 9223372036854775808.0, 0) != 0)
+		fail("fixed 2^63", 9223372036854775808.0, "something", "nothing");
+
+	printf("fixed ties: %s\n", fails ? "FAILED" : "ok");
+}
+
+static void check_floats(uint64_t step)
+{
+	for (uint64_t bits = 0; bits <= UINT32_MAX; bits += step) {
+		uint32_t b = bits;
+		float f;
+
+		memcpy(&f, &b, sizeof(f));
+		roundtrip(f);
+	}
+	printf("floats, every %llu: %s\n", (unsigned long long)step,
+	       fails ? "FAILED" : "ok");
+}
+
+static void check_doubles(void)
+{
+	for (unsigned i = 0; i < RANDOM_ROUNDS; i++)
+		roundtrip(to_double(rand64()));
+	printf("random doubles: %s\n", fails ? "FAILED" : "ok");
+
+	/* every magnitude below 2^63, and every precision */
+	for (unsigned i = 0; i < RANDOM_ROUNDS; i++) {
+		double v = ldexp((double)(int64_t)(rand64() >> 11), (int)(rand64() % 140) - 130);
+		fixed(v, rand64() % 20);
+	}
+	printf("fixed against printf: %s\n", fails ? "FAILED" : "ok");
+}
+
+#define BENCH(NAME, EXPR)							\
+	do {									\
+		double t = now();						\
+		size_t n = 0;							\
+		for (unsigned i = 0; i < RANDOM_ROUNDS; i++)			\
+			n += (EXPR);						\
+		t = now() - t;							\
+		printf("  %-20s %6.1f ns (%zu bytes)\n", NAME,			\
+		       t * 1e9 / RANDOM_ROUNDS, n);				\
+	} while (0)
+
+static void bench(void)
+{
+	char buf[EH_FMT_DOUBLE_SIZE + 1];
+	double *v = malloc(RANDOM_ROUNDS * sizeof(*v));
+
+	if (v == NULL)
+		return;
+
+	for (unsigned i = 0; i < RANDOM_ROUNDS; i++)
+		v[i] = (double)(rand64() >> 11) / (1 << (rand64() % 30));
+
+	printf("per value:\n");
+	BENCH("eh_fmt_double", eh_fmt_double(buf, v[i]));
+	BENCH("%g", (size_t)snprintf(buf, sizeof(buf), "%g", v[i]));
+	BENCH("%.17g", (size_t)snprintf(buf, sizeof(buf), "%.17g", v[i]));
+	BENCH("eh_fmt_double_fixed", eh_fmt_double_fixed(buf, v[i] / 1e9, 3));
+	BENCH("%.3f", (size_t)snprintf(buf, sizeof(buf), "%.3f", v[i] / 1e9));
+
+	free(v);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t step = argc > 1 ? strtoull(argv[1], NULL, 0) : 251;
+
+	if (step == 0)
+		step = 1;
+
+	check_floats(step);
+	check_fixed_ties();
+	check_doubles();
+	if (fails)
+		return 1;
+
+	bench();
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * checks the eh_fmt integer family against printf() and compares its
+ * speed with snprintf() and with the division loop eh_fmt_unsigned()
+ * used to be.
+ *
+ *   eh_fmt_int_bench [millions of values]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_fmt.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+/* xorshift64, shifted so every length shows up */
+static uint64_t rnd(void)
+{
+	uint64_t x = rnd_state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	rnd_state = x;
+	return x >> (x % 64);
+}
+
+/* the division loop eh_fmt_unsigned() used to be */
+static size_t old_fmt_unsigned(char *buf, unsigned n)
+{
+	size_t l = eh_fmt_unsigned_len(n, 10);
+	char *p = buf+l;
+	for (; p>buf; n/=10)
+		*--p = n%10 + '0';
+	return l;
+}
+
+static bool same(const char *got, size_t l, const char *want)
+{
+	return l == strlen(want) && memcmp(got, want, l) == 0;
+}
+
+static int check(size_t count)
+{
+	char buf[32], want[32];
+	size_t bad = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		uint64_t n = rnd();
+		unsigned w = n % 24;
+
+		snprintf(want, sizeof(want), "%" PRIu64, n);
+		bad += !same(buf, eh_fmt_u64(buf, n), want) ||
+			eh_fmt_u64_len(n) != strlen(want);
+
+		snprintf(want, sizeof(want), "%" PRId64, (int64_t)n);
+		bad += !same(buf, eh_fmt_i64(buf, (int64_t)n), want) ||
+			eh_fmt_i64_len((int64_t)n) != strlen(want);
+
+		snprintf(want, sizeof(want), "%" PRIx64, n);
+		bad += !same(buf, eh_fmt_x64(buf, n), want) ||
+			eh_fmt_x64_len(n) != strlen(want);
+
+		snprintf(want, sizeof(want), "%0*" PRIu64, (int)w, n);
+		bad += !same(buf, eh_fmt_u64_pad(buf, n, w), want);
+
+		snprintf(want, sizeof(want), "%0*" PRIx64, (int)w, n);
+		bad += !same(buf, eh_fmt_x64_pad(buf, n, w), want);
+
+		snprintf(want, sizeof(want), "%u", (unsigned)n);
+		bad += !same(buf, eh_fmt_unsigned(buf, (unsigned)n), want);
+	}
+
+	printf("check: %s\n", bad == 0 ? "ok" : "FAILED");
+	return bad == 0 ? 0 : -1;
+}
+
+static volatile size_t sink;	/* keeps the results alive */
+
+#define BENCH(LABEL, EXPR)	do { \
+	size_t sum = 0; \
+	double t = now(); \
+	for (size_t i = 0; i < count; i++) { \
+		uint64_t n = v[i]; \
+		sum += (EXPR); \
+		buf[0] ^= (char)sum; \
+	} \
+	t = now() - t; \
+	sink += sum; \
+	printf("  %-22s %8.1f ns/value\n", LABEL, t * 1e9 / count); \
+} while (0)
+
+int main(int argc, char **argv)
+{
+	size_t count = (argc > 1 ? (size_t)atol(argv[1]) : 10) * 1000000;
+	uint64_t *v = malloc(count * sizeof(*v));
+	char buf[32];
+
+	if (count == 0 || v == NULL)
+		return 1;
+
+	if (check(count / 10 + 1) < 0)
+		return 1;
+
+	for (size_t i = 0; i < count; i++)
+		v[i] = rnd();
+
+	printf("%zu values of every length:\n", count);
+	BENCH("snprintf %u", (size_t)snprintf(buf, sizeof(buf), "%u", (unsigned)n));
+	BENCH("old eh_fmt_unsigned", old_fmt_unsigned(buf, (unsigned)n));
+	BENCH("eh_fmt_unsigned", eh_fmt_unsigned(buf, (unsigned)n));
+	BENCH("snprintf %llu", (size_t)snprintf(buf, sizeof(buf), "%" PRIu64, n));
+	BENCH("eh_fmt_u64", eh_fmt_u64(buf, n));
+	BENCH("eh_fmt_i64", eh_fmt_i64(buf, (int64_t)n));
+	BENCH("snprintf %llx", (size_t)snprintf(buf, sizeof(buf), "%" PRIx64, n));
+	BENCH("eh_fmt_x64", eh_fmt_x64(buf, n));
+	BENCH("snprintf %020llu", (size_t)snprintf(buf, sizeof(buf), "%020" PRIu64, n));
+	BENCH("eh_fmt_u64_pad", eh_fmt_u64_pad(buf, n, 20));
+
+	free(v);
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * frames/s of eh_frame_read() in each mode, fed through a read buffer
+ * the way eh_connection does. once with small frames handled in place,
+ * and once with frames bigger than the buffer, assembled on the heap.
+ *
+ *   eh_frame_bench [MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_frame.h"
+
+#define READ_BUFFER	(16 * 1024)
+#define MAX_FRAME	(1024 * 1024)
+
+struct mode {
+	const char *name;
+	enum eh_frame_mode mode;
+	unsigned header_size;
+	bool big_endian;
+};
+
+static const struct mode modes[] = {
+	{ "line", EH_FRAME_LINE, 0, false },
+	{ "length/4be", EH_FRAME_LENGTH, 4, true },
+	{ "length/2le", EH_FRAME_LENGTH, 2, false },
+	{ "varint", EH_FRAME_VARINT, 0, false },
+	{ "netstring", EH_FRAME_NETSTRING, 0, false },
+};
+
+static size_t frames, payload;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool on_frame(struct eh_frame *UNUSED(f), const char *UNUSED(data), size_t len)
+{
+	frames++;
+	payload += len;
+	return true;
+}
+
+/* one frame of n bytes of payload at p. Returns its encoded size */
+static size_t encode(const struct mode *m, char *p, size_t n)
+{
+	size_t h = 0;
+
+	switch (m->mode) {
+	case EH_FRAME_LINE:
+		break;
+	case EH_FRAME_LENGTH:
+		for (unsigned i = 0; i < m->header_size; i++) {
+			unsigned b = m->big_endian ? m->header_size - 1 - i : i;
+			p[b] = (uint64_t)n >> (8 * i);
+		}
+		h = m->header_size;
+		break;
+	case EH_FRAME_VARINT: {
+		uint64_t v = n;
+		do {
+			p[h++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+			v >>= 7;
+		} while (v);
+		break;
+	}
+	case EH_FRAME_NETSTRING:
+		h = sprintf(p, "%zu:", n);
+		break;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		p[h + i] = 'a' + i % 26;
+
+	if (m->mode == EH_FRAME_LINE) {
+		p[h + n] = '\r';
+		p[h + n + 1] = '\n';
+		return h + n + 2;
+	} else if (m->mode == EH_FRAME_NETSTRING) {
+		p[h + n] = ',';
+		return h + n + 1;
+	}
+	return h + n;
+}
+
+/* like eh_connection's read loop, refilling a fixed buffer */
+static int feed(struct eh_frame *f, const char *data, size_t len)
+{
+	static char buf[READ_BUFFER];
+	size_t pos = 0, fill = 0;
+
+	while (pos < len || fill > 0) {
+		size_t start = 0, n = len - pos;
+		ssize_t r = 0;
+
+		if (n > sizeof(buf) - fill)
+			n = sizeof(buf) - fill;
+		memcpy(buf + fill, data + pos, n);
+		pos += n;
+		fill += n;
+
+		while (start < fill && (r = eh_frame_read(f, buf + start, fill - start)) > 0)
+			start += r;
+		if (r < 0)
+			return -1;
+		if (start == 0 && n == 0)
+			return -1; /* stuck */
+
+		memmove(buf, buf + start, fill - start);
+		fill -= start;
+	}
+	return 0;
+}
+
+static int bench(const struct mode *m, char *data, size_t size, size_t min, size_t max)
+{
+	struct eh_frame_cb cb = { on_frame };
+	struct eh_frame f;
+	size_t len = 0, count = 0, bytes = 0;
+	double t;
+
+	srand(1);
+	for (;;) {
+		size_t n = min + rand() % (max - min + 1);
+
+		if (len + n + 32 > size)
+			break;
+		len += encode(m, data + len, n);
+		count++;
+		bytes += n;
+	}
+
+	eh_frame_init(&f, m->mode, &cb, READ_BUFFER, MAX_FRAME);
+	if (m->mode == EH_FRAME_LENGTH)
+		eh_frame_set_length(&f, m->header_size, m->big_endian);
+
+	frames = payload = 0;
+	t = now();
+	if (feed(&f, data, len) < 0) {
+		fprintf(stderr, "%s: failed after %zu frames: %s\n", m->name,
+			frames, strerror(errno));
+		return -1;
+	}
+	t = now() - t;
+	eh_frame_finish(&f);
+
+	if (frames != count || payload != bytes) {
+		fprintf(stderr, "%s: %zu/%zu frames, %zu/%zu bytes\n", m->name,
+			frames, count, payload, bytes);
+		return -1;
+	}
+
+	printf("  %-12s %10.0f frames/s %8.1f MB/s\n", m->name, count / t, len / t / 1e6);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t size = (argc > 1 ? (size_t)atoi(argv[1]) : 64) << 20;
+	char *data = malloc(size);
+	int ret = 0;
+
+	if (data == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	printf("small frames, 0 to 256 bytes:\n");
+	for (unsigned i = 0; i < ELEMENTS(modes); i++)
+		ret |= bench(&modes[i], data, size, 0, 256);
+
+	printf("big frames, 16K to 256K bytes:\n");
+	for (unsigned i = 0; i < ELEMENTS(modes); i++) {
+		/* 2 bytes can't hold their length */
+		if (modes[i].header_size != 2)
+			ret |= bench(&modes[i], data, size, READ_BUFFER, 256 * 1024);
+	}
+
+	free(data);
+	return ret ? 1 : 0;
+}
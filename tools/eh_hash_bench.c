@@ -0,0 +1,315 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * eh_hash against a linear eh_list scan and against the same chained
+ * table rehashing all at once when it doubles: average and worst single
+ * insert, lookups and deletes. every key is checked to be found, and
+ * gone once deleted.
+ *
+ *   eh_hash_bench [count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "eh.h"
+#include "eh_list.h"
+#include "eh_hash.h"
+
+/* what each lookup touches on one cache line, for both tables */
+struct item {
+	struct eh_hash_node node;
+	uint64_t key;
+
+	struct item *next;	/* of the non-incremental table */
+	uint32_t hash;
+
+	struct eh_list list;
+} __attribute__((aligned(64)));
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline uint32_t hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (uint32_t)key;
+}
+
+static bool match(const struct eh_hash_node *node, const void *data)
+{
+	const struct item *it = container_of(node, struct item, node);
+
+	return it->key == *(const uint64_t *)data;
+}
+
+static struct item *hash_find(struct eh_hash *h, uint64_t key)
+{
+	struct eh_hash_node *node = eh_hash_find(h, hash(key), match, &key);
+	return node ? container_of(node, struct item, node) : NULL;
+}
+
+static struct item *list_find(struct eh_list *l, uint64_t key)
+{
+	eh_list_foreach(l, i) {
+		struct item *it = container_of(i, struct item, list);
+		if (it->key == key)
+			return it;
+	}
+	return NULL;
+}
+
+/*
+ * the same table, rehashing every bucket at once when it doubles
+ */
+struct table {
+	struct item **buckets;
+	size_t size, count;
+};
+
+static void table_insert(struct table *t, struct item *it)
+{
+	struct item **b;
+
+	if (t->count >= t->size) {
+		size_t size = t->size * 2;
+		struct item **buckets = calloc(size, sizeof(*buckets));
+
+		for (size_t i = 0; i < t->size; i++) {
+			for (struct item *p = t->buckets[i], *next; p; p = next) {
+				next = p->next;
+				p->next = buckets[p->hash & (size - 1)];
+				buckets[p->hash & (size - 1)] = p;
+			}
+		}
+		free(t->buckets);
+		t->buckets = buckets;
+		t->size = size;
+	}
+
+	it->hash = hash(it->key);
+	b = &t->buckets[it->hash & (t->size - 1)];
+	it->next = *b;
+	*b = it;
+	t->count++;
+}
+
+static struct item *table_find(struct table *t, uint64_t key)
+{
+	uint32_t h = hash(key);
+
+	for (struct item *p = t->buckets[h & (t->size - 1)]; p; p = p->next) {
+		if (p->hash == h && p->key == key)
+			return p;
+	}
+	return NULL;
+}
+
+static void table_del(struct table *t, struct item *it)
+{
+	for (struct item **p = &t->buckets[it->hash & (t->size - 1)]; *p; p = &(*p)->next) {
+		if (*p == it) {
+			*p = it->next;
+			t->count--;
+			return;
+		}
+	}
+}
+
+static struct item *items;
+static uint64_t *order;		/* keys, shuffled */
+static size_t count;
+static bool ok = true;
+
+static void report(const char *label, double t, size_t n, double worst)
+{
+	printf("  %-26s %8.1f ns/op", label, t / n * 1e9);
+	if (worst > 0)
+		printf("   worst %8.1f us", worst * 1e6);
+	printf("\n");
+}
+
+static void bench_hash(void)
+{
+	struct eh_hash h;
+	double t, worst = 0, total = 0;
+
+	eh_hash_init(&h, 0);
+	for (size_t i = 0; i < count; i++) {
+		t = now();
+		eh_hash_insert(&h, &items[i].node, hash(items[i].key));
+		t = now() - t;
+		total += t;
+		if (t > worst)
+			worst = t;
+	}
+	report("eh_hash insert", total, count, worst);
+
+	t = now();
+	for (size_t i = 0; i < count; i++) {
+		if (hash_find(&h, order[i]) == NULL)
+			ok = false;
+	}
+	report("eh_hash find", now() - t, count, 0);
+
+	t = now();
+	for (size_t i = 0; i < count; i++) {
+		if (hash_find(&h, order[i] + count) != NULL)
+			ok = false;
+	}
+	report("eh_hash miss", now() - t, count, 0);
+
+	t = now();
+	for (size_t i = 0; i < count; i++)
+		eh_hash_del(&h, &hash_find(&h, order[i])->node);
+	report("eh_hash find+del", now() - t, count, 0);
+
+	if (eh_hash_count(&h) != 0 || hash_find(&h, order[0]) != NULL)
+		ok = false;
+	eh_hash_finish(&h);
+}
+
+static void bench_table(void)
+{
+	struct table tb = { calloc(16, sizeof(struct item *)), 16, 0 };
+	double t, worst = 0, total = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		t = now();
+		table_insert(&tb, &items[i]);
+		t = now() - t;
+		total += t;
+		if (t > worst)
+			worst = t;
+	}
+	report("all at once insert", total, count, worst);
+
+	t = now();
+	for (size_t i = 0; i < count; i++) {
+		if (table_find(&tb, order[i]) == NULL)
+			ok = false;
+	}
+	report("all at once find", now() - t, count, 0);
+
+	t = now();
+	for (size_t i = 0; i < count; i++)
+		table_del(&tb, table_find(&tb, order[i]));
+	report("all at once find+del", now() - t, count, 0);
+
+	if (tb.count != 0)
+		ok = false;
+	free(tb.buckets);
+}
+
+/* a scan is O(n), so sizes where one is still used */
+static void bench_small(size_t n)
+{
+	struct eh_list l;
+	struct eh_hash h;
+	size_t lookups = 1000000;
+	char label[32];
+	double t;
+
+	eh_list_init(&l);
+	eh_hash_init(&h, 0);
+	for (size_t i = 0; i < n; i++) {
+		eh_list_append(&l, &items[i].list);
+		eh_hash_insert(&h, &items[i].node, hash(items[i].key));
+	}
+
+	if (n > 1000)
+		lookups = 100000;
+
+	snprintf(label, sizeof(label), "eh_list find, %zu", n);
+	t = now();
+	for (size_t i = 0; i < lookups; i++) {
+		if (list_find(&l, items[i % n].key) == NULL)
+			ok = false;
+	}
+	report(label, now() - t, lookups, 0);
+
+	snprintf(label, sizeof(label), "eh_hash find, %zu", n);
+	t = now();
+	for (size_t i = 0; i < lookups; i++) {
+		if (hash_find(&h, items[i % n].key) == NULL)
+			ok = false;
+	}
+	report(label, now() - t, lookups, 0);
+
+	eh_hash_finish(&h);
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t small[] = { 8, 64, 1000, 10000 };
+
+	count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+	if (count < 10000) {
+		fprintf(stderr, "usage: %s [count>=10000]\n", argv[0]);
+		return 1;
+	}
+
+	items = calloc(count, sizeof(*items));
+	order = calloc(count, sizeof(*order));
+	if (items == NULL || order == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	srand(1);
+	for (size_t i = 0; i < count; i++)
+		items[i].key = order[i] = i;
+	for (size_t i = count - 1; i > 0; i--) {
+		size_t j = ((size_t)rand() * RAND_MAX + rand()) % (i + 1);
+		uint64_t k = order[i];
+
+		order[i] = order[j];
+		order[j] = k;
+	}
+
+	printf("%zu keys\n", count);
+	bench_hash();
+	bench_table();
+	for (unsigned i = 0; i < ELEMENTS(small); i++)
+		bench_small(small[i]);
+
+	printf("check: %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,221 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * eh_heap at 1M nodes: insert, cancel of random ones and pop of the
+ * rest, checked to come out in order. the same deadlines as 1M ev_timer
+ * watchers, and through eh_heap_timer until they all expire.
+ *
+ *   eh_heap_bench [count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <ev.h>
+
+#include "eh.h"
+#include "eh_watcher.h"
+#include "eh_heap.h"
+
+struct item {
+	struct eh_heap_node node;
+	ev_timer timer;
+	double key;
+	bool cancelled, expired;
+};
+
+static struct item *items;
+static size_t *victims;		/* half of the items, shuffled */
+static size_t count;
+static bool ok = true;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *label, double t, size_t n)
+{
+	printf("  %-24s %8.1f ns/op\n", label, t / n * 1e9);
+}
+
+static void bench_heap(void)
+{
+	struct eh_heap h;
+	double t, last = -1;
+	size_t popped = 0;
+
+	eh_heap_init(&h, 0);
+	for (size_t i = 0; i < count; i++)
+		eh_heap_node_init(&items[i].node);
+
+	t = now();
+	for (size_t i = 0; i < count; i++)
+		eh_heap_insert(&h, &items[i].node, items[i].key);
+	report("eh_heap insert", now() - t, count);
+
+	t = now();
+	for (size_t i = 0; i < count / 2; i++)
+		eh_heap_del(&h, &items[victims[i]].node);
+	report("eh_heap cancel", now() - t, count / 2);
+
+	t = now();
+	for (struct eh_heap_node *n; (n = eh_heap_pop(&h)) != NULL; popped++) {
+		struct item *it = container_of(n, struct item, node);
+
+		if (it->key < last || it->cancelled)
+			ok = false;
+		last = it->key;
+	}
+	report("eh_heap pop", now() - t, popped);
+
+	if (popped != count - count / 2)
+		ok = false;
+	eh_heap_finish(&h);
+}
+
+static void timer_cb(struct ev_loop *UNUSED(loop), ev_timer *UNUSED(w), int UNUSED(revents))
+{
+}
+
+/* a watcher per deadline, what eh_heap_timer saves */
+static void bench_ev_timer(struct ev_loop *loop)
+{
+	double t;
+
+	for (size_t i = 0; i < count; i++)
+		eh_timer_init(&items[i].timer, timer_cb, &items[i], 1000 + items[i].key, 0.);
+
+	t = now();
+	for (size_t i = 0; i < count; i++)
+		eh_timer_start(&items[i].timer, loop);
+	report("ev_timer start", now() - t, count);
+
+	t = now();
+	for (size_t i = 0; i < count / 2; i++)
+		eh_timer_stop(&items[victims[i]].timer, loop);
+	report("ev_timer stop", now() - t, count / 2);
+
+	for (size_t i = 0; i < count; i++) {
+		if (eh_timer_active(&items[i].timer))
+			eh_timer_stop(&items[i].timer, loop);
+	}
+}
+
+static size_t expired;
+
+static void on_expire(struct eh_heap_timer *UNUSED(q), struct eh_heap_node *n)
+{
+	struct item *it = container_of(n, struct item, node);
+
+	if (it->cancelled || it->expired)
+		ok = false;
+	it->expired = true;
+	expired++;
+}
+
+static void bench_heap_timer(struct ev_loop *loop)
+{
+	struct eh_heap_timer q;
+	double t;
+
+	eh_heap_timer_init(&q, loop, on_expire, 0);
+	for (size_t i = 0; i < count; i++)
+		eh_heap_node_init(&items[i].node);
+
+	ev_now_update(loop);
+	t = now();
+	for (size_t i = 0; i < count; i++)
+		eh_heap_timer_add(&q, &items[i].node, items[i].key / 100);
+	report("eh_heap_timer add", now() - t, count);
+
+	t = now();
+	for (size_t i = 0; i < count / 2; i++)
+		eh_heap_timer_cancel(&q, &items[victims[i]].node);
+	report("eh_heap_timer cancel", now() - t, count / 2);
+
+	t = now();
+	while (expired < count - count / 2 && eh_heap_top(&q.heap) != NULL)
+		ev_run(loop, EVRUN_ONCE);
+	t = now() - t;
+	printf("  %-24s %8.1f ns/op, %.3fs for deadlines over 10ms\n",
+	       "eh_heap_timer expire", t / expired * 1e9, t);
+
+	if (expired != count - count / 2)
+		ok = false;
+	eh_heap_timer_finish(&q);
+}
+
+int main(int argc, char **argv)
+{
+	struct ev_loop *loop = ev_default_loop(0);
+
+	count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+	if (count < 2) {
+		fprintf(stderr, "usage: %s [count]\n", argv[0]);
+		return 1;
+	}
+
+	items = calloc(count, sizeof(*items));
+	victims = calloc(count, sizeof(*victims));
+	if (items == NULL || victims == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	/* keys in [0, 1), cancelled ones picked at random */
+	srand(1);
+	for (size_t i = 0; i < count; i++) {
+		items[i].key = (double)rand() / RAND_MAX;
+		victims[i] = i;
+	}
+	for (size_t i = count - 1; i > 0; i--) {
+		size_t j = ((size_t)rand() * RAND_MAX + rand()) % (i + 1), k = victims[i];
+
+		victims[i] = victims[j];
+		victims[j] = k;
+	}
+	for (size_t i = 0; i < count / 2; i++)
+		items[victims[i]].cancelled = true;
+
+	printf("%zu nodes, %zu cancelled\n", count, count / 2);
+	bench_heap();
+	bench_ev_timer(loop);
+	bench_heap_timer(loop);
+
+	printf("check: %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
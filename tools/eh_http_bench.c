@@ -0,0 +1,361 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * requests/s of eh_http_parse() against a plain byte at a time parser,
+ * the kind every service used to write in its on_read(), over the same
+ * stream of pipelined requests. also checks the samples split at every
+ * byte, and how Connection lists decide persistence.
+ *
+ *   eh_http_bench [MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_http.h"
+
+#define MAX_HEADERS	32
+
+static const char *const samples[] = {
+	"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n",
+
+	"GET /static/js/app.min.js?v=1.2.3 HTTP/1.1\r\n"
+	"Host: www.example.org\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+	"Accept: */*\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Referer: https://www.example.org/index.html\r\n"
+	"Connection: keep-alive\r\n"
+	"Cookie: session=4f1c2a9e8b7d6c5a; theme=dark; lang=en\r\n"
+	"Sec-Fetch-Dest: script\r\n"
+	"Sec-Fetch-Mode: no-cors\r\n"
+	"Sec-Fetch-Site: same-origin\r\n"
+	"\r\n",
+
+	"POST /api/v1/items HTTP/1.1\r\n"
+	"Host: api.example.org\r\n"
+	"Content-Type: application/json\r\n"
+	"Content-Length: 27\r\n"
+	"\r\n"
+	"{\"name\":\"foo\",\"count\":1234}",
+
+	"POST /upload HTTP/1.1\r\n"
+	"Host: api.example.org\r\n"
+	"Transfer-Encoding: chunked\r\n"
+	"\r\n"
+	"10\r\n0123456789abcdef\r\n"
+	"5\r\nhello\r\n"
+	"0\r\n\r\n",
+};
+
+struct totals {
+	size_t requests;
+	size_t headers;
+	size_t body;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * reference, one whole request per call
+ */
+static size_t ref_line(const char *p, const char *end)
+{
+	const char *s = p;
+
+	while (p + 1 < end) {
+		if (p[0] == '\r' && p[1] == '\n')
+			return p - s;
+		p++;
+	}
+	return SIZE_MAX;
+}
+
+static ssize_t ref_parse(struct totals *t, const char *data, size_t len)
+{
+	const char *p = data, *end = data + len;
+	uint64_t content_length = 0;
+	bool chunked = false;
+	size_t l, i;
+
+	/* request line */
+	if ((l = ref_line(p, end)) == SIZE_MAX)
+		return 0;
+	for (i = 0; i < l && p[i] != ' '; i++)
+		;
+	if (i == 0 || i == l)
+		goto bad;
+	p += l + 2;
+
+	/* headers */
+	for (;;) {
+		const char *v;
+
+		if ((l = ref_line(p, end)) == SIZE_MAX)
+			return 0;
+		if (l == 0)
+			break;
+
+		for (i = 0; i < l && p[i] != ':'; i++)
+			;
+		if (i == 0 || i == l)
+			goto bad;
+		for (v = p + i + 1; *v == ' ' || *v == '\t'; v++)
+			;
+
+		if (i == 14 && strncasecmp(p, "Content-Length", 14) == 0)
+			content_length = strtoull(v, NULL, 10);
+		else if (i == 17 && strncasecmp(p, "Transfer-Encoding", 17) == 0)
+			chunked = (strncasecmp(v, "chunked", 7) == 0);
+
+		t->headers++;
+		p += l + 2;
+	}
+	p += 2;
+
+	/* body */
+	if (chunked) {
+		for (;;) {
+			uint64_t n;
+			char *e;
+
+			if ((l = ref_line(p, end)) == SIZE_MAX)
+				return 0;
+			n = strtoull(p, &e, 16);
+			if (e == p)
+				goto bad;
+			p += l + 2;
+			if ((uint64_t)(end - p) < n + 2)
+				return 0;
+			t->body += n;
+			p += n + 2;
+			if (n == 0)
+				break;
+		}
+	} else {
+		if ((uint64_t)(end - p) < content_length)
+			return 0;
+		t->body += content_length;
+		p += content_length;
+	}
+
+	t->requests++;
+	return p - data;
+bad:
+	errno = EBADMSG;
+	return -1;
+}
+
+/*
+ * eh_http
+ */
+static struct totals eh_totals;
+
+static bool on_request(struct eh_http_parser *UNUSED(p), struct eh_http_request *req)
+{
+	eh_totals.headers += req->headers_count;
+	return true;
+}
+
+static bool on_body(struct eh_http_parser *UNUSED(p), const char *UNUSED(data), size_t len)
+{
+	eh_totals.body += len;
+	return true;
+}
+
+static bool on_complete(struct eh_http_parser *UNUSED(p))
+{
+	eh_totals.requests++;
+	return true;
+}
+
+static ssize_t eh_parse(struct eh_http_parser *parser, const char *data, size_t len)
+{
+	size_t off = 0;
+
+	while (off < len) {
+		ssize_t r = eh_http_parse(parser, data + off, len - off);
+		if (r <= 0)
+			return off ? (ssize_t)off : r;
+		off += r;
+	}
+	return off;
+}
+
+/* eh_http_parse() as on_read() would call it, with len bytes so far */
+static ssize_t eh_parse_upto(struct eh_http_parser *parser, const char *data,
+			     size_t len, size_t *off)
+{
+	ssize_t r = eh_parse(parser, data + *off, len - *off);
+
+	if (r > 0)
+		*off += r;
+	return r;
+}
+
+static bool keep_alive;
+
+static bool on_request_persist(struct eh_http_parser *UNUSED(p), struct eh_http_request *req)
+{
+	keep_alive = req->keep_alive;
+	return true;
+}
+
+static int check(void)
+{
+	struct eh_http_parser_cb cb = { on_request, on_body, on_complete };
+	struct eh_http_parser_cb persist_cb = { .on_request = on_request_persist };
+	struct eh_http_header headers[MAX_HEADERS];
+	struct eh_http_parser parser;
+	static const struct {
+		const char *head;
+		bool keep_alive;
+	} persist[] = {
+		{ "GET / HTTP/1.1\r\nConnection: TE, close\r\n\r\n", false },
+		{ "GET / HTTP/1.1\r\nConnection: close ,TE\r\n\r\n", false },
+		{ "GET / HTTP/1.1\r\nConnection: keep-alive, close\r\n\r\n", false },
+		{ "GET / HTTP/1.1\r\nConnection: closed\r\n\r\n", true },
+		{ "GET / HTTP/1.0\r\nConnection: TE,Keep-Alive\r\n\r\n", true },
+		{ "GET / HTTP/1.0\r\n\r\n", false },
+	};
+	bool ok = true;
+
+	/* every sample, split at every byte, comes out the same */
+	for (unsigned i = 0; i < ELEMENTS(samples); i++) {
+		const char *s = samples[i];
+		size_t len = strlen(s);
+
+		for (size_t at = 1; at < len; at++) {
+			size_t off = 0;
+
+			eh_totals = (struct totals) { 0, 0, 0 };
+			eh_http_parser_init(&parser, &cb, headers, ELEMENTS(headers));
+			if (eh_parse_upto(&parser, s, at, &off) < 0 ||
+			    eh_parse_upto(&parser, s, len, &off) < 0 || off != len ||
+			    eh_totals.requests != 1)
+				ok = false;
+		}
+	}
+
+	for (unsigned i = 0; i < ELEMENTS(persist); i++) {
+		eh_http_parser_init(&parser, &persist_cb, headers, ELEMENTS(headers));
+		keep_alive = !persist[i].keep_alive;
+		if (eh_http_parse(&parser, persist[i].head, strlen(persist[i].head)) <= 0 ||
+		    keep_alive != persist[i].keep_alive)
+			ok = false;
+	}
+
+	printf("check: %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : -1;
+}
+
+/* best of ROUNDS, the machine is rarely quiet */
+#define ROUNDS	5
+
+int main(int argc, char **argv)
+{
+	size_t size = (argc > 1 ? (size_t)atoi(argv[1]) : 64) << 20, len = 0;
+	struct eh_http_parser_cb cb = { on_request, on_body, on_complete };
+	struct eh_http_header headers[MAX_HEADERS];
+	struct eh_http_parser parser;
+	struct totals ref;
+	char *data = malloc(size);
+	double t_ref = 1e9, t_eh = 1e9, t;
+	ssize_t r;
+
+	if (data == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	if (check() < 0)
+		return 1;
+
+	/* one stream of pipelined requests, the samples in turn */
+	for (unsigned i = 0;; i++) {
+		const char *s = samples[i % ELEMENTS(samples)];
+		size_t l = strlen(s);
+
+		if (len + l > size)
+			break;
+		memcpy(data + len, s, l);
+		len += l;
+	}
+
+	for (unsigned round = 0; round < ROUNDS; round++) {
+		ref = (struct totals) { 0, 0, 0 };
+		t = now();
+		for (size_t off = 0; off < len; off += r) {
+			if ((r = ref_parse(&ref, data + off, len - off)) <= 0) {
+				fprintf(stderr, "reference: stopped at %zu\n", off);
+				return 1;
+			}
+		}
+		if ((t = now() - t) < t_ref)
+			t_ref = t;
+
+		eh_totals = (struct totals) { 0, 0, 0 };
+		eh_http_parser_init(&parser, &cb, headers, ELEMENTS(headers));
+		t = now();
+		r = eh_parse(&parser, data, len);
+		if ((t = now() - t) < t_eh)
+			t_eh = t;
+
+		if (r != (ssize_t)len || memcmp(&ref, &eh_totals, sizeof(ref)) != 0) {
+			fprintf(stderr, "mismatch: %zd of %zu, %zu/%zu requests, "
+				"%zu/%zu headers, %zu/%zu body bytes\n", r, len,
+				eh_totals.requests, ref.requests, eh_totals.headers,
+				ref.headers, eh_totals.body, ref.body);
+			return 1;
+		}
+	}
+
+	printf("%zu requests, %zu bytes\n", ref.requests, len);
+	printf("  reference %10.0f req/s %8.1f MB/s\n", ref.requests / t_ref, len / t_ref / 1e6);
+	printf("  eh_http   %10.0f req/s %8.1f MB/s\n", ref.requests / t_eh, len / t_eh / 1e6);
+
+	free(data);
+	return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * eh_hub with 1k topics and 100k subscribers, spread over socketpair
+ * connections as the descriptor limit allows. times subscribing, one
+ * publish to every topic and its flush, and unsubscribing, and reports
+ * the memory per subscription. first checks that a subscriber over
+ * max_pending publishing to its own topic from on_read() is closed
+ * after its callbacks, not in the middle of them.
+ *
+ *   eh_hub_bench [topics] [subscribers] [connections] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <malloc.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include <ev.h>
+
+#include "eh.h"
+#include "eh_list.h"
+#include "eh_hash.h"
+#include "eh_payload.h"
+#include "eh_connection.h"
+#include "eh_hub.h"
+
+#define MSG	"a message to every subscriber of the topic\n"
+
+static struct eh_hub hub;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int topic_name(char *buf, unsigned i)
+{
+	return sprintf(buf, "topic/%u", i);
+}
+
+/*
+ * a client subscribed to what it publishes, closed from its on_read()
+ */
+struct client {
+	struct eh_connection c;
+	struct eh_hub_subscriber sub;
+	bool closed, in_read;
+	bool closed_in_read;
+
+	char rbuf[256];
+	char wbuf[256];
+};
+
+static ssize_t echo_read(struct eh_connection *c, char *data, size_t len)
+{
+	struct client *self = container_of(c, struct client, c);
+
+	self->in_read = true;
+	/* over max_pending, the publish closes this very connection */
+	eh_connection_write(c, "x", 1);
+	eh_hub_publish_data(&hub, "echo", 4, data, len);
+	eh_hub_publish_data(&hub, "echo", 4, data, len);
+	self->in_read = false;
+	return len;
+}
+
+static void echo_close(struct eh_connection *c)
+{
+	struct client *self = container_of(c, struct client, c);
+
+	self->closed = true;
+	self->closed_in_read = self->in_read;
+	eh_hub_unsubscribe_all(&hub, &self->sub);
+}
+
+static struct eh_connection_cb echo_cb = { .on_read = echo_read, .on_close = echo_close };
+
+static int check(struct ev_loop *loop)
+{
+	static struct client client;
+	int sv[2];
+	bool ok;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return -1;
+	fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+	eh_connection_init(&client.c, sv[0], &echo_cb, client.rbuf, sizeof(client.rbuf),
+			   client.wbuf, sizeof(client.wbuf));
+	eh_hub_subscriber_init(&client.sub, &client.c, 1, EH_HUB_DISCONNECT);
+	eh_hub_subscribe(&hub, &client.sub, "echo", 4);
+	eh_connection_start(&client.c, loop);
+
+	if (write(sv[1], "hello\n", 6) != 6)
+		return -1;
+	for (int i = 0; i < 100 && !client.closed; i++)
+		ev_run(loop, EVRUN_NOWAIT);
+	close(sv[1]);
+
+	ok = client.closed && !client.closed_in_read && client.sub.dropped > 0 &&
+		eh_hub_subscribers(&hub, "echo", 4) == 0;
+	printf("check: %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : -1;
+}
+
+/*
+ * load
+ */
+struct conn {
+	struct eh_connection c;
+	int peer;
+	char rbuf[16];
+	char wbuf[16];
+};
+
+static void on_close(struct eh_connection *UNUSED(c))
+{
+}
+
+static struct eh_connection_cb cb = { .on_close = on_close };
+
+static struct conn *conns;
+static struct eh_hub_subscriber *subs;
+static unsigned topics, subscribers, connections;
+
+static bool pending(void)
+{
+	for (unsigned i = 0; i < connections; i++) {
+		if (eh_connection_pending(&conns[i].c) > 0)
+			return true;
+	}
+	return false;
+}
+
+/* every connection got its share of messages */
+static bool drain(size_t per_conn)
+{
+	static char buf[1 << 16];
+	bool ok = true;
+
+	for (unsigned i = 0; i < connections; i++) {
+		size_t want = per_conn * (sizeof(MSG) - 1), got = 0;
+
+		while (got < want) {
+			size_t n = want - got < sizeof(buf) ? want - got : sizeof(buf);
+			ssize_t l = read(conns[i].peer, buf, n);
+
+			if (l <= 0)
+				return false;
+			got += l;
+		}
+		if (memcmp(buf, MSG, sizeof(MSG) - 1) != 0)
+			ok = false;
+	}
+	return ok;
+}
+
+static int bench(struct ev_loop *loop, unsigned rounds)
+{
+	size_t before = mallinfo2().uordblks, reached = 0;
+	double sub_t, pub_t = 0, flush_t = 0, unsub_t;
+	char name[32];
+	bool ok = true;
+	double t = now();
+
+	/* subscriber i, on connection i % connections, to topic i % topics */
+	for (unsigned i = 0; i < subscribers; i++) {
+		eh_hub_subscriber_init(&subs[i], &conns[i % connections].c, 0, EH_HUB_DROP);
+		if (eh_hub_subscribe(&hub, &subs[i], name, topic_name(name, i % topics)) != 1)
+			ok = false;
+	}
+	sub_t = now() - t;
+
+	printf("  subscribe    %8.0f ns/subscriber  %6zu bytes/subscription\n",
+	       sub_t / subscribers * 1e9,
+	       (mallinfo2().uordblks - before) / subscribers);
+
+	for (unsigned r = 0; r < rounds; r++) {
+		struct eh_payload *p = eh_payload_new(MSG, sizeof(MSG) - 1);
+
+		if (p == NULL)
+			return -1;
+
+		t = now();
+		for (unsigned i = 0; i < topics; i++)
+			reached += eh_hub_publish(&hub, name, topic_name(name, i), p);
+		pub_t += now() - t;
+		eh_payload_put(p);
+
+		t = now();
+		do {
+			ev_run(loop, EVRUN_NOWAIT);
+		} while (pending());
+		flush_t += now() - t;
+
+		if (!drain((subscribers + connections - 1) / connections))
+			ok = false;
+	}
+
+	printf("  publish      %8.0f us/round  %6.0f ns/delivery\n",
+	       pub_t / rounds * 1e6, pub_t / reached * 1e9);
+	printf("  flush        %8.0f us/round  %6.0f ns/delivery\n",
+	       flush_t / rounds * 1e6, flush_t / reached * 1e9);
+
+	t = now();
+	for (unsigned i = 0; i < subscribers; i++)
+		eh_hub_unsubscribe_all(&hub, &subs[i]);
+	unsub_t = now() - t;
+	printf("  unsubscribe  %8.0f ns/subscriber\n", unsub_t / subscribers * 1e9);
+
+	if (reached != (size_t)subscribers * rounds)
+		ok = false;
+	return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	struct ev_loop *loop = ev_default_loop(0);
+	struct rlimit rl;
+	unsigned rounds;
+	int ret = 0;
+
+	topics = argc > 1 ? (unsigned)atoi(argv[1]) : 1000;
+	subscribers = argc > 2 ? (unsigned)atoi(argv[2]) : 100000;
+	connections = argc > 3 ? (unsigned)atoi(argv[3]) : 5000;
+	rounds = argc > 4 ? (unsigned)atoi(argv[4]) : 10;
+	if (topics == 0 || connections == 0 || subscribers % connections != 0 ||
+	    subscribers < topics || rounds == 0) {
+		fprintf(stderr, "usage: %s [topics] [subscribers] [connections] [rounds]\n"
+			"  subscribers a multiple of connections, and no fewer than topics\n",
+			argv[0]);
+		return 1;
+	}
+
+	/* two descriptors per connection */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	if (eh_hub_init(&hub, topics) < 0 || check(loop) < 0)
+		return 1;
+
+	conns = calloc(connections, sizeof(*conns));
+	subs = calloc(subscribers, sizeof(*subs));
+	if (conns == NULL || subs == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	for (unsigned i = 0; i < connections; i++) {
+		int sv[2];
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+			fprintf(stderr, "%s: connection %u: %s\n", argv[0], i, strerror(errno));
+			return 1;
+		}
+		fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+		conns[i].peer = sv[1];
+		eh_connection_init(&conns[i].c, sv[0], &cb, conns[i].rbuf, sizeof(conns[i].rbuf),
+				   conns[i].wbuf, sizeof(conns[i].wbuf));
+		eh_connection_start(&conns[i].c, loop);
+	}
+
+	printf("%u topics, %u subscribers on %u connections, %u rounds\n",
+	       topics, subscribers, connections, rounds);
+	ret = bench(loop, rounds);
+
+	eh_hub_finish(&hub);
+	printf("delivery: %s\n", ret == 0 ? "ok" : "FAILED");
+	return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,338 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * event loop latency while logging into a slow pipe, with eh_log_stderr()
+ * writing from the loop and with eh_log_async() writing from a thread.
+ * a consumer thread reads the pipe at a throttled rate.
+ * then lines/s into /dev/null with the stderr prefixes, against the
+ * gettimeofday() and snprintf() formatting they replaced, and lines/s
+ * into a file with eh_log_file() against eh_log_stderr(), with printf
+ * style lines formatted aside or in place. also checks that a segment
+ * the disk can't hold fails eh_log_file_init().
+ *
+ *   eh_log_bench [iterations] [lines per iteration] [lines]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <ev.h>
+
+#include "eh.h"
+#include "eh_list.h"
+#include "eh_log.h"
+#include "eh_watcher.h"
+
+#define CONSUMER_CHUNK	4096	/* read every CONSUMER_SLEEP us, ~4MB/s */
+#define CONSUMER_SLEEP	1000
+
+static int pipe_fd[2];
+static bool consumer_stop;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *consumer(void *UNUSED(arg))
+{
+	char buf[CONSUMER_CHUNK];
+
+	while (!__atomic_load_n(&consumer_stop, __ATOMIC_RELAXED)) {
+		if (read(pipe_fd[0], buf, sizeof(buf)) < 0 && errno != EINTR)
+			break;
+		usleep(CONSUMER_SLEEP);
+	}
+	return NULL;
+}
+
+/* lets the consumer catch up between runs */
+static void drain(void)
+{
+	int n;
+
+	while (ioctl(pipe_fd[0], FIONREAD, &n) == 0 && n > 0)
+		usleep(10000);
+}
+
+static struct {
+	double *lat;
+	unsigned iterations, lines, done;
+	double last;
+} run;
+
+static void on_idle(struct ev_loop *loop, ev_idle *UNUSED(w), int UNUSED(revents))
+{
+	double t = now();
+
+	if (run.done > 0)
+		run.lat[run.done - 1] = t - run.last;
+
+	if (run.done++ == run.iterations) {
+		ev_break(loop, EVBREAK_ALL);
+		return;
+	}
+
+	for (unsigned i = 0; i < run.lines; i++)
+		eh_logf(NULL, EH_LOG_INFO, 0, "iteration %u line %u of the latency benchmark",
+			run.done, i);
+	run.last = t;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void bench(struct ev_loop *loop, const char *label)
+{
+	ev_idle idle;
+	double t;
+
+	run.done = 0;
+	eh_idle_init(&idle, on_idle, NULL);
+	eh_idle_start(&idle, loop);
+	t = now();
+	ev_run(loop, 0);
+	t = now() - t;
+	eh_idle_stop(&idle, loop);
+
+	qsort(run.lat, run.iterations, sizeof(double), cmp);
+	printf("  %-12s %8.1f us p50 %8.1f us p99 %8.1f us max %6.2f s total\n", label,
+	       run.lat[run.iterations / 2] * 1e6,
+	       run.lat[run.iterations * 99 / 100] * 1e6,
+	       run.lat[run.iterations - 1] * 1e6, t);
+}
+
+static void bench_async(struct ev_loop *loop, const char *label,
+			enum eh_log_async_policy policy)
+{
+	if (eh_log_async_init(pipe_fd[1], 1 << 16, policy) < 0) {
+		perror("eh_log_async_init");
+		exit(1);
+	}
+	eh_log_set_backend(eh_log_async);
+	eh_log_set_backendv(eh_log_asyncv);
+	bench(loop, label);
+	eh_log_set_backend(eh_log_stderr);
+	eh_log_set_backendv(NULL);
+	eh_log_async_finish();
+	if (policy == EH_LOG_ASYNC_DROP)
+		printf("  %-12s %lu lines dropped\n", "", eh_log_async_dropped());
+	drain();
+}
+
+/* eh_log_stderr() as it was, a clock read and snprintf() per line */
+static ssize_t old_stderr(const char *name, enum eh_log_level level, int code,
+			  const char *str, ssize_t str_len)
+{
+	struct iovec v[9];
+	struct timeval tv;
+	char buf[1024];
+	char *p = buf;
+	int l=0, l2, pl=sizeof(buf);
+
+	if (gettimeofday(&tv, NULL) == 0) {
+		l2 = snprintf(p, pl, "[%lu.%06lu] ",
+			     (unsigned long)tv.tv_sec,
+			     (unsigned long)tv.tv_usec);
+		v[l++] = (struct iovec) { p, l2 };
+		p += l2;
+		pl -= l2;
+	}
+
+	l2 = snprintf(p, pl, "<%u> ", level);
+	v[l++] = (struct iovec) { p, l2 };
+	p += l2;
+	pl -= l2;
+
+	v[l++] = (struct iovec) { (void*)name, (size_t)strlen(name) };
+	l2 = snprintf(p, pl, ": %u: ", code);
+	v[l++] = (struct iovec) { p, l2 };
+
+	if (str_len < 0)
+		str_len = strlen(str);
+	v[l++] = (struct iovec) { (void*)str, (size_t)str_len };
+	v[l++] = (struct iovec) { "\n", 1 };
+
+	return writev(2, v, l);
+}
+
+#define MSG	"a line for the throughput benchmark"
+
+/* fed != 0 updates the timestamp every fed lines, as a loop would */
+static void throughput(const char *label, eh_log_f f, unsigned lines, unsigned fed)
+{
+	double t = now();
+
+	for (unsigned i = 0; i < lines; i++) {
+		if (fed && i % fed == 0)
+			eh_log_timestamp_update(now());
+		if (f)
+			f("server", EH_LOG_INFO, 42, NULL, 0, MSG, sizeof(MSG) - 1);
+		else
+			old_stderr("server", EH_LOG_INFO, 42, MSG, sizeof(MSG) - 1);
+	}
+	t = now() - t;
+	eh_log_timestamp_update(-1);
+
+	printf("  %-22s %10.0f lines/s\n", label, lines / t);
+}
+
+/* the same through eh_log_rawf(), whatever backends are installed */
+static void throughput_f(const char *label, unsigned lines, unsigned fed)
+{
+	double t = now();
+
+	for (unsigned i = 0; i < lines; i++) {
+		if (fed && i % fed == 0)
+			eh_log_timestamp_update(now());
+		eh_log_rawf("server", EH_LOG_INFO, 42, NULL, 0,
+			    "line %u for the throughput benchmark", i);
+	}
+	t = now() - t;
+	eh_log_timestamp_update(-1);
+
+	printf("  %-22s %10.0f lines/s\n", label, lines / t);
+}
+
+/* a file size limit stands in for a full disk */
+static int check_file_space(const char *path)
+{
+	struct rlimit old, rl;
+	bool ok;
+
+	getrlimit(RLIMIT_FSIZE, &old);
+	rl = old;
+	rl.rlim_cur = 1 << 20;
+	signal(SIGXFSZ, SIG_IGN);
+	setrlimit(RLIMIT_FSIZE, &rl);
+
+	ok = eh_log_file_init(path, 4 << 20, 0) < 0 && errno == EFBIG &&
+		access(path, F_OK) < 0;
+	setrlimit(RLIMIT_FSIZE, &old);
+
+	printf("check: %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	struct ev_loop *loop = ev_default_loop(0);
+	pthread_t thread;
+	unsigned lines = argc > 3 ? (unsigned)atoi(argv[3]) : 1000000;
+	int null_fd, fd;
+	char path[64];
+
+	run.iterations = argc > 1 ? (unsigned)atoi(argv[1]) : 5000;
+	run.lines = argc > 2 ? (unsigned)atoi(argv[2]) : 10;
+	if (run.iterations == 0 || (run.lat = calloc(run.iterations, sizeof(double))) == NULL)
+		return 1;
+
+	/* stderr goes to the slow pipe */
+	if (pipe(pipe_fd) < 0 || dup2(pipe_fd[1], 2) < 0 ||
+	    pthread_create(&thread, NULL, consumer, NULL) != 0) {
+		perror("pipe");
+		return 1;
+	}
+	eh_log_init(EH_LOG_INFO);
+
+	printf("%u loop iterations logging %u lines each, consumer at ~%u KB/s:\n",
+	       run.iterations, run.lines, CONSUMER_CHUNK * (1000000 / CONSUMER_SLEEP) / 1024);
+	bench(loop, "stderr");
+	drain();
+	bench_async(loop, "async drop", EH_LOG_ASYNC_DROP);
+	bench_async(loop, "async block", EH_LOG_ASYNC_BLOCK);
+
+	__atomic_store_n(&consumer_stop, true, __ATOMIC_RELAXED);
+	close(pipe_fd[1]);
+	close(2);
+	pthread_join(thread, NULL);
+	free(run.lat);
+
+	/* now the cost of the line itself */
+	if ((null_fd = open("/dev/null", O_WRONLY)) < 0 || dup2(null_fd, 2) < 0) {
+		perror("/dev/null");
+		return 1;
+	}
+	printf("%u lines to /dev/null with timestamps:\n", lines);
+	throughput("gettimeofday+snprintf", NULL, lines, 0);
+	eh_log_stderr_timestamp(EH_LOG_TIMESTAMP_EPOCH);
+	throughput("epoch, clock per line", eh_log_stderr, lines, 0);
+	throughput("epoch, cached", eh_log_stderr, lines, 100);
+	eh_log_stderr_timestamp(EH_LOG_TIMESTAMP_ISO8601);
+	throughput("iso8601, cached", eh_log_stderr, lines, 100);
+
+	/* and into a file */
+	snprintf(path, sizeof(path), "/tmp/eh_log_bench.%d", (int)getpid());
+	if (check_file_space(path) < 0)
+		return 1;
+
+	printf("%u lines to %s:\n", lines, path);
+	if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0644)) < 0 || dup2(fd, 2) < 0) {
+		perror(path);
+		return 1;
+	}
+	throughput("eh_log_stderr", eh_log_stderr, lines, 100);
+	close(fd);
+	dup2(null_fd, 2);
+
+	if (eh_log_file_init(path, 64 << 20, 0) < 0) {
+		perror("eh_log_file_init");
+		return 1;
+	}
+	throughput("eh_log_file", eh_log_file, lines, 100);
+	eh_log_set_backend(eh_log_file);
+	throughput_f("eh_log_file, printf", lines, 100);
+	eh_log_set_backendv(eh_log_filev);
+	throughput_f("eh_log_filev, printf", lines, 100);
+	eh_log_set_backendv(NULL);
+	eh_log_set_backend(eh_log_stderr);
+	eh_log_file_finish();
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * writes a binary log and checks eh_log_binary_decode() renders it back.
+ *
+ *   eh_log_binary_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_list.h"
+#include "eh_log.h"
+
+static unsigned fails;
+static const char *errno_fmt = "open: %m";
+
+static void expect(const char *out, const char *want)
+{
+	if (strstr(out, want) == NULL) {
+		fprintf(stderr, "missing \"%s\"\n", want);
+		fails++;
+	}
+}
+
+static void reject(const char *out, const char *unwanted)
+{
+	if (strstr(out, unwanted) != NULL) {
+		fprintf(stderr, "unexpected \"%s\"\n", unwanted);
+		fails++;
+	}
+}
+
+int main(void)
+{
+	char log[] = "/tmp/eh_log_binary_test.XXXXXX";
+	char txt[] = "/tmp/eh_log_binary_test.txt.XXXXXX";
+	int log_fd = mkstemp(log), txt_fd = mkstemp(txt);
+	static char out[1 << 20], big[64 * 1024];
+	ssize_t n;
+	char *slice;
+
+	if (log_fd < 0 || txt_fd < 0 || eh_log_binary_init(log, 1 << 20) < 0) {
+		perror("eh_log_binary_init");
+		return 1;
+	}
+	close(log_fd);
+
+	/* a slice without terminator, exactly as big as it says */
+	if ((slice = malloc(5)) == NULL)
+		return 1;
+	memcpy(slice, "slice", 5);
+	eh_log_binary("test", EH_LOG_INFO, -1, NULL, 0, slice, 5);
+	eh_log_binary("test", EH_LOG_INFO, -1, NULL, 0, "terminated tail", 10);
+	eh_log_binaryf("test", EH_LOG_INFO, -1, NULL, 0, "[%.*s]", 3, "abcdef");
+	eh_log_binaryf("test", EH_LOG_INFO, -1, NULL, 0, "[%.2s]", "xyz");
+	free(slice);
+
+	/* errno when logged, not when decoded. %m is a pedantic warning */
+	errno = ENOENT;
+	eh_log_binaryf("test", EH_LOG_INFO, -1, NULL, 0, errno_fmt);
+	errno = 0;
+
+	/* bigger than any fixed buffer the decoder might have */
+	memset(big, 'x', sizeof(big) - 2);
+	big[sizeof(big) - 2] = '!';
+	big[sizeof(big) - 1] = '\0';
+	eh_log_binaryf("test", EH_LOG_INFO, -1, NULL, 0, "big %s end", big);
+
+	eh_log_binary_finish();
+	if (eh_log_binary_decode(log, txt_fd) < 0) {
+		perror("eh_log_binary_decode");
+		return 1;
+	}
+
+	if ((n = pread(txt_fd, out, sizeof(out) - 1, 0)) < 0)
+		return 1;
+	out[n] = '\0';
+
+	expect(out, "slice\n");
+	expect(out, "terminated\n");
+	reject(out, "terminated tail");
+	expect(out, "[abc]");
+	expect(out, "[xy]");
+	expect(out, strerror(ENOENT));
+	expect(out, "x! end\n");
+
+	unlink(log);
+	unlink(txt);
+
+	printf("binary log: %s\n", fails ? "FAILED" : "ok");
+	return fails ? 1 : 0;
+}
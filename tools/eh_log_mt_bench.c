@@ -0,0 +1,198 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * many threads logging into a pipe at once, lines/s through
+ * eh_log_stderr(), through eh_log_stderr() serialized by a mutex as it
+ * used to be, and through eh_log_async(). the reader checks that every
+ * line arrives whole and in order for its thread.
+ *
+ *   eh_log_mt_bench [threads] [lines per thread]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <ev.h>
+
+#include "eh.h"
+#include "eh_list.h"
+#include "eh_log.h"
+
+#define MAX_THREADS	64
+
+static int pipe_fd[2];
+static unsigned threads, lines;
+static int err_fd;	/* the real stderr */
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* reads "<6> tN: line S ...\n" until EOF, S counting up for every N */
+static struct {
+	unsigned next[MAX_THREADS];
+	unsigned long count, bad;
+} seen;
+
+static void check_line(const char *p, size_t len)
+{
+	unsigned n, seq;
+
+	if (sscanf(p, "<%*u> t%u: line %u ", &n, &seq) != 2 || n >= threads ||
+	    seq != seen.next[n] || p[len - 1] != '.')
+		seen.bad++;
+	else
+		seen.next[n]++;
+	seen.count++;
+}
+
+static void *reader(void *UNUSED(arg))
+{
+	static char buf[1 << 16];
+	size_t have = 0;
+	ssize_t l;
+
+	while ((l = read(pipe_fd[0], buf + have, sizeof(buf) - 1 - have)) > 0 ||
+	       (l < 0 && errno == EINTR)) {
+		char *p = buf, *nl;
+
+		have += l > 0 ? l : 0;
+		buf[have] = '\0';
+		while ((nl = memchr(p, '\n', buf + have - p)) != NULL) {
+			*nl = '\0';
+			check_line(p, nl - p);
+			p = nl + 1;
+		}
+		have -= p - buf;
+		memmove(buf, p, have);
+	}
+	return NULL;
+}
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* one line at a time, as eh_log_stderr() was */
+static ssize_t locked_stderr(const char *name, enum eh_log_level level, int code,
+			     const char *dump, size_t dump_len,
+			     const char *str, ssize_t str_len)
+{
+	ssize_t ret;
+
+	pthread_mutex_lock(&lock);
+	ret = eh_log_stderr(name, level, code, dump, dump_len, str, str_len);
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+static void *writer(void *arg)
+{
+	unsigned n = (unsigned)(uintptr_t)arg;
+	char name[16];
+
+	snprintf(name, sizeof(name), "t%u", n);
+	for (unsigned i = 0; i < lines; i++)
+		eh_log_rawf(name, EH_LOG_INFO, 0, NULL, 0,
+			    "line %u of the multi-threaded stress benchmark, long enough to look real.", i);
+	return NULL;
+}
+
+static int bench(const char *label, eh_log_f f)
+{
+	pthread_t w[MAX_THREADS], r;
+	bool async = (f == eh_log_async);
+	bool ok = true;
+	double t;
+
+	if (pipe(pipe_fd) < 0 || (!async && dup2(pipe_fd[1], 2) < 0) ||
+	    (async && eh_log_async_init(pipe_fd[1], 1 << 16, EH_LOG_ASYNC_BLOCK) < 0)) {
+		perror(label);
+		exit(1);
+	}
+	memset(&seen, 0, sizeof(seen));
+	pthread_create(&r, NULL, reader, NULL);
+	eh_log_set_backend(f);
+	eh_log_set_backendv(async ? eh_log_asyncv : NULL);
+
+	t = now();
+	for (unsigned i = 0; i < threads; i++)
+		pthread_create(&w[i], NULL, writer, (void *)(uintptr_t)i);
+	for (unsigned i = 0; i < threads; i++)
+		pthread_join(w[i], NULL);
+	if (async)
+		eh_log_async_finish();
+	t = now() - t;
+
+	/* the reader stops at EOF */
+	eh_log_set_backend(eh_log_stderr);
+	eh_log_set_backendv(NULL);
+	close(pipe_fd[1]);
+	if (!async)
+		dup2(err_fd, 2);
+	pthread_join(r, NULL);
+	close(pipe_fd[0]);
+
+	for (unsigned i = 0; i < threads; i++)
+		ok = ok && seen.next[i] == lines;
+	ok = ok && seen.bad == 0;
+
+	printf("  %-16s %10.0f lines/s  %s\n", label, threads * lines / t,
+	       ok ? "ok" : "FAILED");
+	return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+
+	threads = argc > 1 ? (unsigned)atoi(argv[1]) : 8;
+	lines = argc > 2 ? (unsigned)atoi(argv[2]) : 200000;
+	if (threads == 0 || threads > MAX_THREADS) {
+		fprintf(stderr, "%s: threads must be 1 to %u\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	err_fd = dup(2);
+	eh_log_init(EH_LOG_INFO);
+	printf("%u threads logging %u lines each into a pipe:\n", threads, lines);
+	ret |= bench("mutex+writev", locked_stderr);
+	ret |= bench("eh_log_stderr", eh_log_stderr);
+	ret |= bench("eh_log_async", eh_log_async);
+	return ret ? 1 : 0;
+}
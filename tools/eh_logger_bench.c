@@ -0,0 +1,126 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * eh_logger_get() cost with many loggers registered, against the linear
+ * strcmp() scan it replaced. also checks that every name is found, that
+ * a new name is created once and that prefix levels reach existing
+ * loggers.
+ *
+ *   eh_logger_bench [loggers] [lookups]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "eh.h"
+#include "eh_list.h"
+#include "eh_log.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the old lookup, a strcmp() per registered logger */
+static struct eh_logger *linear_get(struct eh_logger **v, size_t n, const char *name)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (strcmp(v[i]->name, name) == 0)
+			return v[i];
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? (size_t)atol(argv[1]) : 10000;
+	size_t lookups = argc > 2 ? (size_t)atol(argv[2]) : 1000000;
+	struct eh_logger **v = calloc(count, sizeof(*v));
+	char (*names)[32] = calloc(count, sizeof(*names));
+	size_t linear_lookups = lookups / 100, found = 0;
+	bool ok = true;
+	double t;
+
+	if (count == 0 || v == NULL || names == NULL)
+		return 1;
+
+	eh_log_init(EH_LOG_INFO);
+	for (size_t i = 0; i < count; i++) {
+		snprintf(names[i], sizeof(names[i]), "server.conn.%zu", i);
+		if ((v[i] = eh_logger_new(names[i])) == NULL) {
+			perror("eh_logger_new");
+			return 1;
+		}
+	}
+
+	/* every name resolves to its logger, a new one is created once */
+	for (size_t i = 0; i < count; i++)
+		ok = ok && eh_logger_get(names[i]) == v[i];
+	ok = ok && eh_logger_get("server.other") == eh_logger_get("server.other");
+	eh_log_set_level("server.conn.*", EH_LOG_DEBUG);
+	ok = ok && v[0]->level == EH_LOG_DEBUG && v[count - 1]->level == EH_LOG_DEBUG;
+	printf("check: %s\n", ok ? "ok" : "FAILED");
+	if (!ok)
+		return 1;
+
+	printf("%zu loggers:\n", count);
+
+	t = now();
+	for (size_t i = 0; i < lookups; i++)
+		found += eh_logger_get(names[(i * 7919) % count]) != NULL;
+	t = now() - t;
+	printf("  eh_logger_get  %10.1f ns/lookup\n", t * 1e9 / lookups);
+
+	t = now();
+	for (size_t i = 0; i < lookups; i++)
+		found += eh_logger_getf("server.conn.%zu", (i * 7919) % count) != NULL;
+	t = now() - t;
+	printf("  eh_logger_getf %10.1f ns/lookup\n", t * 1e9 / lookups);
+
+	t = now();
+	for (size_t i = 0; i < linear_lookups; i++)
+		found += linear_get(v, count, names[(i * 7919) % count]) != NULL;
+	t = now() - t;
+	printf("  linear strcmp  %10.1f ns/lookup\n", t * 1e9 / linear_lookups);
+
+	if (found != 2 * lookups + linear_lookups)
+		return 1;
+
+	eh_log_finish();
+	free(names);
+	free(v);
+	return 0;
+}
@@ -0,0 +1,314 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * read policies over a socketpair fed by a thread with lines, into a
+ * 4KB buffer unless said otherwise: one read() per wakeup, reading again
+ * while reads fill the buffer (what eh_connection does), asking FIONREAD
+ * first, readv() into the free tail and the head gap, and a buffer grown
+ * to the 64KB eh_buffer allows. eh_connection itself runs last, as is
+ * and moving hot connections up to 1MB overflow blocks.
+ *
+ *   eh_read_bench [MB] [line]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include <ev.h>
+
+#include "eh.h"
+#include "eh_buffer.h"
+#include "eh_connection.h"
+
+#define READ_LOOPS	8	/* as eh_connection */
+#define SMALL		4096
+#define BIG		65535
+
+static size_t total, line;
+static int fds[2];
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *writer(void *UNUSED(arg))
+{
+	static char chunk[1 << 16];
+	size_t per = sizeof(chunk) / line * line;
+
+	for (size_t i = 0; i + line <= per; i += line) {
+		memset(chunk + i, 'x', line - 1);
+		chunk[i + line - 1] = '\n';
+	}
+
+	for (size_t sent = 0; sent < total; ) {
+		size_t n = total - sent < per ? total - sent : per;
+		ssize_t l = write(fds[1], chunk, n);
+
+		if (l < 0 && errno != EINTR) {
+			perror("write");
+			exit(1);
+		}
+		sent += l > 0 ? l : 0;
+	}
+	return NULL;
+}
+
+/*
+ * the consumer, whole lines at a time
+ */
+static size_t received, lines;
+
+static size_t consume(const char *data, size_t len)
+{
+	const char *p = data, *end = data + len, *nl;
+
+	while ((nl = memchr(p, '\n', end - p)) != NULL) {
+		lines++;
+		p = nl + 1;
+	}
+	return p - data;
+}
+
+struct stats {
+	double t;
+	unsigned long wakeups, reads, ioctls;
+};
+
+enum policy { ONCE, AGAIN, FIONREAD_FIRST, READV };
+
+/* eh_buffer based */
+static void run_linear(enum policy policy, size_t size, struct stats *st)
+{
+	static char mem[BIG];
+	struct eh_buffer b;
+	struct pollfd pfd = { .fd = fds[0], .events = POLLIN };
+
+	eh_buffer_init(&b, mem, size);
+
+	while (received < total) {
+		int loops = policy == ONCE ? 1 : READ_LOOPS;
+
+		poll(&pfd, 1, -1);
+		st->wakeups++;
+
+		while (loops-- > 0) {
+			size_t want = 0;
+			bool eof = false, more;
+			ssize_t l;
+
+			if (policy == FIONREAD_FIRST) {
+				int avail = 0;
+
+				st->ioctls++;
+				if (ioctl(fds[0], FIONREAD, &avail) < 0 || avail == 0)
+					break;
+				want = avail;
+			}
+
+			st->reads++;
+			if ((l = eh_buffer_read(&b, fds[0], &eof)) <= 0)
+				break;
+			received += l;
+			more = policy == FIONREAD_FIRST ? want > (size_t)l :
+				eh_buffer_freetail(&b) == 0;
+			eh_buffer_skip(&b, consume(eh_buffer_data(&b), eh_buffer_len(&b)));
+			if (!more)
+				break;
+		}
+	}
+}
+
+/* a ring, read with readv() and made linear for the consumer */
+static void run_readv(size_t size, struct stats *st)
+{
+	static char mem[BIG], tmp[BIG];
+	size_t base = 0, len = 0;
+	struct pollfd pfd = { .fd = fds[0], .events = POLLIN };
+
+	while (received < total) {
+		int loops = READ_LOOPS;
+
+		poll(&pfd, 1, -1);
+		st->wakeups++;
+
+		while (loops-- > 0) {
+			size_t tail = base + len, room = size - len;
+			struct iovec v[2];
+			int n = 0;
+			bool more;
+			ssize_t l;
+
+			if (room == 0)
+				break;
+			if (tail < size) {
+				v[n++] = (struct iovec) { mem + tail, size - tail };
+				if (base > 0)
+					v[n++] = (struct iovec) { mem, base };
+			} else {
+				v[n++] = (struct iovec) { mem + tail - size, room };
+			}
+
+			st->reads++;
+			if ((l = readv(fds[0], v, n)) <= 0)
+				break;
+			received += l;
+			len += l;
+
+			/* wrapped, on_read() needs the bytes in one piece */
+			if (base + len > size) {
+				size_t first = size - base;
+
+				memcpy(tmp, mem + base, first);
+				memcpy(tmp + first, mem, len - first);
+				memcpy(mem, tmp, len);
+				base = 0;
+			}
+
+			more = (size_t)l == room;
+			l = consume(mem + base, len);
+			base += l;
+			len -= l;
+			if (len == 0)
+				base = 0;
+			if (!more)
+				break;
+		}
+	}
+}
+
+/* the real thing */
+static ssize_t on_read(struct eh_connection *UNUSED(c), char *data, size_t len)
+{
+	size_t l = consume(data, len);
+
+	received += l;
+	return l;
+}
+
+static void on_close(struct eh_connection *UNUSED(c))
+{
+}
+
+static struct eh_connection_cb cb = { .on_read = on_read, .on_close = on_close };
+
+static void run_connection(size_t size, size_t overflow, struct stats *st)
+{
+	static char rbuf[BIG], wbuf[16];
+	struct ev_loop *loop = ev_default_loop(0);
+	struct eh_connection c;
+
+	eh_connection_init(&c, fds[0], &cb, rbuf, size, wbuf, sizeof(wbuf));
+	eh_connection_set_overflow(&c, overflow);
+	eh_connection_start(&c, loop);
+	while (received < total)
+		ev_run(loop, EVRUN_ONCE);
+	eh_connection_stop(&c);
+
+	st->wakeups = c.read_events;
+	st->reads = c.read_calls;
+	eh_connection_finish(&c); /* closes fds[0] */
+	fds[0] = -1;
+}
+
+static int bench(const char *label, int kind, enum policy policy, size_t size)
+{
+	struct stats st = { 0 };
+	pthread_t w;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+	received = lines = 0;
+	st.t = now();
+	pthread_create(&w, NULL, writer, NULL);
+	if (kind == 0)
+		run_linear(policy, size, &st);
+	else if (kind == 1)
+		run_readv(size, &st);
+	else
+		run_connection(size, kind == 3 ? 1 << 20 : 0, &st);
+	pthread_join(w, NULL);
+	st.t = now() - st.t;
+
+	if (fds[0] >= 0)
+		close(fds[0]);
+	close(fds[1]);
+
+	printf("  %-14s %8.1f MB/s %8lu wakeups %8lu reads %8lu ioctls %6.0f bytes/read\n",
+	       label, total / st.t / 1e6, st.wakeups, st.reads, st.ioctls,
+	       (double)total / st.reads);
+	return lines == total / line ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+
+	total = (argc > 1 ? (size_t)atol(argv[1]) : 256) << 20;
+	line = argc > 2 ? (size_t)atol(argv[2]) : 50;
+	if (line < 2 || line > SMALL) {
+		fprintf(stderr, "usage: %s [MB] [line<=%u]\n", argv[0], SMALL);
+		return 1;
+	}
+	total = total / line * line;
+
+	printf("%zu MB of %zu byte lines\n", total >> 20, line);
+	ret |= bench("once", 0, ONCE, SMALL);
+	ret |= bench("again", 0, AGAIN, SMALL);
+	ret |= bench("fionread", 0, FIONREAD_FIRST, SMALL);
+	ret |= bench("readv", 1, AGAIN, SMALL);
+	ret |= bench("again 64KB", 0, AGAIN, BIG);
+	ret |= bench("eh_connection", 2, AGAIN, SMALL);
+	ret |= bench("  hot, 1MB", 3, AGAIN, SMALL);
+
+	printf("check: %s\n", ret == 0 ? "ok" : "FAILED");
+	return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,349 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * load for a RESP server in the way of redis-benchmark: clients each
+ * keep pipeline commands in flight, PING, SET and GET in turn, and every
+ * reply is checked. eh_resp_read() batching is checked first.
+ *
+ *   eh_resp_cache 6380 &
+ *   eh_resp_bench [port] [clients] [pipeline] [requests]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <ev.h>
+
+#include "eh.h"
+#include "eh_alloc.h"
+#include "eh_watcher.h"
+#include "eh_resp.h"
+
+#define MAX_VALUES	16
+#define VALUE		"xxx"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * eh_resp_read() batches
+ */
+static size_t commands, batches, last_batch;
+
+static bool count_command(struct eh_resp *UNUSED(r), const struct eh_resp_value *UNUSED(argv),
+			  size_t UNUSED(argc))
+{
+	commands++;
+	return true;
+}
+
+static void count_batch(struct eh_resp *UNUSED(r), size_t count)
+{
+	batches++;
+	last_batch = count;
+}
+
+/* 100 commands come in batches of 64 and 36, and a bad one after 2 still gets on_batch() */
+static int check(void)
+{
+	struct eh_resp_cb cb = { count_command, count_batch };
+	struct eh_resp_value values[MAX_VALUES];
+	struct eh_resp resp;
+	static const char ping[] = "*1\r\n$4\r\nPING\r\n";
+	char data[100 * (sizeof(ping) - 1) + 16];
+	size_t len = 0, off = 0;
+	ssize_t l;
+	bool ok = true;
+
+	for (unsigned i = 0; i < 100; i++, len += sizeof(ping) - 1)
+		memcpy(data + len, ping, sizeof(ping) - 1);
+
+	eh_resp_init(&resp, &cb, values, ELEMENTS(values));
+	while (off < len && (l = eh_resp_read(&resp, data + off, len - off)) > 0)
+		off += l;
+	if (off != len || commands != 100 || batches != 2 || last_batch != 36)
+		ok = false;
+
+	commands = batches = 0;
+	memcpy(data + 2 * (sizeof(ping) - 1), "$x\r\n", 4);
+	if (eh_resp_read(&resp, data, 2 * (sizeof(ping) - 1) + 4) != -1 || errno != EBADMSG ||
+	    commands != 2 || batches != 1 || last_batch != 2)
+		ok = false;
+
+	printf("check: %s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : -1;
+}
+
+/*
+ * load
+ */
+struct client {
+	ev_io watcher;
+	int fd;
+
+	char key[16];
+	char *cmd;		/* pipeline commands */
+	size_t cmd_len;
+
+	unsigned inflight;
+	double sent_at;
+
+	char in[65536];
+	size_t in_len;
+};
+
+enum test { PING, SET, GET };
+
+static const char *const test_name[] = { "PING", "SET", "GET" };
+
+static struct {
+	enum test test;
+	unsigned pipeline;
+	size_t requests, issued, done;
+	bool failed;
+
+	double *rtt;		/* of every pipeline round */
+	size_t rtt_count, rtt_size;
+} run;
+
+static bool reply_ok(const struct eh_resp_value *v, size_t count)
+{
+	if (count != 1 || v->null)
+		return false;
+
+	switch (run.test) {
+	case PING:
+		return v->type == EH_RESP_SIMPLE && v->len == 4 && memcmp(v->str, "PONG", 4) == 0;
+	case SET:
+		return v->type == EH_RESP_SIMPLE && v->len == 2 && memcmp(v->str, "OK", 2) == 0;
+	case GET:
+		return v->type == EH_RESP_BULK && v->len == sizeof(VALUE) - 1 &&
+			memcmp(v->str, VALUE, v->len) == 0;
+	}
+	return false;
+}
+
+static void fire(struct client *c)
+{
+	unsigned n = run.pipeline;
+	size_t one = c->cmd_len / run.pipeline;
+
+	if (run.requests - run.issued < n)
+		n = run.requests - run.issued;
+	if (n == 0)
+		return;
+
+	/* a pipeline fits the socket buffer */
+	if (write(c->fd, c->cmd, one * n) != (ssize_t)(one * n)) {
+		perror("write");
+		exit(1);
+	}
+	run.issued += n;
+	c->inflight = n;
+	c->sent_at = now();
+}
+
+static void on_reply(struct ev_loop *loop, ev_io *w, int UNUSED(revents))
+{
+	struct client *c = w->data;
+	struct eh_resp_value values[MAX_VALUES];
+	size_t off = 0, count;
+	ssize_t l = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+
+	if (l <= 0) {
+		if (l < 0 && errno == EAGAIN)
+			return;
+		fprintf(stderr, "connection lost\n");
+		exit(1);
+	}
+	c->in_len += l;
+
+	while ((l = eh_resp_parse(c->in + off, c->in_len - off, values,
+				  ELEMENTS(values), &count)) > 0) {
+		if (!reply_ok(values, count))
+			run.failed = true;
+		off += l;
+		run.done++;
+		c->inflight--;
+	}
+	if (l < 0) {
+		run.failed = true;
+		ev_break(loop, EVBREAK_ALL);
+		return;
+	}
+	memmove(c->in, c->in + off, c->in_len - off);
+	c->in_len -= off;
+
+	if (c->inflight == 0) {
+		if (run.rtt_count < run.rtt_size)
+			run.rtt[run.rtt_count++] = now() - c->sent_at;
+		fire(c);
+	}
+	if (run.done == run.requests)
+		ev_break(loop, EVBREAK_ALL);
+}
+
+static int command(char *out, enum test test, const char *key)
+{
+	size_t kl = strlen(key);
+
+	switch (test) {
+	case PING:
+		return sprintf(out, "*1\r\n$4\r\nPING\r\n");
+	case SET:
+		return sprintf(out, "*3\r\n$3\r\nSET\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n",
+			       kl, key, sizeof(VALUE) - 1, VALUE);
+	case GET:
+		return sprintf(out, "*2\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n", kl, key);
+	}
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static int bench(struct ev_loop *loop, struct client *clients, unsigned n, enum test test)
+{
+	double t;
+
+	run.test = test;
+	run.issued = run.done = run.rtt_count = 0;
+
+	for (unsigned i = 0; i < n; i++) {
+		struct client *c = &clients[i];
+		char one[128];
+		int l = command(one, test, c->key);
+
+		c->cmd_len = 0;
+		for (unsigned j = 0; j < run.pipeline; j++, c->cmd_len += l)
+			memcpy(c->cmd + c->cmd_len, one, l);
+	}
+
+	t = now();
+	for (unsigned i = 0; i < n; i++)
+		fire(&clients[i]);
+	ev_run(loop, 0);
+	t = now() - t;
+
+	if (run.failed || run.done != run.requests) {
+		printf("%-6s FAILED\n", test_name[test]);
+		return -1;
+	}
+
+	qsort(run.rtt, run.rtt_count, sizeof(double), cmp_double);
+	printf("%-6s %10.0f ops/s   p50 %7.0f us   p99 %7.0f us\n", test_name[test],
+	       run.requests / t, run.rtt[run.rtt_count / 2] * 1e6,
+	       run.rtt[run.rtt_count * 99 / 100] * 1e6);
+	return 0;
+}
+
+static int connect_to(unsigned port)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(port) };
+	int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	struct ev_loop *loop = ev_default_loop(0);
+	unsigned port = argc > 1 ? (unsigned)atoi(argv[1]) : 6380;
+	unsigned n = argc > 2 ? (unsigned)atoi(argv[2]) : 50;
+	struct client *clients;
+	int ret = 0;
+
+	run.pipeline = argc > 3 ? (unsigned)atoi(argv[3]) : 16;
+	run.requests = argc > 4 ? (size_t)atol(argv[4]) : 1000000;
+	run.rtt_size = run.requests / run.pipeline + n;
+
+	if (check() < 0)
+		return 1;
+
+	if (n == 0 || run.pipeline == 0 || run.pipeline > 256) {
+		fprintf(stderr, "usage: %s [port] [clients] [pipeline<=256] [requests]\n", argv[0]);
+		return 1;
+	}
+
+	clients = calloc(n, sizeof(*clients));
+	run.rtt = calloc(run.rtt_size, sizeof(double));
+	if (clients == NULL || run.rtt == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	for (unsigned i = 0; i < n; i++) {
+		struct client *c = &clients[i];
+
+		if ((c->fd = connect_to(port)) < 0 ||
+		    (c->cmd = malloc(run.pipeline * 128)) == NULL) {
+			fprintf(stderr, "%s: %u: %s\n", argv[0], port, strerror(errno));
+			return 1;
+		}
+		snprintf(c->key, sizeof(c->key), "key:%u", i);
+		eh_io_init(&c->watcher, on_reply, c, c->fd, EH_READ);
+		eh_io_start(&c->watcher, loop);
+	}
+
+	printf("%u clients, pipeline %u, %zu requests\n", n, run.pipeline, run.requests);
+	for (enum test t = PING; t <= GET; t++) {
+		if (bench(loop, clients, n, t) < 0)
+			ret = 1;
+	}
+	return ret;
+}
@@ -0,0 +1,245 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * minimal in-memory cache speaking RESP, an example of eh_resp and a
+ * target for redis-benchmark, i.e.
+ *
+ *   eh_resp_cache 6380 &
+ *   redis-benchmark -p 6380 -t ping,set,get -P 16 -q
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <ev.h>
+
+#include "eh.h"
+#include "eh_alloc.h"
+#include "eh_buffer.h"
+#include "eh_connection.h"
+#include "eh_server.h"
+#include "eh_resp.h"
+
+#define BUCKETS		(1 << 16)
+#define MAX_ARGS	64
+
+struct entry {
+	struct entry *next;
+	size_t key_len, value_len;
+	char data[]; /* key, then value */
+};
+
+static struct entry *cache[BUCKETS];
+
+static inline unsigned hash(const char *s, size_t len)
+{
+	uint32_t h = 2166136261u;
+	while (len--)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h & (BUCKETS - 1);
+}
+
+static struct entry **lookup(const char *key, size_t len)
+{
+	struct entry **e = &cache[hash(key, len)];
+	for (; *e; e = &(*e)->next) {
+		if ((*e)->key_len == len && memcmp((*e)->data, key, len) == 0)
+			break;
+	}
+	return e;
+}
+
+struct client {
+	struct eh_connection conn;
+	struct eh_resp resp;
+
+	struct eh_resp_value values[MAX_ARGS + 1];
+	char read_buf[16384];
+	char write_buf[65535];
+};
+
+#define is_cmd(A, S)	((A).len == sizeof(S) - 1 && strncasecmp((A).str, S, (A).len) == 0)
+#define REPLY(X)	do { if ((X) < 0) goto full; } while (0)
+
+static bool reply(struct client *c, const struct eh_resp_value *argv, size_t argc)
+{
+	struct eh_buffer *out = &c->conn.write_buffer;
+
+	if (is_cmd(argv[0], "PING")) {
+		if (argc > 1)
+			REPLY(eh_resp_put_bulk(out, argv[1].str, argv[1].len));
+		else
+			REPLY(eh_resp_put_simple(out, "PONG", 4));
+	} else if (is_cmd(argv[0], "ECHO") && argc == 2) {
+		REPLY(eh_resp_put_bulk(out, argv[1].str, argv[1].len));
+	} else if (is_cmd(argv[0], "GET") && argc == 2) {
+		struct entry *e = *lookup(argv[1].str, argv[1].len);
+		if (e)
+			REPLY(eh_resp_put_bulk(out, e->data + e->key_len, e->value_len));
+		else
+			REPLY(eh_resp_put_null(out, false));
+	} else if (is_cmd(argv[0], "SET") && argc == 3) {
+		struct entry **p = lookup(argv[1].str, argv[1].len), *e;
+
+		if ((e = eh_alloc(sizeof(*e) + argv[1].len + argv[2].len)) == NULL)
+			return false;
+		e->key_len = argv[1].len;
+		e->value_len = argv[2].len;
+		memcpy(e->data, argv[1].str, argv[1].len);
+		memcpy(e->data + e->key_len, argv[2].str, argv[2].len);
+
+		if (*p) {
+			e->next = (*p)->next;
+			eh_free(*p);
+		} else {
+			e->next = NULL;
+		}
+		*p = e;
+		REPLY(eh_resp_put_simple(out, "OK", 2));
+	} else if (is_cmd(argv[0], "DEL")) {
+		int64_t n = 0;
+		for (size_t i = 1; i < argc; i++) {
+			struct entry **p = lookup(argv[i].str, argv[i].len), *e = *p;
+			if (e) {
+				*p = e->next;
+				eh_free(e);
+				n++;
+			}
+		}
+		REPLY(eh_resp_put_integer(out, n));
+	} else if (is_cmd(argv[0], "CONFIG") || is_cmd(argv[0], "COMMAND")) {
+		/* redis-benchmark asks */
+		REPLY(eh_resp_put_array(out, 0));
+	} else if (is_cmd(argv[0], "QUIT")) {
+		eh_resp_put_simple(out, "OK", 2);
+		return false;
+	} else {
+		REPLY(eh_resp_put_error(out, "ERR unknown command", 19));
+	}
+	return true;
+full:
+	return false;
+}
+
+static bool on_command(struct eh_resp *resp, const struct eh_resp_value *argv, size_t argc)
+{
+	struct client *c = container_of(resp, struct client, resp);
+	struct eh_buffer *out = &c->conn.write_buffer;
+	size_t len = eh_buffer_len(out);
+
+	if (reply(c, argv, argc))
+		return true;
+	else if (eh_buffer_len(out) != len)
+		return false; /* QUIT */
+
+	/* the write buffer is full, flush what's possible and retry once */
+	if (eh_buffer_write(out, eh_connection_fd(&c->conn)) <= 0)
+		return false;
+	return reply(c, argv, argc);
+}
+
+static void on_batch(struct eh_resp *resp, size_t UNUSED(count))
+{
+	struct client *c = container_of(resp, struct client, resp);
+
+	/* the replies of the whole batch are written together */
+	eh_connection_start(&c->conn, NULL);
+}
+
+static struct eh_resp_cb resp_cb = {
+	.on_command = on_command,
+	.on_batch = on_batch,
+};
+
+static ssize_t on_read(struct eh_connection *conn, char *data, size_t len)
+{
+	struct client *c = container_of(conn, struct client, conn);
+	return eh_resp_read(&c->resp, data, len);
+}
+
+static void on_close(struct eh_connection *conn)
+{
+	struct client *c = container_of(conn, struct client, conn);
+	eh_free(c);
+}
+
+static struct eh_connection_cb conn_cb = {
+	.on_read = on_read,
+	.on_close = on_close,
+};
+
+static struct eh_connection *on_connect(struct eh_server *UNUSED(server), int fd,
+					struct sockaddr *UNUSED(addr), socklen_t UNUSED(addrlen))
+{
+	struct client *c = eh_alloc(sizeof(*c));
+
+	if (c == NULL)
+		return NULL;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	eh_connection_init(&c->conn, fd, &conn_cb,
+			   c->read_buf, sizeof(c->read_buf),
+			   c->write_buf, sizeof(c->write_buf));
+	eh_resp_init(&c->resp, &resp_cb, c->values, ELEMENTS(c->values));
+	return &c->conn;
+}
+
+int main(int argc, char **argv)
+{
+	struct ev_loop *loop = ev_default_loop(0);
+	struct eh_server server = { .on_connect = on_connect };
+	unsigned port = argc > 1 ? (unsigned)atoi(argv[1]) : 6380;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (eh_server_ipv4_tcp(&server, "127.0.0.1", port, true) <= 0 ||
+	    eh_server_listen(&server, 128) < 0) {
+		fprintf(stderr, "%s: %u: %s\n", argv[0], port, strerror(errno));
+		return 1;
+	}
+
+	eh_server_start(&server, loop);
+	ev_run(loop, 0);
+	return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * This file is part of libeh <http://github.com/amery/libeh>
+ *
+ * Copyright (c) 2011, Alejandro Mery <amery@geeks.cl>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * checks eh_scan against strtoull() and eh_fmt_cstr(), then compares
+ * their speed on numbers of every length. strtoull() is timed on
+ * terminated strings and on slices copied out to be terminated, as
+ * protocol handlers had to.
+ *
+ *   eh_scan_bench [millions of values]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+#include "eh.h"
+#include "eh_fmt.h"
+#include "eh_scan.h"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+/* xorshift64, shifted so every length shows up */
+static uint64_t rnd(void)
+{
+	uint64_t x = rnd_state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	rnd_state = x;
+	return x >> (x % 64);
+}
+
+static int check(size_t count)
+{
+	char buf[64], esc[256], back[64];
+	size_t bad = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		uint64_t n = rnd(), u;
+		int64_t s;
+		size_t l;
+
+		l = snprintf(buf, sizeof(buf), "%" PRIu64 "x", n);
+		bad += eh_scan_u64(buf, l, &u) != (ssize_t)l - 1 || u != n;
+		bad += eh_scan_u64(buf, l - 2, &u) > 0 && u != n / 10;
+
+		l = snprintf(buf, sizeof(buf), "%" PRId64, (int64_t)n);
+		bad += eh_scan_i64(buf, l, &s) != (ssize_t)l || s != (int64_t)n;
+
+		l = snprintf(buf, sizeof(buf), "%" PRIx64, n);
+		bad += eh_scan_x64(buf, l, &u) != (ssize_t)l || u != n;
+
+		/* one more digit overflows when strtoull() says so */
+		l = snprintf(buf, sizeof(buf), "%" PRIu64 "%u", n, (unsigned)(n % 10));
+		errno = 0;
+		u = strtoull(buf, NULL, 10);
+		bad += (eh_scan_u64(buf, l, &u) < 0) != (errno == ERANGE);
+
+		/* escapes read back as what was escaped */
+		for (unsigned j = 0; j < sizeof(back); j++)
+			back[j] = (char)rnd();
+		l = eh_fmt_cstr(esc, sizeof(esc), back, sizeof(back));
+		bad += eh_scan_cstr(buf, sizeof(buf), esc, l) != (ssize_t)sizeof(back) ||
+			memcmp(buf, back, sizeof(back)) != 0;
+	}
+
+	printf("check: %s\n", bad == 0 ? "ok" : "FAILED");
+	return bad == 0 ? 0 : -1;
+}
+
+static volatile uint64_t sink;	/* keeps the results alive */
+
+#define BENCH(LABEL, EXPR)	do { \
+	uint64_t sum = 0; \
+	double t = now(); \
+	for (size_t i = 0; i < count; i++) { \
+		const char *s = text + off[i]; \
+		size_t l = off[i + 1] - off[i] - 1; \
+		(void)l; \
+		sum += (EXPR); \
+	} \
+	t = now() - t; \
+	sink += sum; \
+	printf("  %-22s %8.1f ns/value\n", LABEL, t * 1e9 / count); \
+} while (0)
+
+/* what a handler without eh_scan does with a slice */
+static uint64_t copy_strtoull(const char *s, size_t l, int base)
+{
+	char buf[32];
+
+	if (l >= sizeof(buf))
+		l = sizeof(buf) - 1;
+	memcpy(buf, s, l);
+	buf[l] = '\0';
+	return strtoull(buf, NULL, base);
+}
+
+static uint64_t scan_u64(const char *s, size_t l)
+{
+	uint64_t n = 0;
+	eh_scan_u64(s, l, &n);
+	return n;
+}
+
+static uint64_t scan_x64(const char *s, size_t l)
+{
+	uint64_t n = 0;
+	eh_scan_x64(s, l, &n);
+	return n;
+}
+
+/* count numbers, each terminated, printed with fmt */
+static char *numbers(size_t count, const char *fmt, size_t *off)
+{
+	char *text = malloc(count * 21 + 1), *p = text;
+
+	if (text == NULL)
+		exit(1);
+
+	rnd_state = 88172645463325252ULL;
+	for (size_t i = 0; i < count; i++) {
+		off[i] = p - text;
+		p += sprintf(p, fmt, rnd()) + 1;
+	}
+	off[count] = p - text;
+	return text;
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = (argc > 1 ? (size_t)atol(argv[1]) : 10) * 1000000;
+	size_t *off = malloc((count + 1) * sizeof(*off));
+	char *text;
+
+	if (count == 0 || off == NULL)
+		return 1;
+
+	if (check(count / 10 + 1) < 0)
+		return 1;
+
+	printf("%zu decimal values of every length:\n", count);
+	text = numbers(count, "%" PRIu64, off);
+	BENCH("strtoull", strtoull(s, NULL, 10));
+	BENCH("copy+strtoull", copy_strtoull(s, l, 10));
+	BENCH("eh_scan_u64", scan_u64(s, l));
+	free(text);
+
+	printf("%zu hexadecimal values of every length:\n", count);
+	text = numbers(count, "%" PRIx64, off);
+	BENCH("strtoull", strtoull(s, NULL, 16));
+	BENCH("copy+strtoull", copy_strtoull(s, l, 16));
+	BENCH("eh_scan_x64", scan_x64(s, l));
+	free(text);
+
+	free(off);
+	return 0;
+}